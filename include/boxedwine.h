@@ -64,6 +64,7 @@
 #include "ktimer.h"
 #include "../source/util/synchronization.h"
 #include "../source/util/karray.h"
+#include "../source/util/kbitmap.h"
 #include "../source/util/stringutil.h"
 #include "../source/util/vectorutils.h"
 #include "../source/util/fileutils.h"
@@ -50,11 +50,28 @@ public:
 private:
     class Data {
     public:
+        Data(KEPoll* epoll);
+
+        KEPoll* epoll;
         U32 fd;
         U64 data;
         U32 events;
+        std::shared_ptr<KObject> watchedObject; // the object's conditions have cond as one of their parents
+        KListNode<Data*> readyNode;
+        BOXEDWINE_CONDITION cond;
     };
     std::unordered_map<U32, Data*> data;
+    std::vector<Data*> unusedData; // recycled instead of deleted so that a signal racing with EPOLL_CTL_DEL never sees freed memory
+    KList<Data*> readyList; // registered fds that might be ready, wait only looks at these
+    BOXEDWINE_MUTEX readyListMutex;
+    BOXEDWINE_CONDITION cond;
+
+    static void onDataSignaled(void* p);
+    void addToReadyList(Data* d);
+    void watch(Data* d);
+    void unwatch(Data* d);
+    U32 getReadyEvents(Data* d, KFileDescriptor* fd);
+    U32 collectReadyEvents(U32 events, U32 maxevents);
 };
 
 #endif
\ No newline at end of file
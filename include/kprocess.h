@@ -31,11 +31,15 @@ class Memory;
 
 class MappedFile : public BoxedPtrBase {
 public:
+    MappedFile() : address(0), len(0), offset(0), readAheadIndex(0), readAheadPages(0) {}
+
     BoxedPtr<MappedFileCache> systemCacheEntry;
     std::shared_ptr<KFile> file;
     U32 address;
     U64 len;
     U64 offset;
+    U32 readAheadIndex; // the file page after the last fault around window, a fault there means the access is sequential
+    U32 readAheadPages; // size of the last fault around window
 };
 
 #define K_SIG_INFO_SIZE 10
@@ -107,13 +111,13 @@ public:
     void killAllThreads();
     BString getAbsoluteExePath();
     void clone(const std::shared_ptr<KProcess>& from);
-    U32 getNextFileDescriptorHandle(int after);
+    S32 getNextFileDescriptorHandle(int after);
 
     BString getModuleName(U32 eip);
     U32 getModuleEip(U32 eip);    
     KFileDescriptor* allocFileDescriptor(const std::shared_ptr<KObject>& kobject, U32 accessFlags, U32 descriptorFlags, S32 handle, U32 afterHandle);
     KFileDescriptor* getFileDescriptor(FD handle);
-    void clearFdHandle(FD handle);
+    void clearFdHandle(FD handle, KFileDescriptor* fd);
     U32 openFile(BString currentDirectory, BString localPath, U32 accessFlags, KFileDescriptor** result);
     bool isStopped();
     bool isTerminated();
@@ -125,6 +129,7 @@ public:
     void printStack();
     U32 signal(U32 signal);
     void signalFd(KThread* thread, U32 signal);
+    void addPendingSignalWork();
     bool isSystemProcess() {return this->systemProcess;}
 
     void iterateThreads(std::function<bool(KThread*)> callback);
@@ -269,9 +274,30 @@ public:
 #endif
 #endif
 private:
-    std::unordered_map<U32, KFileDescriptor*> fds;
+    // getFileDescriptor is called by almost every syscall so it reads the table without taking fdsMutex, only writers
+    // take the lock.  When the table grows the entries are copied to a larger table which is then published, the old
+    // table stays allocated until the process is destroyed since another thread might still be reading from it.
+    class KFileDescriptorTable {
+    public:
+        KFileDescriptorTable(U32 size) : size(size), fds(new std::atomic<KFileDescriptor*>[size]) {
+            for (U32 i = 0; i < size; i++) {
+                this->fds[i].store(NULL, std::memory_order_relaxed);
+            }
+        }
+        ~KFileDescriptorTable() {
+            delete[] this->fds;
+        }
+        const U32 size;
+        std::atomic<KFileDescriptor*>* const fds;
+    };
+    std::atomic<KFileDescriptorTable*> fdTable;
+    std::vector<KFileDescriptorTable*> retiredFdTables;
+    KBitmap<MAX_NUMBER_OF_FILES + 1> freeFds; // a set bit means the handle is not in use
     BOXEDWINE_MUTEX fdsMutex;
 
+    void setFileDescriptor(U32 handle, KFileDescriptor* fd); // caller must hold fdsMutex
+    void getFileDescriptors(std::vector<KFileDescriptor*>& result);
+
     std::unordered_map<U32, user_desc> ldt;
     BOXEDWINE_MUTEX ldtMutex;
 
@@ -26,6 +26,7 @@ void terminateCurrentThread(KThread* thread);
 
 void addTimer(KTimer* timer);
 void removeTimer(KTimer* timer);
+U32 getNextTimer(); // milliseconds until the next timer expires
 
 bool runSlice();
 void runThreadSlice(KThread* thread);
@@ -36,4 +37,14 @@ void waitForProcessToFinish(const std::shared_ptr<KProcess>& process, KThread* t
 #endif
 U32 getMIPS();
 
+#ifdef BOXEDWINE_WORKER_THREADS
+void startSchedulerWorkers();
+void stopSchedulerWorkers();
+void waitForScheduledThread(U32 timeout); // milliseconds, at most 20
+// The native window, OpenGL and audio only run on the main thread.  Returns false after handing the thread over to it,
+// the caller then stops so that the instruction runs again over there
+bool runOnMainWorker(KThread* thread);
+bool isMainSchedulerWorker();
+#endif
+
 #endif
\ No newline at end of file
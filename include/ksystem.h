@@ -34,6 +34,24 @@
 #define CALL_BACK_ADDRESS 0xFFFF0000
 #define SIG_RETURN_ADDRESS CALL_BACK_ADDRESS
 
+// the vdso reads the time from the time page so that clock_gettime, gettimeofday and time don't need a syscall.  The
+// vdso code starts on the next native page so that the time page stays writable while the code page is translated
+#define VDSO_TIME_ADDRESS 0xFFFE0000
+#define VDSO_ADDRESS (VDSO_TIME_ADDRESS + (K_NATIVE_PAGES_PER_PAGE << K_PAGE_SHIFT))
+#define VDSO_PAGE_COUNT (2 * K_NATIVE_PAGES_PER_PAGE)
+
+// time page layout, the vdso code in loader.cpp depends on these offsets
+#define VDSO_TIME_SEQ 0 // odd while the host is writing the page
+#define VDSO_TIME_FLAGS 4
+#define VDSO_TIME_TSC 8 // 64-bit guest rdtsc value that the times below were taken at
+#define VDSO_TIME_MULT 16 // nanoseconds = (rdtsc - VDSO_TIME_TSC) * VDSO_TIME_MULT >> VDSO_TIME_SHIFT
+#define VDSO_TIME_SHIFT 20
+#define VDSO_TIME_MONOTONIC 24 // 64-bit seconds then 32-bit nanoseconds
+#define VDSO_TIME_REALTIME 36 // 64-bit seconds then 32-bit nanoseconds
+
+#define VDSO_TIME_FLAG_TSC 1 // all clocks can be computed from rdtsc
+#define VDSO_TIME_FLAG_COARSE 2 // the page is updated often enough to answer the coarse clocks without rdtsc
+
 #define OPENGL_TYPE_NOT_SET 0
 #define OPENGL_TYPE_UNAVAILABLE 1
 #define OPENGL_TYPE_SDL 2
@@ -41,6 +59,7 @@
 
 class MappedFileCache;
 class KTimer;
+class Memory;
 class CPU;
 class KProcess;
 class KThread;
@@ -81,8 +100,18 @@ public:
     static bool useLargeAddressSpace;
     static bool useSingleMemOffset;
 #endif
+#ifdef BOXEDWINE_64BIT_MMU
+    static bool useHugePages;
+#endif
+#ifdef BOXEDWINE_DEFAULT_MMU
+    static U32 fileReadAheadPages; // power of 2, the smallest window read on a file mapping page fault, 0 or 1 disables it
+#endif
+#ifdef BOXEDWINE_WORKER_THREADS
+    static U32 schedulerWorkers; // host threads that run emulated threads, 1 keeps everything on the main thread
+#endif
 #ifdef BOXEDWINE_MULTI_THREADED
     static U32 cpuAffinityCountForApp;
+    static S32 mainThreadCpu; // host core the main/render thread is pinned to, -1 if it isn't pinned
 #endif
     static U32 pollRate;
     static bool showWindowImmediately;
@@ -107,8 +136,10 @@ public:
     static KThread* getThreadById(U32 threadId);
     static U32 getRunningProcessCount();
     static U32 getProcessCount();
+    static U32 getCpuCount(); // number of cpus the emulated programs see, guest cpu i runs on host core i
     static void printStacks();
     static void wakeThreadsWaitingOnProcessStateChanged();
+    static U64 updateTimePage(Memory* memory); // returns the monotonic time in nanoseconds that was written to the page
 
     // syscalls
     static U32 clock_getres(U32 clk_id, U32 timespecAddress);
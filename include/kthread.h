@@ -24,6 +24,17 @@
 #define TLS_ENTRIES 10
 #define TLS_ENTRY_START_INDEX 10
 
+// bits in KThread::pendingWork
+#define KTHREAD_WORK_SIGNAL 1 // the thread or its process has a pending signal, runSignals will decide if it can be delivered
+#define KTHREAD_WORK_TERMINATE 2
+
+#define K_SCHED_OTHER 0
+#define K_SCHED_FIFO 1
+#define K_SCHED_RR 2
+#define K_SCHED_BATCH 3
+#define K_SCHED_IDLE 5
+#define K_SCHED_RESET_ON_FORK 0x40000000
+
 class OpenGLVetexPointer {
 public:
     OpenGLVetexPointer() : size(0), type(0), stride(0), count(0), ptr(0), marshal(NULL), marshal_size(0), refreshEachCall(0) {}
@@ -49,6 +60,20 @@ public:
     bool sharing;
 };
 
+// a thread can only wait on one futex at a time, so each thread holds the entry it puts in the futex wait queues
+class KFutexWaiter {
+public:
+    KFutexWaiter() : node(this), cond(B("futex")), address(NULL), waitAddress(NULL), expireTimeInMillies(0), mask(0), wake(false), active(false) {}
+    KListNode<KFutexWaiter*> node;
+    BOXEDWINE_CONDITION cond;
+    U8* address; // host address of the futex word, a requeue can change it while waiting
+    U8* waitAddress; // host address the wait was started with, a requeue doesn't change it
+    U32 expireTimeInMillies;
+    U32 mask;
+    bool wake;
+    bool active; // the single threaded build re-enters the futex syscall each time the thread is woken
+};
+
 class KThread {
 public:
     KThread(U32 id, const std::shared_ptr<KProcess>& process);
@@ -64,14 +89,17 @@ public:
     void seg_mapper(U32 address, bool readFault, bool writeFault, bool throwException=true);
     void seg_access(U32 address, bool readFault, bool writeFault, bool throwException=true);
     bool runSignals();
+    void addPendingWork(U32 work) {this->pendingWork.fetch_or(work, std::memory_order_release);}
+    void onSignalMaskChanged(); // a pending signal that was masked off might be deliverable now
     void runSignal(U32 signal, U32 trapNo, U32 errorNo);
+    void setSignalContextSyscallResult(U32 result, U32 eipCount);
     void signalIllegalInstruction(int code);    
     void clone(KThread* from);
     void setupStack();
     void setTLS(struct user_desc* desc);
 
     // syscalls
-    U32 futex(U32 addr, U32 op, U32 value, U32 pTime, U32 val2, U32 val3) ;
+    U32 futex(U32 addr, U32 op, U32 value, U32 pTime, U32 val2, U32 val3, U32 eipCount = 0);
     U32 modify_ldt(U32 func, U32 ptr, U32 count);
     U32 signalstack(U32 ss, U32 oss);
     U32 sigprocmask(U32 how, U32 set, U32 oset, U32 sigsetSize);
@@ -79,6 +107,7 @@ public:
     U32 sigsuspend(U32 mask, U32 sigsetSize);
     U32 sleep(U32 ms);
     U32 nanoSleep(U64 nano);
+    U32 schedYield();
     U32 clockNanoSleep(U32 clock, U32 flags, U64 nano, U32 addressRemain);
 
     U32 id;
@@ -103,10 +132,22 @@ public:
     U64 userTime;
     U64 kernelTime;
     U32 inSysCall;
+    S32 nice; // -20 (highest priority) to 19, set by setpriority
+    U32 schedPolicy;
+    U32 schedPriority; // 1 to 99 for K_SCHED_FIFO and K_SCHED_RR, otherwise 0
+    U64 cpuAffinity; // set by sched_setaffinity, bit i is guest cpu i, 0 means all of them
+    U32 yieldSpinCount; // sched_yield calls that came right after each other
+    U64 lastYieldTime;
+#ifndef BOXEDWINE_MULTI_THREADED
+    bool interactive; // the last time this thread ran it blocked before using a quarter of its time slice
+#endif
     BOXEDWINE_CONDITION waitingForSignalToEndCond;
     U64 waitingForSignalToEndMaskToRestore;    
     U64 pendingSignals;
     BOXEDWINE_MUTEX pendingSignalsMutex;
+    // KTHREAD_WORK_* bits, tested with a single load at the start of every syscall so that the common case of nothing
+    // to do doesn't need to look at the signal masks
+    std::atomic<U32> pendingWork;
     KThreadGlContext* getGlContextById(U32 id);
     void removeGlContextById(U32 id);
     void addGlContext(U32 id, void* context);
@@ -140,6 +181,11 @@ public:
 #else
     KListNode<KThread*> scheduledThreadNode;
     KListNode<KThread*> waitThreadNode;
+#ifdef BOXEDWINE_WORKER_THREADS
+    U32 schedulerWorker; // the worker whose run queue this thread goes back on
+    bool schedulerRunning; // a worker is running this thread right now
+    bool mainWorkerOnly; // the thread used the native window, OpenGL or audio, which only the main thread can run
+#endif
         
     BoxedWineConditionTimer condTimer;
 #endif
@@ -147,8 +193,9 @@ public:
     U32 condStartWaitTime;
 private:
     void clearFutexes();
+    U32 conditionSleep(U32 ms);
 
-#ifdef BOXEDWINE_BINARY_TRANSLATOR
+#if defined(BOXEDWINE_BINARY_TRANSLATOR) || defined(BOXEDWINE_WORKER_THREADS)
     THREAD_LOCAL
 #endif
     static KThread* runningThread;
@@ -158,7 +205,7 @@ private:
     struct user_desc tls[TLS_ENTRIES];
     BOXEDWINE_MUTEX tlsMutex;
 
-    static BOXEDWINE_MUTEX futexesMutex;
+    KFutexWaiter futexWaiter;
 };
 
 class ChangeThread {
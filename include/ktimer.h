@@ -21,15 +21,15 @@
 
 class KTimer {
 public:
-    KTimer() : node(this), millies(0), resetMillies(0), active(false) {}
+    KTimer() : micros(0), resetMicros(0), active(false), heapIndex(0xFFFFFFFF) {}
     ~KTimer();
 
-    virtual bool run()=0; // return true of the timer should be removed, don't remove a timer manually in run because it will invalidate the iterator
+    virtual bool run()=0; // return true if the timer should be removed, if false is returned then micros should be moved forward
 
-    KListNode<KTimer*> node;
-	U32 millies;
-	U32 resetMillies;
+	U64 micros; // when the timer expires in KSystem::getMicroCounter time, to change this while the timer is active, call addTimer again so that it can be re-sorted
+	U64 resetMicros;
 	bool active;
+    U32 heapIndex; // used by the scheduler
 };
 
 #endif
\ No newline at end of file
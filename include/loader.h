@@ -29,6 +29,7 @@ public:
     static FsOpenNode* inspectNode(BString currentDirectory, const BoxedPtr<FsNode>& node, BString& loader, BString& interpreter, std::vector<BString>& interpreterArgs);
     static int getMemSizeOfElf(FsOpenNode* openNode);
     static U32 getPELoadAddress(FsOpenNode* FsopenNode, U32* section, U32* numberOfSections, U32* sizeOfSection);
+    static void writeVDSO(U8* page); // page will be mapped at VDSO_ADDRESS
 
 private:
     static BString getInterpreter(FsOpenNode* openNode, bool* isElf);
@@ -23,12 +23,13 @@ class KFile;
 
 class MappedFileCache : public BoxedPtrBase {
 public:
-    MappedFileCache(BString name) : name(name), data(NULL), dataSize(0) {}
+    MappedFileCache(BString name) : name(name), data(NULL), dataSize(0), nativeMappingLen(0) {}
     virtual ~MappedFileCache();
     const BString name;
     std::shared_ptr<KFile> file;
     U8** data;
     U32 dataSize;
+    U64 nativeMappingLen; // when not 0, data[0] is the host file mapped with Platform::mapNativeFile
 };
 
 #define K_PAGE_SIZE 4096
@@ -71,6 +72,9 @@ U32 getNativeStringLen(U32 address);
 
 void memcopyFromNative(U32 address, const void* p, U32 len);
 void memcopyToNative(U32 address, void* p, U32 len);
+// iov is the guest address of iovcnt {buffer, length} pairs, returns how many bytes were copied
+U32 memcopyFromNativeIov(U32 iov, U32 iovcnt, const void* p, U32 len);
+U32 memcopyToNativeIov(U32 iov, U32 iovcnt, void* p, U32 len);
 
 class KProcess;
 class Page;
@@ -114,12 +118,20 @@ public:
 
     void onThreadChanged();
 
+    U8* getTimePage(); // host address of VDSO_TIME_ADDRESS
+
     void incRefCount() { this->refCount++;}
 	void decRefCount() { this->refCount--; if (this->refCount == 0) { delete this; } }
     U32 getRefCount() { return this->refCount;}
 
 private:
     U32 refCount;
+
+    // findFirstAvailablePage searches these instead of looking at every page.  freePages are not in use at all, mappedPages
+    // were mmap'd and can be replaced when canBeReMapped is set
+    KBitmap<K_NUMBER_OF_PAGES> freePages;
+    KBitmap<K_NUMBER_OF_PAGES> mappedPages;
+    void updateAvailablePages(U32 page, U32 pageCount);
 public: 
 
 #ifdef BOXEDWINE_DEFAULT_MMU
@@ -132,11 +144,34 @@ public:
     void setPage(U32 index, Page* page);
     inline Page* getPage(U32 index) {return this->mmu[index];}
 
+#ifdef BOXEDWINE_WORKER_THREADS
+    // each scheduler worker runs a different process
+    THREAD_LOCAL static Page** currentMMU;
+    THREAD_LOCAL static U8** currentMMUReadPtr;
+    THREAD_LOCAL static U8** currentMMUWritePtr;
+#else
     static Page** currentMMU;
     static U8** currentMMUReadPtr;
     static U8** currentMMUWritePtr;
 #endif
 
+private:
+    // getCodeBlock looks here before asking the CodePage.  An entry is only used while its generation matches the CodePage's
+    // generation, which changes every time the page frees a block, so all the entries for a page are dropped at once
+#define CODE_BLOCK_CACHE_SHIFT 12
+#define CODE_BLOCK_CACHE_SIZE (1 << CODE_BLOCK_CACHE_SHIFT)
+#define CODE_BLOCK_CACHE_PROBES 4
+    class CodeBlockCacheEntry {
+    public:
+        U32 eip;
+        U32 generation;
+        DecodedBlock* block;
+    };
+    CodeBlockCacheEntry codeBlockCache[CODE_BLOCK_CACHE_SIZE];
+    void cacheCodeBlock(U32 eip, DecodedBlock* block, U32 generation);
+public:
+#endif
+
 #ifdef BOXEDWINE_DYNAMIC
     std::vector<void*> dynamicExecutableMemory;
     U32 dynamicExecutableMemoryPos;
@@ -145,43 +180,87 @@ public:
 
 #ifdef BOXEDWINE_64BIT_MMU
     BOXEDWINE_MUTEX pageMutex;
-    U8 flags[K_NUMBER_OF_PAGES];
-    U8 nativeFlags[K_NATIVE_NUMBER_OF_PAGES]; // this is based on the granularity for permissions, Platform::getPagePermissionGranularity. 
+    // the per page tables below are allocated with Platform::allocZeroedNativeMemory, so the host only backs the parts that
+    // are written to, a small process doesn't pay for the parts of the 4GB address space it doesn't use
+    U8* flags; // K_NUMBER_OF_PAGES
+    U8* nativeFlags; // K_NATIVE_NUMBER_OF_PAGES, this is based on the granularity for permissions, Platform::getPagePermissionGranularity. 
     U32 allocated;
     U64 id; 
 
-    // this will contain id in each page unless that page was mapped to native host memory
-    U64 memOffsets[K_NUMBER_OF_PAGES];    
+    // K_NUMBER_OF_PAGES, this will contain 0 in each page unless that page was mapped to native host memory.  The host address is
+    // address + id + memOffsets[page]
+    U64* memOffsets;
 private:
-    std::unordered_map<U32, std::unordered_map<U32, U32> > needsMemoryOffset; // first index is page, second index is offset
+    U8* pageTables;
+    U64 pageTablesSize;
+    void allocPageTables();
+    void freePageTables();
+
+    // one bit per instruction offset for each page that has ever needed a memory offset.  The pages are grouped by
+    // NEEDS_MEMORY_OFFSET_GROUP_PAGES so that only the groups that are used get a table of page pointers
+#define NEEDS_MEMORY_OFFSET_GROUP_SHIFT 10
+#define NEEDS_MEMORY_OFFSET_GROUP_PAGES (1 << NEEDS_MEMORY_OFFSET_GROUP_SHIFT)
+#define NEEDS_MEMORY_OFFSET_PAGE_WORDS (K_PAGE_SIZE / 64)
+    U64** needsMemoryOffset[K_NUMBER_OF_PAGES >> NEEDS_MEMORY_OFFSET_GROUP_SHIFT];
 public:
+    // called during code translation for every instruction
     bool doesInstructionNeedMemoryOffset(U32 eip) {
         U32 page = eip >> K_PAGE_SHIFT;
-        U32 offset = eip & K_PAGE_MASK;
-        if (this->needsMemoryOffset.count(page) && this->needsMemoryOffset[page].count(offset)) {
-            return this->needsMemoryOffset[page][offset] > 0;
+        U64** group = this->needsMemoryOffset[page >> NEEDS_MEMORY_OFFSET_GROUP_SHIFT];
+        if (!group) {
+            return false;
+        }
+        U64* bits = group[page & (NEEDS_MEMORY_OFFSET_GROUP_PAGES - 1)];
+        if (!bits) {
+            return false;
         }
-        return false;
+        U32 offset = eip & K_PAGE_MASK;
+        return (bits[offset >> 6] & ((U64)1 << (offset & 63))) != 0;
     }
     void clearNeedsMemoryOffset(U32 page, U32 pageCount) {
-        for (U32 i = 0; i < pageCount; i++) {
-            if (this->needsMemoryOffset.count(page + i)) {
-                this->needsMemoryOffset.erase(page + i);
+        for (U32 i = page; i < page + pageCount; i++) {
+            U64** group = this->needsMemoryOffset[i >> NEEDS_MEMORY_OFFSET_GROUP_SHIFT];
+            if (group && group[i & (NEEDS_MEMORY_OFFSET_GROUP_PAGES - 1)]) {
+                delete[] group[i & (NEEDS_MEMORY_OFFSET_GROUP_PAGES - 1)];
+                group[i & (NEEDS_MEMORY_OFFSET_GROUP_PAGES - 1)] = NULL;
             }
         }
     }
     void setNeedsMemoryOffset(U32 eip) {
         U32 page = eip >> K_PAGE_SHIFT;
         U32 offset = eip & K_PAGE_MASK;
-        this->needsMemoryOffset[page][offset] = 1;
+        U64** group = this->needsMemoryOffset[page >> NEEDS_MEMORY_OFFSET_GROUP_SHIFT];
+        if (!group) {
+            group = new U64*[NEEDS_MEMORY_OFFSET_GROUP_PAGES];
+            memset(group, 0, sizeof(U64*) * NEEDS_MEMORY_OFFSET_GROUP_PAGES);
+            this->needsMemoryOffset[page >> NEEDS_MEMORY_OFFSET_GROUP_SHIFT] = group;
+        }
+        U64* bits = group[page & (NEEDS_MEMORY_OFFSET_GROUP_PAGES - 1)];
+        if (!bits) {
+            bits = new U64[NEEDS_MEMORY_OFFSET_PAGE_WORDS];
+            memset(bits, 0, sizeof(U64) * NEEDS_MEMORY_OFFSET_PAGE_WORDS);
+            group[page & (NEEDS_MEMORY_OFFSET_GROUP_PAGES - 1)] = bits;
+        }
+        bits[offset >> 6] |= (U64)1 << (offset & 63);
     }
 
     void clearAllNeedsMemoryOffset() {
-        this->needsMemoryOffset.clear();
+        for (U32 i = 0; i < (K_NUMBER_OF_PAGES >> NEEDS_MEMORY_OFFSET_GROUP_SHIFT); i++) {
+            U64** group = this->needsMemoryOffset[i];
+            if (group) {
+                for (U32 j = 0; j < NEEDS_MEMORY_OFFSET_GROUP_PAGES; j++) {
+                    if (group[j]) {
+                        delete[] group[j];
+                    }
+                }
+                delete[] group;
+                this->needsMemoryOffset[i] = NULL;
+            }
+        }
     }
 
 #define MAX_DYNAMIC_CODE_PAGE_COUNT 0xFF
-    U8 dynamicCodePageUpdateCount[K_NATIVE_NUMBER_OF_PAGES];
+    U8* dynamicCodePageUpdateCount; // K_NATIVE_NUMBER_OF_PAGES
 
 #ifdef BOXEDWINE_BINARY_TRANSLATOR
     BOXEDWINE_MUTEX executableMemoryMutex;    
@@ -213,10 +292,17 @@ public:
     void executableMemoryReleased();
     bool isAddressExecutable(void* address);
 
-    void allocNativeMemory(U32 page, U32 pageCount, U32 flags);
+    void allocNativeMemory(U32 page, U32 pageCount, U32 flags, U32 filledPageCount = 0); // the first filledPageCount pages already hold their data and won't be zeroed
     void freeNativeMemory(U32 page, U32 pageCount);    
+    void releaseHostFilePages(U32 page, U32 pageCount);
+    bool handleHostFileBusError(U64 hostAddress); // called by the host SIGBUS handler, returns true if the fault was a truncated host file and the access can be retried
     void updatePagePermission(U32 page, U32 pageCount); // called after page permission has changed, code will give the native page the highest permission possible
     void updateNativePermission(U32 page, U32 pageCount, U32 permission); // for a native page change so that it can be read or written too now, updatePagePermission should be called when done to restore correct permissions
+    // while a batch is open on the current thread, updatePagePermission only records the new permission in nativeFlags, the host
+    // calls are made when the outermost batch ends with contiguous native pages that have the same permission merged into one call.
+    // pageMutex must be held while the batch is open
+    void beginNativePermissionBatch();
+    void endNativePermissionBatch();
 
     class AllocatedMemory {
     public:
@@ -226,7 +312,14 @@ public:
     };
     std::list<AllocatedMemory> allocatedExecutableMemory;
 private:
-    bool committedEipPages[K_NUMBER_OF_PAGES];
+    bool* committedEipPages; // K_NUMBER_OF_PAGES
+
+    U32 nativePermissionBatchDepth;
+    KThread* nativePermissionBatchThread;
+    U32 pendingNativePermissionStart; // native page range that might have NATIVE_FLAG_PERMISSION_PENDING set
+    U32 pendingNativePermissionEnd;
+    bool isBatchingNativePermissions();
+    void flushNativePermissions(U32 nativePage, U32 nativePageCount);
 
 public:
     void*** eipToHostInstructionPages;
@@ -249,6 +342,8 @@ private:
 #ifdef BOXEDWINE_DEFAULT_MMU
     static U8* callbackRam;
     static U32 callbackRamPos;    
+    static U8* vdsoRam; // the vdso and the time page are shared by all processes
+    static U8* vdsoTimeRam;
     U8* nativeAddressStart;
 #endif
 #ifdef BOXEDWINE_64BIT_MMU
@@ -258,8 +353,19 @@ private:
 #endif
 #endif
     void addCallback(OpCallback func);
+    void mapVDSO();
 };
 
+#ifdef BOXEDWINE_BINARY_TRANSLATOR
+class NativePermissionBatch {
+public:
+    NativePermissionBatch(Memory* memory) : memory(memory) {memory->beginNativePermissionBatch();}
+    ~NativePermissionBatch() {memory->endNativePermissionBatch();}
+private:
+    Memory* memory;
+};
+#endif
+
 #include "../source/emulation/softmmu/soft_page.h"
 #include "../source/emulation/softmmu/soft_memory.h"
 #endif
@@ -42,6 +42,11 @@
 #define BOXEDWINE_DEFAULT_MMU 1
 #endif
 
+// runs the emulated threads of the single threaded build on a pool of host threads, see kscheduler.cpp
+#if defined(BOXEDWINE_WORKER_THREADS) && (defined(BOXEDWINE_MULTI_THREADED) || !defined(BOXEDWINE_DEFAULT_MMU) || defined(BOXEDWINE_DYNAMIC) || defined(__EMSCRIPTEN__) || defined(__TEST))
+#error BOXEDWINE_WORKER_THREADS needs the single threaded build with the soft mmu and the normal cpu
+#endif
+
 #ifdef BOXEDWINE_HAS_SETJMP
 #include <setjmp.h>
 #endif
@@ -133,16 +138,23 @@ public:
     static U32 nanoSleep(U64 nano);
     static U32 getPageAllocationGranularity();
     static U32 getPagePermissionGranularity(); // assumed to be smaller or equal to getPageAllocationGranularity and that getPageAllocationGranularity / getPagePermissionGranularity is a whole number
-    static U32 allocateNativeMemory(U64 address); // page must be aligned to Platform::getAllocationGranularity
-    static U32 freeNativeMemory(U64 address); // page  must be aligned to Platform::getAllocationGranularity
+    static U32 allocateNativeMemory(U64 address, U32 len = 0); // page must be aligned to Platform::getAllocationGranularity.  when len == 0, it will default to getPageAllocationGranularity() << K_PAGE_SHIFT
+    static U32 freeNativeMemory(U64 address, U32 len = 0); // page  must be aligned to Platform::getAllocationGranularity.  when len == 0, it will default to getPageAllocationGranularity() << K_PAGE_SHIFT
     static U32 updateNativePermission(U64 address, U32 permission, U32 len = 0); // page must be aligned to Platform::getPagePermissionGranularity.  when len == 0, it will default to getPagePermissionGranularity() << K_PAGE_SHIFT
     static void* reserveNativeMemory(bool large);
     static void releaseNativeMemory(void* address, U64 len);
     static void commitNativeMemory(void* address, U64 len);
+    static void* allocZeroedNativeMemory(U64 len); // the host will only back the pages that are written to, free it with releaseNativeMemory
+    static void* allocReadOnlyNativeMemory(U64 len, void** writableAlias); // zeroed memory that can only be read, writableAlias is set to a second mapping of the same memory that can be written.  Neither is ever freed
+    static void* mapNativeFile(void* address, U64 len, S32 handle, U64 offset, bool shared); // maps the host file read/write at address (anywhere if NULL), returns NULL if the host can't, free it with releaseNativeMemory
+    static void unmapNativeFile(void* address, U64 len); // replaces a range mapped with mapNativeFile at a fixed address with reserved memory that can't be accessed
+    static bool zeroTruncatedNativeFilePage(void* address); // if address is in a range mapped with mapNativeFile(NULL, ...), replaces its host page with zeros so that a file truncated after it was mapped can't fault again, returns false if it isn't
     static void* allocExecutable64kBlock(U32 count);
 
 #ifdef BOXEDWINE_MULTI_THREADED
     static void setCpuAffinityForThread(KThread* thread, U32 count);
+    static bool setCpuAffinityMaskForThread(KThread* thread, U64 mask); // bit i is host core i, returns false if the host can't pin threads
+    static bool setCpuAffinityMaskForCurrentThread(U64 mask);
 #endif
 private:
     friend class KSystem;
@@ -24,6 +24,9 @@
 #include <sys/socket.h>
 #include <SDL.h>
 #include <sys/mman.h>
+#include <map>
+#include <fcntl.h>
+#include <unistd.h>
 #ifdef BOXEDWINE_BINARY_TRANSLATOR
 #include "../../source/emulation/cpu/binaryTranslation/btCpu.h"
 #endif
@@ -145,19 +148,43 @@ U32 Platform::getCpuCount() {
 #endif
 }
 
-U32 Platform::nanoSleep(U64 nano) {
-    struct timespec req, rem;
+#if defined(__linux__) && !defined(__EMSCRIPTEN__)
+#include <sys/prctl.h>
 
-    if (nano > 999999999)
-    {
-        req.tv_sec = (int)(nano / 1000000000l);                  /* Must be Non-Negative */
-        req.tv_nsec = (nano - ((long)req.tv_sec * 1000000000l)); /* Must be in range of 0 to 999999999 */
-    } else {
-        req.tv_sec = 0;        /* Must be Non-Negative */
-        req.tv_nsec = nano;    /* Must be in range of 0 to 999999999 */
+// the host may wake the thread up to the timer slack late so that it can coalesce wake ups.  Short sleeps are usually
+// frame pacing so they get a small slack, long sleeps can be coalesced more.  Only changed when it differs since it
+// is a syscall.
+static void setTimerSlack(U64 nano) {
+    static THREAD_LOCAL U64 currentSlack;
+    U64 slack = nano >> 6;
+
+    if (slack < 1000) {
+        slack = 1000;
+    } else if (slack > 1000000) {
+        slack = 1000000;
     }
+    if (slack != currentSlack) {
+        prctl(PR_SET_TIMERSLACK, (unsigned long)slack, 0, 0, 0);
+        currentSlack = slack;
+    }
+}
+#endif
 
-    nanosleep(&req, &rem);
+U32 Platform::nanoSleep(U64 nano) {
+    struct timespec req;
+
+    req.tv_sec = (time_t)(nano / 1000000000l);
+    req.tv_nsec = (long)(nano % 1000000000l);
+#if defined(__linux__) && !defined(__EMSCRIPTEN__)
+    setTimerSlack(nano);
+    // CLOCK_MONOTONIC isn't affected by changes to the wall clock, if a host signal interrupts it, req is updated
+    // to what is left
+    while (clock_nanosleep(CLOCK_MONOTONIC, 0, &req, &req) == EINTR) {
+    }
+#else
+    while (nanosleep(&req, &req) == -1 && errno == EINTR) {
+    }
+#endif
     return 0;
 }
 
@@ -207,15 +234,21 @@ U32 Platform::getPagePermissionGranularity() {
     return K_NATIVE_PAGES_PER_PAGE;
 }
 
-U32 Platform::allocateNativeMemory(U64 address) {
-    if (mprotect((void*)address, getPageAllocationGranularity() << K_PAGE_SHIFT, PROT_READ | PROT_WRITE) < 0) {
+U32 Platform::allocateNativeMemory(U64 address, U32 len) {
+    if (len == 0) {
+        len = getPageAllocationGranularity() << K_PAGE_SHIFT;
+    }
+    if (mprotect((void*)address, len, PROT_READ | PROT_WRITE) < 0) {
         kpanic("allocNativeMemory mprotect failed: %s", strerror(errno));
     }
     return 0;
 }
 
-U32 Platform::freeNativeMemory(U64 address) {
-    mprotect((void*)address, getPageAllocationGranularity() << K_PAGE_SHIFT, PROT_NONE);
+U32 Platform::freeNativeMemory(U64 address, U32 len) {
+    if (len == 0) {
+        len = getPageAllocationGranularity() << K_PAGE_SHIFT;
+    }
+    mprotect((void*)address, len, PROT_NONE);
     return 0;
 }
 
@@ -320,7 +353,15 @@ U32 Platform::updateNativePermission(U64 address, U32 permission, U32 len) {
     return 0;
 }
 
+// host files mapped with mapNativeFile(NULL, ...), a SIGBUS in one of them means the file was truncated after it was mapped
+static std::map<U64, U64> nativeFileMappings;
+static BOXEDWINE_MUTEX nativeFileMappingsMutex;
+
 void Platform::releaseNativeMemory(void* address, U64 len) {
+    {
+        BOXEDWINE_CRITICAL_SECTION_WITH_MUTEX(nativeFileMappingsMutex);
+        nativeFileMappings.erase((U64)address);
+    }
     munmap(address, len);
 }
 
@@ -333,6 +374,196 @@ void Platform::commitNativeMemory(void* address, U64 len) {
     }
 }
 
+void* Platform::allocZeroedNativeMemory(U64 len) {
+    void* result = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_ANONYMOUS | MAP_PRIVATE, -1, 0);
+    if (result == MAP_FAILED) {
+        kpanic("allocZeroedNativeMemory: failed to allocate memory : %s", strerror(errno));
+    }
+    return result;
+}
+
+#if defined(__linux__) && !defined(__EMSCRIPTEN__)
+#include <sched.h>
+#include <sys/syscall.h>
+#include <vector>
+
+// mbind and get_mempolicy are plain syscalls, libnuma is only a wrapper around them
+#define K_MPOL_DEFAULT 0
+#define K_MPOL_PREFERRED 1
+#define K_MPOL_F_ADDR (1 << 1)
+#define K_MAX_NUMA_NODES 1024
+
+// host cpu index -> numa node, empty if the host has only one node or doesn't say
+static const std::vector<int>& getNumaNodeOfCpus() {
+    static const std::vector<int> nodes = []() {
+        std::vector<int> result;
+        bool multipleNodes = false;
+
+        for (U32 cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+            char path[64];
+            snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%u", cpu);
+            DIR* dir = opendir(path);
+            if (!dir) {
+                break;
+            }
+            int node = -1;
+            struct dirent* entry;
+            while ((entry = readdir(dir)) != NULL) {
+                if (!strncmp(entry->d_name, "node", 4) && entry->d_name[4] >= '0' && entry->d_name[4] <= '9') {
+                    node = atoi(entry->d_name + 4);
+                    break;
+                }
+            }
+            closedir(dir);
+            if (node > 0) {
+                multipleNodes = true;
+            }
+            result.push_back(node);
+        }
+        if (!multipleNodes) {
+            result.clear();
+        }
+        return result;
+    }();
+    return nodes;
+}
+
+// the node of the cores the current thread may run on, -1 if they are spread over more than one node.  The threads of a
+// process inherit the affinity of the thread that creates it, so this is the node the process will run on
+static int getNumaNodeForCurrentThread() {
+    const std::vector<int>& nodes = getNumaNodeOfCpus();
+    if (nodes.empty()) {
+        return -1;
+    }
+    cpu_set_t set;
+    if (sched_getaffinity(0, sizeof(set), &set) != 0) {
+        return -1;
+    }
+    int result = -1;
+    for (U32 cpu = 0; cpu < nodes.size(); cpu++) {
+        if (!CPU_ISSET(cpu, &set)) {
+            continue;
+        }
+        if (nodes[cpu] < 0 || (result >= 0 && nodes[cpu] != result)) {
+            return -1;
+        }
+        result = nodes[cpu];
+    }
+    return result < K_MAX_NUMA_NODES ? result : -1;
+}
+
+// preferred instead of bind so that the host can still fall back to another node instead of failing when this one is full
+static void setNumaNode(void* p, U64 len, int node) {
+    unsigned long mask[K_MAX_NUMA_NODES / (8 * sizeof(unsigned long))] = { 0 };
+    mask[node / (8 * sizeof(unsigned long))] = 1ul << (node % (8 * sizeof(unsigned long)));
+    static bool loggedFailure;
+    if (syscall(SYS_mbind, p, len, K_MPOL_PREFERRED, mask, K_MAX_NUMA_NODES, 0) != 0 && !loggedFailure) {
+        klog("reserveNativeMemory: could not prefer numa node %d: %s", node, strerror(errno));
+        loggedFailure = true;
+    }
+}
+
+// the node of a range that is about to be replaced with MAP_FIXED, which drops its policy, -1 if it has none
+static int getNumaNode(void* p) {
+    int mode = K_MPOL_DEFAULT;
+    unsigned long mask[K_MAX_NUMA_NODES / (8 * sizeof(unsigned long))] = { 0 };
+    if (syscall(SYS_get_mempolicy, &mode, mask, K_MAX_NUMA_NODES, p, K_MPOL_F_ADDR) != 0 || mode != K_MPOL_PREFERRED) {
+        return -1;
+    }
+    for (U32 i = 0; i < K_MAX_NUMA_NODES; i++) {
+        if (mask[i / (8 * sizeof(unsigned long))] & (1ul << (i % (8 * sizeof(unsigned long))))) {
+            return (int)i;
+        }
+    }
+    return -1;
+}
+#endif
+
+// the kernel will only use a huge page once all of it has been committed with the same permission and it will split it
+// again if Memory::updatePagePermission gives part of it a different permission
+static void adviseHugePages(void* p, U64 len) {
+#if defined(MADV_HUGEPAGE) && defined(BOXEDWINE_64BIT_MMU)
+    if (KSystem::useHugePages) {
+        static bool loggedFailure;
+        if (madvise(p, len, MADV_HUGEPAGE) < 0 && !loggedFailure) {
+            klog("reserveNativeMemory: huge pages are not available: %s", strerror(errno));
+            loggedFailure = true;
+        }
+    }
+#endif
+}
+
+void* Platform::mapNativeFile(void* address, U64 len, S32 handle, U64 offset, bool shared) {
+    void* result = mmap(address, len, PROT_READ | PROT_WRITE, (shared ? MAP_SHARED : MAP_PRIVATE) | (address ? MAP_FIXED : 0), handle, offset);
+    if (result == MAP_FAILED) {
+        return NULL;
+    }
+    if (!address) {
+        // fixed mappings are in the guest address space, Memory keeps track of those
+        BOXEDWINE_CRITICAL_SECTION_WITH_MUTEX(nativeFileMappingsMutex);
+        nativeFileMappings[(U64)result] = len;
+    }
+    return result;
+}
+
+void* Platform::allocReadOnlyNativeMemory(U64 len, void** writableAlias) {
+#if defined(__linux__) && !defined(__EMSCRIPTEN__)
+    int fd = (int)syscall(SYS_memfd_create, "boxedwine", 0);
+#else
+    char name[64];
+    snprintf(name, sizeof(name), "/boxedwine-%d-%llx", (int)getpid(), (unsigned long long)(U64)writableAlias);
+    int fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0600);
+    if (fd >= 0) {
+        shm_unlink(name);
+    }
+#endif
+    if (fd < 0) {
+        kpanic("allocReadOnlyNativeMemory: could not create shared memory: %s", strerror(errno));
+    }
+    if (ftruncate(fd, len) < 0) {
+        kpanic("allocReadOnlyNativeMemory: ftruncate failed: %s", strerror(errno));
+    }
+    void* result = mmap(NULL, len, PROT_READ, MAP_SHARED, fd, 0);
+    *writableAlias = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (result == MAP_FAILED || *writableAlias == MAP_FAILED) {
+        kpanic("allocReadOnlyNativeMemory: mmap failed: %s", strerror(errno));
+    }
+    return result;
+}
+
+bool Platform::zeroTruncatedNativeFilePage(void* address) {
+    BOXEDWINE_CRITICAL_SECTION_WITH_MUTEX(nativeFileMappingsMutex);
+    auto it = nativeFileMappings.upper_bound((U64)address);
+    if (it == nativeFileMappings.begin()) {
+        return false;
+    }
+    --it;
+    if ((U64)address >= it->first + it->second) {
+        return false;
+    }
+    U64 pageSize = (U64)getpagesize();
+    void* page = (void*)((U64)address & ~(pageSize - 1));
+    // the page is no longer shared with the file or other processes, but there is nothing in the file to share anymore
+    return mmap(page, pageSize, PROT_READ | PROT_WRITE, MAP_ANONYMOUS | MAP_FIXED | MAP_PRIVATE, -1, 0) == page;
+}
+
+void Platform::unmapNativeFile(void* address, U64 len) {
+#if defined(__linux__) && !defined(__EMSCRIPTEN__)
+    int node = getNumaNode(address);
+#endif
+    if (mmap(address, len, PROT_NONE, MAP_ANONYMOUS | MAP_FIXED | MAP_PRIVATE, -1, 0) != address) {
+        kpanic("unmapNativeFile mmap failed: %s", strerror(errno));
+    }
+    // the new mapping doesn't inherit the advice given to the reservation
+    adviseHugePages(address, len);
+#if defined(__linux__) && !defined(__EMSCRIPTEN__)
+    if (node >= 0) {
+        setNumaNode(address, len, node);
+    }
+#endif
+}
+
 void* Platform::allocExecutable64kBlock(U32 count) {
     void* result = mmap(NULL, 64 * 1024 * count, PROT_EXEC | PROT_WRITE | PROT_READ, MAP_ANONYMOUS | MAP_PRIVATE | MAP_BOXEDWINE, -1, 0);
     if (result == MAP_FAILED) {
@@ -356,6 +587,15 @@ void* Platform::reserveNativeMemory(bool large) {
             break;
         }
     }
+    adviseHugePages(p, len);
+#if defined(__linux__) && !defined(__EMSCRIPTEN__)
+    // first touch would only put the pages on the right node if the thread that touches them first happens to be
+    // running there, with the process's cores on one node this makes sure its memory is allocated there
+    int node = getNumaNodeForCurrentThread();
+    if (node >= 0) {
+        setNumaNode(p, len, node);
+    }
+#endif
     return p;
 }
 
@@ -381,27 +621,53 @@ void Platform::setCpuAffinityForThread(KThread* thread, U32 count) {
         thread_policy_set(port, THREAD_AFFINITY_POLICY, (thread_policy_t) &policy, THREAD_AFFINITY_POLICY_COUNT);
     }
 }
+
+// Mac OS only has affinity tags, a thread can't be pinned to a core
+bool Platform::setCpuAffinityMaskForThread(KThread* thread, U64 mask) {
+    return false;
+}
+
+bool Platform::setCpuAffinityMaskForCurrentThread(U64 mask) {
+    return false;
+}
 #else
+#include <pthread.h>
+
+static bool setCpuAffinityMask(pthread_t thread, U64 mask) {
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    for (U32 i = 0; i < 64 && i < CPU_SETSIZE; i++) {
+        if (mask & ((U64)1 << i)) {
+            CPU_SET(i, &set);
+        }
+    }
+    return pthread_setaffinity_np(thread, sizeof(cpu_set_t), &set) == 0;
+}
+
+bool Platform::setCpuAffinityMaskForThread(KThread* thread, U64 mask) {
+    return setCpuAffinityMask((pthread_t)((BtCPU*)thread->cpu)->nativeHandle, mask);
+}
+
+bool Platform::setCpuAffinityMaskForCurrentThread(U64 mask) {
+    return setCpuAffinityMask(pthread_self(), mask);
+}
+
 void Platform::setCpuAffinityForThread(KThread* thread, U32 count) {
     if (KSystem::cpuAffinityCountForApp) {
         U32 cores = Platform::getCpuCount();
         if (cores <= 1) {
             return;
         }
-        if (count > CPU_SETSIZE) {
-            count = CPU_SETSIZE;
-        }
-        if (count > cores) {
+        if (count == 0 || count > cores) {
             count = cores;
         }
-        cpu_set_t mask;
-        CPU_ZERO(&mask);
-        for (U32 i = 0; i < count; i++) {
-            CPU_SET(i, &mask);
+        if (count > 64) {
+            count = 64;
         }
         klog("Process %s (PID=%d) set thread %d cpu affinity to %X", thread->process->name.c_str(), thread->process->id, thread->id, count);
 
-        sched_setaffinity((pid_t)((BtCPU*)thread->cpu)->nativeHandle, sizeof(cpu_set_t), &mask);
+        // nativeHandle is a pthread_t, not a kernel thread id, so sched_setaffinity can't be used
+        setCpuAffinityMask((pthread_t)((BtCPU*)thread->cpu)->nativeHandle, count >= 64 ? ~(U64)0 : (((U64)1 << count) - 1));
     }
 }
 #endif
@@ -137,6 +137,12 @@ void platformHandler(int sig, siginfo_t* info, void* vcontext) {
     if (!currentThread) {
         return;
     }
+#ifndef __MACH__
+    // checked before the cpu since it is usually the emulator's own code, like a syscall copying guest memory, that faults
+    if (sig == SIGBUS && info->si_code == BUS_ADRERR && currentThread->memory->handleHostFileBusError((U64)info->si_addr)) {
+        return;
+    }
+#endif
     ucontext_t* context = (ucontext_t*)vcontext;
 
     BtCPU* cpu = (BtCPU*)currentThread->cpu;
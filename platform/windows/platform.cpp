@@ -391,8 +391,11 @@ U32 Platform::getPagePermissionGranularity() {
     return K_NATIVE_PAGES_PER_PAGE;
 }
 
-U32 Platform::allocateNativeMemory(U64 address) {
-    if (!VirtualAlloc((void*)address, getPageAllocationGranularity() << K_PAGE_SHIFT, MEM_COMMIT, PAGE_READWRITE)) {
+U32 Platform::allocateNativeMemory(U64 address, U32 len) {
+    if (len == 0) {
+        len = getPageAllocationGranularity() << K_PAGE_SHIFT;
+    }
+    if (!VirtualAlloc((void*)address, len, MEM_COMMIT, PAGE_READWRITE)) {
         LPSTR messageBuffer = NULL;
         size_t size = FormatMessageA(FORMAT_MESSAGE_ALLOCATE_BUFFER | FORMAT_MESSAGE_FROM_SYSTEM | FORMAT_MESSAGE_IGNORE_INSERTS, NULL, GetLastError(), MAKELANGID(LANG_NEUTRAL, SUBLANG_DEFAULT), (LPSTR)&messageBuffer, 0, NULL);
         kpanic("allocateNativeMemory: failed to commit memory: page=%x : %s", address, messageBuffer);
@@ -400,8 +403,11 @@ U32 Platform::allocateNativeMemory(U64 address) {
     return 0;
 }
 
-U32 Platform::freeNativeMemory(U64 address) {
-    if (!VirtualFree((void*)address, getPageAllocationGranularity() << K_PAGE_SHIFT, MEM_DECOMMIT)) {
+U32 Platform::freeNativeMemory(U64 address, U32 len) {
+    if (len == 0) {
+        len = getPageAllocationGranularity() << K_PAGE_SHIFT;
+    }
+    if (!VirtualFree((void*)address, len, MEM_DECOMMIT)) {
         LPSTR messageBuffer = NULL;
         size_t size = FormatMessageA(FORMAT_MESSAGE_ALLOCATE_BUFFER | FORMAT_MESSAGE_FROM_SYSTEM | FORMAT_MESSAGE_IGNORE_INSERTS, NULL, GetLastError(), MAKELANGID(LANG_NEUTRAL, SUBLANG_DEFAULT), (LPSTR)&messageBuffer, 0, NULL);
         kpanic("failed to release memory: %s", messageBuffer);
@@ -426,6 +432,45 @@ void Platform::commitNativeMemory(void* address, U64 len) {
     }
 }
 
+void* Platform::allocZeroedNativeMemory(U64 len) {
+    // committed pages don't use physical memory until they are touched
+    void* result = VirtualAlloc(NULL, len, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE);
+    if (!result) {
+        LPSTR messageBuffer = NULL;
+        size_t size = FormatMessageA(FORMAT_MESSAGE_ALLOCATE_BUFFER | FORMAT_MESSAGE_FROM_SYSTEM | FORMAT_MESSAGE_IGNORE_INSERTS, NULL, GetLastError(), MAKELANGID(LANG_NEUTRAL, SUBLANG_DEFAULT), (LPSTR)&messageBuffer, 0, NULL);
+        kpanic("allocZeroedNativeMemory: failed to allocate memory : %s", messageBuffer);
+    }
+    return result;
+}
+
+void* Platform::allocReadOnlyNativeMemory(U64 len, void** writableAlias) {
+    HANDLE mapping = CreateFileMappingW(INVALID_HANDLE_VALUE, NULL, PAGE_READWRITE, (DWORD)(len >> 32), (DWORD)len, NULL);
+    if (!mapping) {
+        kpanic("allocReadOnlyNativeMemory: CreateFileMapping failed: %d", GetLastError());
+    }
+    void* result = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, (SIZE_T)len);
+    *writableAlias = MapViewOfFile(mapping, FILE_MAP_WRITE, 0, 0, (SIZE_T)len);
+    if (!result || !*writableAlias) {
+        kpanic("allocReadOnlyNativeMemory: MapViewOfFile failed: %d", GetLastError());
+    }
+    // the views keep the memory alive
+    CloseHandle(mapping);
+    return result;
+}
+
+void* Platform::mapNativeFile(void* address, U64 len, S32 handle, U64 offset, bool shared) {
+    // a view can't be placed inside of the reserved address space of the process, the caller will read the file instead
+    return NULL;
+}
+
+void Platform::unmapNativeFile(void* address, U64 len) {
+    // mapNativeFile never maps anything on Windows
+}
+
+bool Platform::zeroTruncatedNativeFilePage(void* address) {
+    return false;
+}
+
 void* Platform::allocExecutable64kBlock(U32 count) {
     void* result = VirtualAlloc(NULL, 64 * 1024 * count, MEM_COMMIT, PAGE_EXECUTE_READWRITE);
     if (!result) {
@@ -474,10 +519,49 @@ void* Platform::reserveNativeMemory(bool large) {
     return p;
 }
 
+#ifndef CREATE_WAITABLE_TIMER_HIGH_RESOLUTION
+#define CREATE_WAITABLE_TIMER_HIGH_RESOLUTION 0x00000002
+#endif
+
+// closes the thread's timer when the thread exits, every emulated thread that sleeps gets its own
+class HighResolutionTimer {
+public:
+    HighResolutionTimer() : timer(NULL), created(false) {}
+    ~HighResolutionTimer() {
+        if (this->timer) {
+            CloseHandle(this->timer);
+        }
+    }
+    HANDLE timer;
+    bool created;
+};
+
+// Windows 10 1803 and later have timers that are precise to well under a millisecond without timeBeginPeriod, on
+// older versions this returns NULL and short sleeps spin instead.  This uses thread_local instead of THREAD_LOCAL since
+// __declspec(thread) can't run the destructor
+static HANDLE getHighResolutionTimer() {
+    static thread_local HighResolutionTimer holder;
+
+    if (!holder.created) {
+        holder.timer = CreateWaitableTimerExW(NULL, NULL, CREATE_WAITABLE_TIMER_HIGH_RESOLUTION, TIMER_ALL_ACCESS);
+        holder.created = true;
+    }
+    return holder.timer;
+}
+
 U32 Platform::nanoSleep(U64 nano) {
     U32 millies = (U32)(nano / 1000000);
     LARGE_INTEGER startTime;
-
+    HANDLE timer = getHighResolutionTimer();
+
+    if (timer) {
+        LARGE_INTEGER dueTime;
+        dueTime.QuadPart = -(LONGLONG)(nano / 100); // negative is relative, in 100ns units
+        if (SetWaitableTimer(timer, &dueTime, 0, NULL, NULL, FALSE)) {
+            WaitForSingleObject(timer, INFINITE);
+            return 0;
+        }
+    }
     if (millies > NUMBER_OF_MILLIES_TO_SPIN_FOR_WAIT || !PCFreq || !QueryPerformanceCounter(&startTime)) {
         Sleep(millies);
     } else {
@@ -516,6 +600,14 @@ void Platform::setCpuAffinityForThread(KThread* thread, U32 count) {
         SetThreadAffinityMask((HANDLE)((BtCPU*)thread->cpu)->nativeHandle, mask);
     }
 }
+
+bool Platform::setCpuAffinityMaskForThread(KThread* thread, U64 mask) {
+    return SetThreadAffinityMask((HANDLE)((BtCPU*)thread->cpu)->nativeHandle, (DWORD_PTR)mask) != 0;
+}
+
+bool Platform::setCpuAffinityMaskForCurrentThread(U64 mask) {
+    return SetThreadAffinityMask(GetCurrentThread(), (DWORD_PTR)mask) != 0;
+}
 #endif
 
 #ifdef BOXEDWINE_X64
@@ -1400,6 +1400,7 @@ U8 Armv8btAsm::getHostMem(U8 regEmulatedAddress, S8 tmpReg) {
         shiftRegRightWithValue32(tmpReg, regEmulatedAddress, 12); // get page
         readMem64ValueOffset(resultReg, xCPU, CPU_OFFSET_MEMOFFSET);
         readMem64RegOffset(resultReg, resultReg, tmpReg, 3); // read memOffset, shift page << 3 (page*8), since sizeof(U64)==8 to get the value in memOffsets[page]        
+        addRegs64(resultReg, resultReg, xMem); // memOffsets is relative to xMem
         if (needToReleaseTmpReg) {
             releaseTmpReg(tmpReg);
         }
@@ -1422,6 +1423,7 @@ U8 Armv8btAsm::getHostMemWithOffset(U8 regEmulatedAddress, U32 offset) {
         shiftRegRightWithValue32(tmpReg, tmpReg, 12); // get page
         readMem64ValueOffset(resultReg, xCPU, CPU_OFFSET_MEMOFFSET);
         readMem64RegOffset(resultReg, resultReg, tmpReg, 3); // read memOffset, shift page << 3 (page*8), since sizeof(U64)==8 to get the value in memOffsets[page]        
+        addRegs64(resultReg, resultReg, xMem); // memOffsets is relative to xMem
         releaseTmpReg(tmpReg);
         return resultReg;
     }
@@ -1436,6 +1438,7 @@ U8 Armv8btAsm::getHostMemFromAddress(U32 address) {
 
         readMem64ValueOffset(resultReg, xCPU, CPU_OFFSET_MEMOFFSET);
         readMem64RegOffset(resultReg, resultReg, tmpReg, 3); // read memOffset, shift page << 3 (page*8), since sizeof(U64)==8 to get the value in memOffsets[page]        
+        addRegs64(resultReg, resultReg, xMem); // memOffsets is relative to xMem
         releaseTmpReg(tmpReg);
         return resultReg;
     }
@@ -488,6 +488,7 @@ void terminateOtherThread(const std::shared_ptr<KProcess>& process, U32 threadId
     KThread* thread = process->getThreadById(threadId);        
     if (thread) {
         thread->terminating = true;
+        thread->addPendingWork(KTHREAD_WORK_TERMINATE);
         ((BtCPU*)thread->cpu)->exitToStartThreadLoop = true;
         ((BtCPU*)thread->cpu)->wakeThreadIfWaiting();
     }
@@ -503,6 +504,7 @@ void terminateOtherThread(const std::shared_ptr<KProcess>& process, U32 threadId
 
 void terminateCurrentThread(KThread* thread) {
     thread->terminating = true;
+    thread->addPendingWork(KTHREAD_WORK_TERMINATE);
     ((BtCPU*)thread->cpu)->exitToStartThreadLoop = true;
 }
 
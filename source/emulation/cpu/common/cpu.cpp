@@ -192,6 +192,7 @@ void CPU::jmp(U32 big, U32 selector, U32 offset, U32 oldEip) {
 }
 
 void CPU::prepareFpuException(int code, int error) {
+    BOXEDWINE_KERNEL_LOCK;
     const std::shared_ptr<KProcess>& process = this->thread->process;
 
     // blocking signals, signalfd can't handle these
@@ -210,6 +211,7 @@ void CPU::prepareFpuException(int code, int error) {
 }
 
 void CPU::prepareException(int code, int error) {
+    BOXEDWINE_KERNEL_LOCK;
     const std::shared_ptr<KProcess>& process = this->thread->process;
 
      // blocking signals, signalfd can't handle these
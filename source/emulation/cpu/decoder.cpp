@@ -6079,6 +6079,10 @@ U32 DecodedOp::getNeededFlags(DecodedBlock* block, DecodedOp* op, U32 flags, U32
     return flags;
 }
 
+// the branch ops allocate these without the kernel lock, so each scheduler worker keeps its own list
+#ifdef BOXEDWINE_WORKER_THREADS
+THREAD_LOCAL
+#endif
 static DecodedBlockFromNode* freeFromNodes;
 DecodedBlockFromNode* DecodedBlockFromNode::alloc() {
     DecodedBlockFromNode* result;
@@ -6152,6 +6156,9 @@ void DecodedBlock::removeReferenceFrom(DecodedBlock* block) {
 	}
 }
 
+#ifdef BOXEDWINE_WORKER_THREADS
+THREAD_LOCAL
+#endif
 DecodedBlock* DecodedBlock::currentBlock;
 
 void decodeBlock(pfnFetchByte fetchByte, U32 eip, bool isBig, U32 maxInstructions, U32 maxLen, U32 stopIfThrowsException, DecodedBlock* block) {
@@ -1504,6 +1504,9 @@ public:
 
 class DecodedBlock {
 public:   
+#ifdef BOXEDWINE_WORKER_THREADS
+    THREAD_LOCAL
+#endif
     static DecodedBlock* currentBlock;
     virtual ~DecodedBlock() {}
 
@@ -235,19 +235,28 @@ DecodedBlock* NormalCPU::getNextBlock() {
     DecodedBlock* block = this->thread->memory->getCodeBlock(startIp);
 
     if (!block) {
+        BOXEDWINE_KERNEL_LOCK;
         block = NormalBlock::alloc();
-        decodeBlock(fetchByte, startIp, this->isBig(), 0, K_PAGE_SIZE, 0, block);
         block->address = startIp;
-        
-        DecodedOp* op = block->op;
-        while (op) {
-            if (!op->pfn) // callback will be set by decoder
-                op->pfn = normalOps[op->inst];
-            op = op->next;
+#ifdef BOXEDWINE_DEFAULT_MMU
+        if (!CodePage::copySharedBlock(startIp, this->isBig(), block))
+#endif
+        {
+            decodeBlock(fetchByte, startIp, this->isBig(), 0, K_PAGE_SIZE, 0, block);
+
+            DecodedOp* op = block->op;
+            while (op) {
+                if (!op->pfn) // callback will be set by decoder
+                    op->pfn = normalOps[op->inst];
+                op = op->next;
+            }
+#ifdef BOXEDWINE_DEFAULT_MMU
+            CodePage::addSharedBlock(startIp, this->isBig(), block);
+#endif
         }
         this->thread->memory->addCodeBlock(startIp, block);
         if (this->firstOp) {
-            op = DecodedOp::alloc();
+            DecodedOp* op = DecodedOp::alloc();
             op->inst = Custom1;
             op->pfn = this->firstOp;
             op->next = block->op;
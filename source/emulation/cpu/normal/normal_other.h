@@ -184,6 +184,12 @@ void OPCALL normal_int80(CPU* cpu, DecodedOp* op) {
 }
 void OPCALL normal_int98(CPU* cpu, DecodedOp* op) {
     START_OP(cpu, op);
+#ifdef BOXEDWINE_WORKER_THREADS
+    if (!runOnMainWorker(cpu->thread)) {
+        return; // the instruction runs again once the main thread picks up this thread
+    }
+#endif
+    BOXEDWINE_KERNEL_LOCK;
     U32 index = cpu->peek32(0);
     if (index<wine_callbackSize && wine_callback[index]) {
         wine_callback[index](cpu);
@@ -196,12 +202,24 @@ void OPCALL normal_int98(CPU* cpu, DecodedOp* op) {
 }
 void OPCALL normal_int99(CPU* cpu, DecodedOp* op) {
     START_OP(cpu, op);
+#ifdef BOXEDWINE_WORKER_THREADS
+    if (!runOnMainWorker(cpu->thread)) {
+        return; // the instruction runs again once the main thread picks up this thread
+    }
+#endif
+    BOXEDWINE_KERNEL_LOCK;
     U32 index = cpu->peek32(0);
     callOpenGL(cpu, index);
     NEXT();
 }
 void OPCALL normal_int9A(CPU* cpu, DecodedOp* op) {
     START_OP(cpu, op);
+#ifdef BOXEDWINE_WORKER_THREADS
+    if (!runOnMainWorker(cpu->thread)) {
+        return; // the instruction runs again once the main thread picks up this thread
+    }
+#endif
+    BOXEDWINE_KERNEL_LOCK;
 #ifdef BOXEDWINE_VULKAN
     U32 index = cpu->peek32(0);
     callVulkan(cpu, index);
@@ -210,6 +228,7 @@ void OPCALL normal_int9A(CPU* cpu, DecodedOp* op) {
 }
 void OPCALL normal_intIb(CPU* cpu, DecodedOp* op) {
     START_OP(cpu, op);
+    BOXEDWINE_KERNEL_LOCK;
     cpu->thread->signalIllegalInstruction(5);// 5=ILL_PRVOPC  // :TODO: just a guess
     NEXT_DONE();
 }
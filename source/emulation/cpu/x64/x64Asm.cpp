@@ -330,6 +330,7 @@ U8 X64Asm::getHostMem(U8 regEmulatedAddress, bool isRex) {
         } else {
             releaseTmpReg(tmpReg);
         }
+        addWithLea(resultReg, true, resultReg, true, HOST_MEM, true, 0, 0, 8); // memOffsets is relative to HOST_MEM, lea so that flags aren't changed
         return resultReg;
     }
 }
@@ -342,6 +343,7 @@ U8 X64Asm::getHostMemFromAddress(U32 address) {
         U8 resultReg = getTmpReg();
         writeToRegFromMem(resultReg, true, HOST_CPU, true, -1, false, 0, CPU_MEMOFFSET, 8, false);
         writeToRegFromMem(resultReg, true, resultReg, true, -1, false, 0, (address >> K_PAGE_SHIFT) << 3, 8, false);
+        addWithLea(resultReg, true, resultReg, true, HOST_MEM, true, 0, 0, 8); // memOffsets is relative to HOST_MEM
         return resultReg;
     }
 }
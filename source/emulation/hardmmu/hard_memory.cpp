@@ -22,13 +22,13 @@
 #include <string.h>
 #include <setjmp.h>
 #include "hard_memory.h"
+#include "loader.h"
 #include "../cpu/binaryTranslation/btCodeMemoryWrite.h"
 #include "../cpu/binaryTranslation/btCodeChunk.h"
 
-Memory::Memory() : allocated(0), callbackPos(0) {
-    memset(flags, 0, sizeof(flags));
-    memset(nativeFlags, 0, sizeof(nativeFlags));
-    memset(memOffsets, 0, sizeof(memOffsets));
+Memory::Memory() : allocated(0), pageTables(NULL), pageTablesSize(0), callbackPos(0) {
+    memset(needsMemoryOffset, 0, sizeof(needsMemoryOffset));
+    this->freePages.setRange(0, K_NUMBER_OF_PAGES, true);
 #ifndef BOXEDWINE_BINARY_TRANSLATOR
     memset(codeCache, 0, sizeof(codeCache));    
 #else
@@ -39,13 +39,16 @@ Memory::Memory() : allocated(0), callbackPos(0) {
         this->eipToHostInstructionPages = NULL;
     }
     this->eipToHostInstructionAddressSpaceMapping = NULL;
-    memset(this->dynamicCodePageUpdateCount, 0, sizeof(this->dynamicCodePageUpdateCount));
-    memset(this->committedEipPages, 0, sizeof(this->committedEipPages));
+    this->nativePermissionBatchDepth = 0;
+    this->nativePermissionBatchThread = NULL;
+    this->pendingNativePermissionStart = K_NATIVE_NUMBER_OF_PAGES;
+    this->pendingNativePermissionEnd = 0;
 #endif    
     reserveNativeMemory();
 
     allocNativeMemory(CALL_BACK_ADDRESS >> K_PAGE_SHIFT, K_NATIVE_PAGES_PER_PAGE, PAGE_READ | PAGE_EXEC | PAGE_WRITE);
     this->addCallback(onExitSignal);
+    this->mapVDSO();
 #ifdef BOXEDWINE_DYNAMIC
     this->dynamicExecutableMemoryPos = 0;
     this->dynamicExecutableMemoryLen = 0;
@@ -98,6 +101,7 @@ void Memory::reset() {
     this->callbackPos = 0;
     allocNativeMemory(CALL_BACK_ADDRESS >> K_PAGE_SHIFT, K_NATIVE_PAGES_PER_PAGE, PAGE_READ | PAGE_EXEC | PAGE_WRITE);
     this->addCallback(onExitSignal);
+    this->mapVDSO();
 }
 
 void Memory::releaseNativeMemory() {
@@ -108,11 +112,12 @@ void Memory::releaseNativeMemory() {
     }
     clearAllNeedsMemoryOffset();
     Platform::releaseNativeMemory((void*)this->id, 0x100000000l);
-    memset(this->flags, 0, sizeof(this->flags));
-    memset(this->nativeFlags, 0, sizeof(this->nativeFlags));
-    memset(this->memOffsets, 0, sizeof(this->memOffsets));
+    this->freePages.setRange(0, K_NUMBER_OF_PAGES, true);
+    this->mappedPages.clear();
     this->allocated = 0;
 #ifdef BOXEDWINE_BINARY_TRANSLATOR
+    this->pendingNativePermissionStart = K_NATIVE_NUMBER_OF_PAGES;
+    this->pendingNativePermissionEnd = 0;
     executableMemoryReleased();
     for (auto& p : this->allocatedExecutableMemory) {
         Platform::releaseNativeMemory(p.memory, p.size);
@@ -123,9 +128,48 @@ void Memory::releaseNativeMemory() {
         this->eipToHostInstructionAddressSpaceMapping = NULL;
     }
 #endif
+    freePageTables();
 }
 
+void Memory::allocPageTables() {
+    this->pageTablesSize = K_NUMBER_OF_PAGES * sizeof(U64) + K_NUMBER_OF_PAGES + K_NATIVE_NUMBER_OF_PAGES * 2;
+#ifdef BOXEDWINE_BINARY_TRANSLATOR
+    this->pageTablesSize += K_NUMBER_OF_PAGES * sizeof(bool);
+#endif
+    this->pageTables = (U8*)Platform::allocZeroedNativeMemory(this->pageTablesSize);
+
+    U8* p = this->pageTables;
+    this->memOffsets = (U64*)p;
+    p += K_NUMBER_OF_PAGES * sizeof(U64);
+    this->flags = p;
+    p += K_NUMBER_OF_PAGES;
+    this->nativeFlags = p;
+    p += K_NATIVE_NUMBER_OF_PAGES;
+    this->dynamicCodePageUpdateCount = p;
+    p += K_NATIVE_NUMBER_OF_PAGES;
+#ifdef BOXEDWINE_BINARY_TRANSLATOR
+    this->committedEipPages = (bool*)p;
+#endif
+}
+
+void Memory::freePageTables() {
+    if (this->pageTables) {
+        Platform::releaseNativeMemory(this->pageTables, this->pageTablesSize);
+        this->pageTables = NULL;
+        this->pageTablesSize = 0;
+    }
+}
+
+// number of emulated pages whose eip to host mapping fills one 2MB huge page
+#define EIP_MAPPING_PAGES_PER_HUGE_PAGE (0x200000 / (sizeof(void*) << K_PAGE_SHIFT))
+
 void Memory::commitHostAddressSpaceMapping(U32 page, U32 pageCount, U64 defaultValue) {
+    if (KSystem::useHugePages) {
+        // commit whole huge pages at a time, otherwise the host can't back the mapping with them
+        U32 endPage = page + pageCount;
+        page &= ~(EIP_MAPPING_PAGES_PER_HUGE_PAGE - 1);
+        pageCount = (U32)(((endPage + EIP_MAPPING_PAGES_PER_HUGE_PAGE - 1) & ~(EIP_MAPPING_PAGES_PER_HUGE_PAGE - 1)) - page);
+    }
     for (U32 i=0;i<pageCount;i++) {
         if (!this->isEipPageCommitted(page+i)) {
             U8* address = (U8*)this->eipToHostInstructionAddressSpaceMapping+((U64)(page+i))*K_PAGE_SIZE*sizeof(void*);
@@ -147,36 +191,52 @@ void Memory::reset(U32 page, U32 pageCount) {
 }
 
 void Memory::clone(Memory* from) {
-    int i=0;    
+    NativePermissionBatch batch(this);
+    U32 i = 0;
 
-    for (i=0;i<0x100000;i++) {
-        if (from->isPageAllocated(i)) {
-            if (from->flags[i] & PAGE_MAPPED_HOST) {
+    while (i < K_NUMBER_OF_PAGES) {
+        if (!from->isPageAllocated(i)) {
+            if (this->flags[i] != from->flags[i]) { // don't touch the parts of the table that aren't used
                 this->flags[i] = from->flags[i];
-                this->memOffsets[i] = from->memOffsets[i];
-                continue;
-            }
-            bool changedWritePermission = false;
-            if (!(from->flags[i] & PAGE_WRITE)) {
-                changedWritePermission = true;
             }
-            bool changedReadPermission = false;
-            if (!from->isShared(i) && !(from->flags[i] & PAGE_READ)) {
+            i++;
+            continue;
+        }
+        if (from->flags[i] & PAGE_MAPPED_HOST) {
+            this->flags[i] = from->flags[i];
+            this->memOffsets[i] = from->memOffsets[i] + from->id - this->id;
+            i++;
+            continue;
+        }
+        // copy a run of allocated pages at once so that the host permissions are changed once per run instead of per page
+        U32 runStart = i;
+        while (i < K_NUMBER_OF_PAGES && from->isPageAllocated(i) && !(from->flags[i] & PAGE_MAPPED_HOST)) {
+            i++;
+        }
+        U32 runCount = i - runStart;
+        bool changedReadPermission = false;
+
+        for (U32 j = runStart; j < i;) {
+            if (!from->isShared(j) && !(from->flags[j] & PAGE_READ)) {
+                U32 unreadableStart = j;
+                while (j < i && !from->isShared(j) && !(from->flags[j] & PAGE_READ)) {
+                    j++;
+                }
+                from->updateNativePermission(unreadableStart, j - unreadableStart, PAGE_READ);
                 changedReadPermission = true;
-                from->updateNativePermission(i, 1, PAGE_READ);
-            }
-            allocNativeMemory(i, 1, from->flags[i] | PAGE_WRITE);
-            memcpy(getNativeAddress(this, i << K_PAGE_SHIFT), getNativeAddress(from, i << K_PAGE_SHIFT), K_PAGE_SIZE);
-            if (changedWritePermission) {
-                updatePagePermission(i, 1);
-            }
-            if (changedReadPermission) {
-                from->updatePagePermission(i, 1);
+            } else {
+                j++;
             }
-        } else {
-            this->flags[i] = from->flags[i];
-        }     
+        }
+        allocNativeMemory(runStart, runCount, PAGE_READ | PAGE_WRITE);
+        memcpy(getNativeAddress(this, runStart << K_PAGE_SHIFT), getNativeAddress(from, runStart << K_PAGE_SHIFT), runCount << K_PAGE_SHIFT);
+        memcpy(&this->flags[runStart], &from->flags[runStart], runCount);
+        updatePagePermission(runStart, runCount);
+        if (changedReadPermission) {
+            from->updatePagePermission(runStart, runCount);
+        }
     }
+    updateAvailablePages(0, K_NUMBER_OF_PAGES);
 }
 
 void zeroMemory(U32 address, int len) {
@@ -197,9 +257,10 @@ void Memory::unmapNativeMemory(U32 address, U32 size) {
     U64 pageStart = address >> K_PAGE_SHIFT;
 
     for (U32 i = 0; i < pageCount; i++) {
-        this->memOffsets[i + pageStart] = this->id;
+        this->memOffsets[i + pageStart] = 0;
         this->flags[i + pageStart] = 0;
     }
+    updateAvailablePages((U32)pageStart, pageCount);
 }
 
 U32 Memory::mapNativeMemory(void* hostAddress, U32 size) {
@@ -212,19 +273,83 @@ U32 Memory::mapNativeMemory(void* hostAddress, U32 size) {
     U64 offset;
     
     for (int i = 0; i < K_NUMBER_OF_PAGES; i++) {
-        if ((i << K_PAGE_SHIFT) + this->memOffsets[i] == hostStart) {
+        if ((i << K_PAGE_SHIFT) + this->id + this->memOffsets[i] == hostStart) {
             return (i << (K_PAGE_SHIFT)) + ((U32)((U64)hostAddress) & K_PAGE_MASK);
         }
     }
     findFirstAvailablePage(0x10000, pageCount, &result, false, true);
-    offset = hostStart - (result << K_PAGE_SHIFT);
+    offset = hostStart - (result << K_PAGE_SHIFT) - this->id;
     for (i = 0; i < pageCount; i++) {
         this->memOffsets[result + i] = offset;
         this->flags[result + i] = PAGE_MAPPED_HOST | PAGE_READ | PAGE_WRITE;
     }
+    updateAvailablePages(result, pageCount);
     return (result << K_PAGE_SHIFT) + ((U32)((U64)hostAddress) & K_PAGE_MASK);
 }
 
+static U32 getNativePermissionIndex(U32 page) {
+    return (page << K_PAGE_SHIFT) >> K_NATIVE_PAGE_SHIFT;
+}
+
+// returns how many of the pages, starting at the first one, the host file covers
+static U32 getHostFilePageCount(FsOpenNode* openNode, U32 pageCount, U64 offset) {
+    S64 length = openNode->length();
+
+    if (length <= (S64)offset) {
+        return 0;
+    }
+    U64 filePageCount = ((U64)length - offset + K_PAGE_SIZE - 1) >> K_PAGE_SHIFT;
+    if (filePageCount < pageCount) {
+        return (U32)filePageCount;
+    }
+    return pageCount;
+}
+
+// maps the host file over the start of a private file mapping so that the host page cache backs it instead of a copy read
+// into anonymous memory, the host gives us copy on write.  Pages past the end of the file are not mapped, touching them
+// on the host would be a SIGBUS, they are left for allocNativeMemory to zero.  Returns the number of pages that were mapped
+static U32 mapHostFilePrivate(Memory* memory, U32 page, U32 pageCount, U64 offset, const BoxedPtr<MappedFile>& mappedFile) {
+    if (K_NATIVE_PAGES_PER_PAGE != 1) {
+        return 0;
+    }
+    FsOpenNode* openNode = mappedFile->file->openFile;
+    S32 handle = openNode->getNativeHandle();
+    if (handle < 0) {
+        return 0;
+    }
+    U32 filePageCount = getHostFilePageCount(openNode, pageCount, offset);
+    if (!filePageCount || !Platform::mapNativeFile((void*)(memory->id + ((U64)page << K_PAGE_SHIFT)), (U64)filePageCount << K_PAGE_SHIFT, handle, offset, false)) {
+        return 0;
+    }
+    for (U32 i = 0; i < filePageCount; i++) {
+        memory->nativeFlags[getNativePermissionIndex(page + i)] |= NATIVE_FLAG_HOST_FILE;
+    }
+    return filePageCount;
+}
+
+// the shared buffer for a file mapping, if the whole range is in the host file then the host file is mapped directly so
+// that writes reach the file and other processes, else it is a copy that the caller needs to load
+static U8* allocSharedFileMemory(U32 pageCount, const BoxedPtr<MappedFile>& mappedFile, bool* needToLoad) {
+    U64 len = (U64)pageCount << K_PAGE_SHIFT;
+    FsOpenNode* openNode = mappedFile->file->openFile;
+    S32 handle = openNode->getNativeHandle();
+
+    if (handle >= 0 && getHostFilePageCount(openNode, pageCount, 0) == pageCount) {
+        // without write access to the host file, a private host mapping still shares the page cache for reads
+        U8* ram = (U8*)Platform::mapNativeFile(NULL, len, handle, 0, (openNode->flags & K_O_ACCMODE) == K_O_RDWR);
+        if (ram) {
+            mappedFile->systemCacheEntry->nativeMappingLen = len;
+            *needToLoad = false;
+            return ram;
+        }
+    }
+    U8* ram = new U8[len]; // make it continuous
+
+    memset(ram, 0, len);
+    *needToLoad = true;
+    return ram;
+}
+
 void Memory::allocPages(U32 page, U32 pageCount, U8 permissions, FD fd, U64 offset, const BoxedPtr<MappedFile>& mappedFile) {    
     for (U32 i = 0; i < pageCount; i++) {
         this->clearCodePageFromCache(page + i);
@@ -232,29 +357,32 @@ void Memory::allocPages(U32 page, U32 pageCount, U8 permissions, FD fd, U64 offs
     this->clearNeedsMemoryOffset(page, pageCount);
     if ((permissions & PAGE_PERMISSION_MASK) || mappedFile) {
         if ((permissions & PAGE_SHARED) == 0) {
-            allocNativeMemory(page, pageCount, permissions);
+            U32 filledPageCount = 0;
+
+            if (mappedFile) {
+                filledPageCount = mapHostFilePrivate(this, page, pageCount, offset, mappedFile);
+            }
+            allocNativeMemory(page, pageCount, permissions, filledPageCount);
+            if (filledPageCount) {
+                return;
+            }
         } else {
             bool needToLoad = false;       
             
             freeNativeMemory(page, pageCount);
 
             if (!mappedFile->systemCacheEntry->data[0]) {
-                U32 len = pageCount << K_PAGE_SHIFT;
-                U8* ram = new U8[len]; // make it continuous
-
-                //klog("shared ram %.08X%.08X @%.08X len=%X\n", (U32)((U64)ram >> 32), (U32)((U64)ram), (page << K_PAGE_SHIFT), len);
-                memset(ram, 0, len);
-                needToLoad = true;
-                mappedFile->systemCacheEntry->data[0] = ram;
                 if (offset) {
                     kpanic("allocPages doesn't support offset with shared memory");
                 }
+                mappedFile->systemCacheEntry->data[0] = allocSharedFileMemory(pageCount, mappedFile, &needToLoad);
             }
-            U64 offset = (U64)mappedFile->systemCacheEntry->data[0] - (page << K_PAGE_SHIFT);
+            U64 offset = (U64)mappedFile->systemCacheEntry->data[0] - (page << K_PAGE_SHIFT) - this->id;
             for (U32 i = 0; i < pageCount; i++) {
                 this->memOffsets[page + i] = offset;
                 this->flags[page + i] = PAGE_MAPPED_HOST | PAGE_ALLOCATED | permissions;
             }
+            updateAvailablePages(page, pageCount);
             // if the native page wasn't removed from memory because the allocation granularity is more than 1 page and a near by page is in use, 
             // then if we don't mark the page as read only, it won't generate an exception and the shared memory won't be used.  updatePagePermission
             // will see that these pages are shared and will use a strict (lowest permission) for all pages in the granulaty
@@ -269,6 +397,7 @@ void Memory::allocPages(U32 page, U32 pageCount, U8 permissions, FD fd, U64 offs
         for (i=0;i<pageCount;i++) {
             this->flags[i+page]=permissions;
         }
+        updateAvailablePages(page, pageCount);
     }
     if (mappedFile) {
         bool addedWritePermission = false;
@@ -305,33 +434,23 @@ void Memory::protectPage(U32 i, U32 permissions) {
 }
 
 bool Memory::findFirstAvailablePage(U32 startingPage, U32 pageCount, U32* result, bool canBeReMapped, bool alignNative) {
-    U32 i;
-    
-    for (i=startingPage;i<K_NUMBER_OF_PAGES;i++) {
-        if (alignNative && !isAlignedNativePage(i)) {
-            continue;
-        }
-        if (i + pageCount >= K_NUMBER_OF_PAGES) {
-            return false;
-        }
-        if (((this->flags[i] & (PAGE_MAPPED | PAGE_MAPPED_HOST)) == 0 && !this->isPageAllocated(i)) || (canBeReMapped && (this->flags[i] & PAGE_MAPPED))) {
-            U32 j;
-            bool success = true;
+    U32 page;
 
-            for (j=1;j<pageCount;j++) {
-                if (((this->flags[i+j] & (PAGE_MAPPED | PAGE_MAPPED_HOST)) || this->isPageAllocated(i+j)) && (!canBeReMapped || !(this->flags[i+j] & PAGE_MAPPED))) {
-                    success = false;
-                    break;
-                }
-            }
-            if (success) {
-                *result = i;
-                return true;
-            }
-            i+=j; // no reason to check all the pages again
-        }
+    if (!this->freePages.findRun(startingPage, pageCount, alignNative ? K_NATIVE_PAGES_PER_PAGE : 1, canBeReMapped ? &this->mappedPages : NULL, &page)) {
+        return false;
+    }
+    if (page + pageCount >= K_NUMBER_OF_PAGES) {
+        return false;
+    }
+    *result = page;
+    return true;
+}
+
+void Memory::updateAvailablePages(U32 page, U32 pageCount) {
+    for (U32 i = page; i < page + pageCount; i++) {
+        this->freePages.set(i, (this->flags[i] & (PAGE_MAPPED | PAGE_MAPPED_HOST | PAGE_ALLOCATED)) == 0);
+        this->mappedPages.set(i, (this->flags[i] & PAGE_MAPPED) != 0);
     }
-    return false;
 }
 
 bool Memory::isValidReadAddress(U32 address, U32 len) {
@@ -458,6 +577,9 @@ void writeb(U32 address, U8 value) {
     if (flags & NATIVE_FLAG_CODEPAGE_READONLY) {
         BtCodeMemoryWrite w((BtCPU*)KThread::currentThread()->cpu, address, 1);
         *(U8*)getNativeAddress(m, address) = value;
+    } else if ((m->flags[page] & (PAGE_MAPPED_HOST | PAGE_WRITE)) == PAGE_MAPPED_HOST) {
+        // the host memory behind it might be writable, like it is for a read only shared mapping
+        KThread::currentThread()->seg_access(address, false, true);
     } else if ((flags & NATIVE_FLAG_COMMITTED) || (m->flags[page] & PAGE_MAPPED_HOST)) {
         *(U8*)getNativeAddress(KThread::currentThread()->memory, address) = value;
     } else {
@@ -493,6 +615,8 @@ void writew( U32 address, U16 value) {
     if (flags & NATIVE_FLAG_CODEPAGE_READONLY) {
         BtCodeMemoryWrite w((BtCPU*)KThread::currentThread()->cpu, address, 2);
         *(U16*)getNativeAddress(m, address) = value;
+    } else if ((m->flags[page] & (PAGE_MAPPED_HOST | PAGE_WRITE)) == PAGE_MAPPED_HOST) {
+        KThread::currentThread()->seg_access(address, false, true);
     } else if (flags & NATIVE_FLAG_COMMITTED || (m->flags[page] & PAGE_MAPPED_HOST)) {
         *(U16*)getNativeAddress(KThread::currentThread()->memory, address) = value;
     } else {
@@ -528,6 +652,8 @@ void writed(U32 address, U32 value) {
     if (flags & NATIVE_FLAG_CODEPAGE_READONLY) {
         BtCodeMemoryWrite w((BtCPU*)KThread::currentThread()->cpu, address, 4);
         *(U32*)getNativeAddress(m, address) = value;
+    } else if ((m->flags[page] & (PAGE_MAPPED_HOST | PAGE_WRITE)) == PAGE_MAPPED_HOST) {
+        KThread::currentThread()->seg_access(address, false, true);
     } else if ((flags & NATIVE_FLAG_COMMITTED) || (m->flags[page] & PAGE_MAPPED_HOST)) {
         *(U32*)getNativeAddress(KThread::currentThread()->memory, address) = value;
     } else {
@@ -552,6 +678,8 @@ void writeq(U32 address, U64 value) {
     if (flags & NATIVE_FLAG_CODEPAGE_READONLY) {
         BtCodeMemoryWrite w((BtCPU*)KThread::currentThread()->cpu, address, 8);
         *(U64*)getNativeAddress(m, address) = value;
+    } else if ((m->flags[page] & (PAGE_MAPPED_HOST | PAGE_WRITE)) == PAGE_MAPPED_HOST) {
+        KThread::currentThread()->seg_access(address, false, true);
     } else if ((flags & NATIVE_FLAG_COMMITTED) || (m->flags[page] & PAGE_MAPPED_HOST)) {
         *(U64*)getNativeAddress(KThread::currentThread()->memory, address) = value;
     } else {
@@ -562,6 +690,42 @@ void writeq(U32 address, U64 value) {
 #endif
 }
 
+// shared by all processes like the soft MMU's.  The guest reaches vdsoTimeRam through memOffsets, the host only maps it
+// read only so that neither translated code nor a syscall can change every process's clock.  The host writes it through
+// vdsoTimeWriteRam, see KSystem::updateTimePage
+static U8* vdsoTimeRam;
+static U8* vdsoTimeWriteRam;
+
+void Memory::mapVDSO() {
+    U32 timePage = VDSO_TIME_ADDRESS >> K_PAGE_SHIFT;
+    U32 codePage = VDSO_ADDRESS >> K_PAGE_SHIFT;
+
+    if (!vdsoTimeRam) {
+        void* writable = NULL;
+        vdsoTimeRam = (U8*)Platform::allocReadOnlyNativeMemory(K_NATIVE_PAGES_PER_PAGE << K_PAGE_SHIFT, &writable);
+        vdsoTimeWriteRam = (U8*)writable;
+    }
+    U64 offset = (U64)vdsoTimeRam - ((U64)timePage << K_PAGE_SHIFT) - this->id;
+    for (U32 i = 0; i < K_NATIVE_PAGES_PER_PAGE; i++) {
+        this->memOffsets[timePage + i] = offset;
+        this->flags[timePage + i] = PAGE_MAPPED_HOST | PAGE_ALLOCATED | PAGE_READ;
+    }
+    updateAvailablePages(timePage, K_NATIVE_PAGES_PER_PAGE);
+    updatePagePermission(timePage, K_NATIVE_PAGES_PER_PAGE);
+
+    allocNativeMemory(codePage, K_NATIVE_PAGES_PER_PAGE, PAGE_READ | PAGE_EXEC | PAGE_WRITE);
+    ElfLoader::writeVDSO((U8*)getNativeAddress(this, VDSO_ADDRESS));
+    // same as the soft MMU and the kernel, the guest can't change the vDSO or the code cached from it
+    for (U32 i = 0; i < K_NATIVE_PAGES_PER_PAGE; i++) {
+        protectPage(codePage + i, PAGE_READ | PAGE_EXEC);
+    }
+    KSystem::updateTimePage(this);
+}
+
+U8* Memory::getTimePage() {
+    return vdsoTimeWriteRam;
+}
+
 void Memory::addCallback(OpCallback func) {
     U64 funcAddress = (U64)func;
 
@@ -995,9 +1159,7 @@ bool Memory::clearCodePageReadOnly(U32 nativePage) {
 
 void Memory::reserveNativeMemory() {
     this->id = (U64)Platform::reserveNativeMemory(false);
-    for (int i = 0; i < K_NUMBER_OF_PAGES; i++) {
-        this->memOffsets[i] = this->id;
-    }
+    allocPageTables();
 #ifdef BOXEDWINE_BINARY_TRANSLATOR
     if (KSystem::useLargeAddressSpace) {
         this->eipToHostInstructionAddressSpaceMapping = Platform::reserveNativeMemory(true);
@@ -1139,43 +1301,72 @@ void Memory::executableMemoryReleased() {
 }
 #endif
 
-static U32 getNativePermissionIndex(U32 page) {
-    return (page << K_PAGE_SHIFT) >> K_NATIVE_PAGE_SHIFT;
+// Platform::updateNativePermission treats exec as read, so native pages that only differ by that can be changed with one host call
+static U32 getHostPermission(U32 permission) {
+    U32 result = permission & PAGE_WRITE;
+    if (permission & (PAGE_READ | PAGE_EXEC)) {
+        result |= PAGE_READ;
+    }
+    return result;
 }
 
-void Memory::allocNativeMemory(U32 page, U32 pageCount, U32 flags) {
+void Memory::allocNativeMemory(U32 page, U32 pageCount, U32 flags, U32 filledPageCount) {
     U32 gran = Platform::getPageAllocationGranularity();
     U32 permissionGran = Platform::getPagePermissionGranularity();
     U32 granPage = page & ~(gran - 1);
     U32 granCount = ((gran - 1) + pageCount + (page - granPage)) / gran;    
-    U32 permPerAllocPage = gran / permissionGran;
 
-    for (U32 i = 0; i < granCount; i++) {
-        U64 address = (this->id | (granPage << K_PAGE_SHIFT));
-        U32 nativePermissionIndex = getNativePermissionIndex(granPage);
-        if (!(this->nativeFlags[nativePermissionIndex] & NATIVE_FLAG_COMMITTED)) {            
-            Platform::allocateNativeMemory(address);
-            this->allocated += (gran << K_PAGE_SHIFT);
-            for (U32 j = 0; j < permPerAllocPage; j++) {
-                this->nativeFlags[nativePermissionIndex + j] |= NATIVE_FLAG_COMMITTED;
-            }
-        } else {
-            // so that the memset works below
 #ifdef _DEBUG
-            if (permissionGran > gran) {
-                kpanic("Wasn't expecting a larger permission size than the allocation size");
-            }
+    if (permissionGran > gran) {
+        kpanic("Wasn't expecting a larger permission size than the allocation size");
+    }
 #endif
-            Platform::updateNativePermission(address, PAGE_READ | PAGE_WRITE, gran << K_PAGE_SHIFT);
+    this->releaseHostFilePages(page + filledPageCount, pageCount - filledPageCount);
+
+    // contiguous allocation pages that are all committed or all not committed are handled with one host call
+    auto commitRun = [this, permissionGran](U32 runPage, U32 runCount, bool committed) {
+        if (committed) {
+            // so that the memset works below
+            this->updateNativePermission(runPage, runCount, PAGE_READ | PAGE_WRITE);
+        } else {
+            Platform::allocateNativeMemory(this->id | (runPage << K_PAGE_SHIFT), runCount << K_PAGE_SHIFT);
+            this->allocated += (runCount << K_PAGE_SHIFT);
+            U32 nativePermissionIndex = getNativePermissionIndex(runPage);
+            for (U32 j = 0; j < runCount / permissionGran; j++) {
+                this->nativeFlags[nativePermissionIndex + j] &= ~(PAGE_PERMISSION_MASK | NATIVE_FLAG_PERMISSION_PENDING);
+                this->nativeFlags[nativePermissionIndex + j] |= NATIVE_FLAG_COMMITTED | PAGE_READ | PAGE_WRITE;
+            }
+        }
+    };
+    U32 runPage = granPage;
+    U32 runCount = 0;
+    bool runCommitted = false;
+
+    for (U32 i = 0; i < granCount; i++) {
+        bool committed = (this->nativeFlags[getNativePermissionIndex(granPage)] & NATIVE_FLAG_COMMITTED) != 0;
+        if (runCount && committed != runCommitted) {
+            commitRun(runPage, runCount, runCommitted);
+            runCount = 0;
+        }
+        if (!runCount) {
+            runPage = granPage;
+            runCommitted = committed;
         }
+        runCount += gran;
         granPage += gran;
     }
+    if (runCount) {
+        commitRun(runPage, runCount, runCommitted);
+    }
     for (U32 i = 0; i < pageCount; i++) {
         this->flags[page + i] = flags | PAGE_ALLOCATED;
-        this->memOffsets[page + i] = this->id;
+        this->memOffsets[page + i] = 0;
     }
+    updateAvailablePages(page, pageCount);
     
-    memset(getNativeAddress(this, page << K_PAGE_SHIFT), 0, pageCount << K_PAGE_SHIFT);
+    if (filledPageCount < pageCount) {
+        memset(getNativeAddress(this, (page + filledPageCount) << K_PAGE_SHIFT), 0, (pageCount - filledPageCount) << K_PAGE_SHIFT);
+    }
 
     granPage = page & ~(gran - 1);
     U32 granPageCount = granCount * gran;
@@ -1183,50 +1374,114 @@ void Memory::allocNativeMemory(U32 page, U32 pageCount, U32 flags) {
     //printf("allocated %X - %X\n", page << PAGE_SHIFT, (page+pageCount) << PAGE_SHIFT);
 }
 
+// pages that were mapped from a host file by mapHostFilePrivate are replaced with fresh reserved memory, else the host file
+// stays mapped and reusing the page would write to file backed pages, which is a SIGBUS if the file was truncated.  They are
+// left uncommitted so that the caller will commit them again if needed
+void Memory::releaseHostFilePages(U32 page, U32 pageCount) {
+    U32 runPage = 0;
+    U32 runCount = 0;
+
+    for (U32 i = 0; i <= pageCount; i++) {
+        U32 nativePermissionIndex = getNativePermissionIndex(page + i);
+        if (i < pageCount && (this->nativeFlags[nativePermissionIndex] & NATIVE_FLAG_HOST_FILE)) {
+            if (this->nativeFlags[nativePermissionIndex] & NATIVE_FLAG_COMMITTED) {
+                this->allocated -= K_PAGE_SIZE;
+            }
+            this->nativeFlags[nativePermissionIndex] &= ~(NATIVE_FLAG_HOST_FILE | NATIVE_FLAG_COMMITTED | NATIVE_FLAG_PERMISSION_PENDING | PAGE_PERMISSION_MASK);
+            if (!runCount) {
+                runPage = page + i;
+            }
+            runCount++;
+        } else if (runCount) {
+            Platform::unmapNativeFile((void*)(this->id + ((U64)runPage << K_PAGE_SHIFT)), (U64)runCount << K_PAGE_SHIFT);
+            runCount = 0;
+        }
+    }
+}
+
+// called from the host SIGBUS handler.  A host file mapped into guest memory or as a shared file buffer raises SIGBUS on
+// the host when a page past the end of the file is touched because the file was truncated after it was mapped.  Instead
+// of taking down the emulator, the page is replaced with zeros like the part of the last page past the end of a file.
+// Returns false if the address isn't in one of these mappings
+bool Memory::handleHostFileBusError(U64 hostAddress) {
+    if (hostAddress < this->id || hostAddress >= this->id + ((U64)K_NUMBER_OF_PAGES << K_PAGE_SHIFT)) {
+        return Platform::zeroTruncatedNativeFilePage((void*)hostAddress);
+    }
+    U32 page = (U32)((hostAddress - this->id) >> K_PAGE_SHIFT);
+    U32 nativePermissionIndex = getNativePermissionIndex(page);
+    if (!(this->nativeFlags[nativePermissionIndex] & NATIVE_FLAG_HOST_FILE)) {
+        return false;
+    }
+    void* p = (void*)(this->id + ((U64)page << K_PAGE_SHIFT));
+    // the page stays committed, it is just anonymous memory now
+    Platform::unmapNativeFile(p, K_PAGE_SIZE);
+    Platform::commitNativeMemory(p, K_PAGE_SIZE);
+    this->nativeFlags[nativePermissionIndex] &= ~NATIVE_FLAG_HOST_FILE;
+    this->updatePagePermission(page, 1);
+    return true;
+}
+
 void Memory::freeNativeMemory(U32 page, U32 pageCount) {    
+    this->releaseHostFilePages(page, pageCount);
     for (U32 i = 0; i < pageCount; i++) {
         U32 nativePermissionIndex = getNativePermissionIndex(page + i);
         this->nativeFlags[nativePermissionIndex] &= ~NATIVE_FLAG_CODEPAGE_READONLY;
         this->clearCodePageFromCache(page + i);
         this->flags[page + i] = 0;
-        this->memOffsets[page + i] = this->id;
+        this->memOffsets[page + i] = 0;
     }
+    updateAvailablePages(page, pageCount);
 
     U32 gran = Platform::getPageAllocationGranularity();
     U32 permissionGran = Platform::getPagePermissionGranularity();
     U32 permPerAllocPage = gran / permissionGran;
     U32 granPage = page & ~(gran - 1);
     U32 granCount = ((gran - 1) + pageCount + (page - granPage)) / gran;
+    U32 freePage = 0;
+    U32 freeCount = 0;
+
     for (U32 i = 0; i < granCount; i++) {
         U32 nativePermissionIndex = getNativePermissionIndex(granPage);
-        if (this->nativeFlags[nativePermissionIndex] & NATIVE_FLAG_COMMITTED) {
-            bool inUse = false;
+        bool canFree = false;
 
+        if (this->nativeFlags[nativePermissionIndex] & NATIVE_FLAG_COMMITTED) {
+            canFree = true;
             for (U32 j = 0; j < gran; j++) {
                 if (this->isPageAllocated(granPage + j)) {
-                    inUse = true;
+                    canFree = false;
                     break;
                 }
             }
-            if (!inUse) {
-                U64 address = (this->id | (granPage << K_PAGE_SHIFT));
-                Platform::freeNativeMemory(address);
+            if (canFree) {
                 for (U32 j = 0; j < permPerAllocPage; j++) {
                     this->nativeFlags[nativePermissionIndex + j] = 0;
                 }
                 this->allocated -= (gran << K_PAGE_SHIFT);
-            } else {
-                updatePagePermission(granPage, gran);
             }
         }
+        if (canFree) {
+            if (!freeCount) {
+                freePage = granPage;
+            }
+            freeCount += gran;
+        } else if (freeCount) {
+            Platform::freeNativeMemory(this->id | (freePage << K_PAGE_SHIFT), freeCount << K_PAGE_SHIFT);
+            freeCount = 0;
+        }
         granPage += gran;
     }
+    if (freeCount) {
+        Platform::freeNativeMemory(this->id | (freePage << K_PAGE_SHIFT), freeCount << K_PAGE_SHIFT);
+    }
+    // allocation pages that are still in use by other pages, the ones that were freed are no longer committed and will be skipped
+    updatePagePermission(page & ~(gran - 1), granCount * gran);
 }
 
 void Memory::updatePagePermission(U32 page, U32 pageCount) {
     U32 permissionGran = Platform::getPagePermissionGranularity();
     U32 permissionGranPage = page & ~(permissionGran - 1);
     U32 permissionGranCount = ((permissionGran - 1) + pageCount + (page - permissionGranPage)) / permissionGran;    
+    U32 nativePage = getNativePermissionIndex(permissionGranPage);
 
     // could be mixed (M1 is 16K permission)
     for (U32 i = 0; i < permissionGranCount; i++) {
@@ -1250,34 +1505,96 @@ void Memory::updatePagePermission(U32 page, U32 pageCount) {
                 permissions |= this->flags[permissionGranPage + j];
             }
         }
-        U64 address = (this->id | (permissionGranPage << K_PAGE_SHIFT));
         U32 index = getNativePermissionIndex(permissionGranPage);
         if (this->nativeFlags[index] & NATIVE_FLAG_CODEPAGE_READONLY) {
             permissions &= ~PAGE_WRITE;
         }
         if (this->nativeFlags[index] & NATIVE_FLAG_COMMITTED) {
             this->nativeFlags[index] &= ~PAGE_PERMISSION_MASK;
-            this->nativeFlags[index] |= (permissions & (PAGE_READ | PAGE_WRITE));
-            Platform::updateNativePermission(address, permissions);
+            this->nativeFlags[index] |= (permissions & PAGE_PERMISSION_MASK) | NATIVE_FLAG_PERMISSION_PENDING;
         }
         permissionGranPage += permissionGran;
     }
+    U32 nativePageCount = getNativePermissionIndex(permissionGranPage) - nativePage;
+    if (isBatchingNativePermissions()) {
+        if (nativePage < this->pendingNativePermissionStart) {
+            this->pendingNativePermissionStart = nativePage;
+        }
+        if (nativePage + nativePageCount > this->pendingNativePermissionEnd) {
+            this->pendingNativePermissionEnd = nativePage + nativePageCount;
+        }
+    } else {
+        flushNativePermissions(nativePage, nativePageCount);
+    }
 }
 
 void Memory::updateNativePermission(U32 page, U32 pageCount, U32 permission) {
     U32 permissionGran = Platform::getPagePermissionGranularity();
     U32 permissionGranPage = page & ~(permissionGran - 1);
     U32 permissionGranCount = ((permissionGran - 1) + pageCount + (page - permissionGranPage)) / permissionGran;
+    U32 nativePage = getNativePage(permissionGranPage);
 
     for (U32 i = 0; i < permissionGranCount; i++) {
-        U64 address = (this->id | (permissionGranPage << K_PAGE_SHIFT));
-        U32 nativePage = getNativePage(permissionGranPage);
-        if (this->nativeFlags[nativePage] & NATIVE_FLAG_COMMITTED) {
-            Platform::updateNativePermission(address, permission);
-            this->nativeFlags[nativePage] &= ~PAGE_PERMISSION_MASK;
-            this->nativeFlags[nativePage] |= (permission & (PAGE_READ | PAGE_WRITE));
+        U32 index = getNativePage(permissionGranPage);
+        if (this->nativeFlags[index] & NATIVE_FLAG_COMMITTED) {
+            this->nativeFlags[index] &= ~PAGE_PERMISSION_MASK;
+            this->nativeFlags[index] |= (permission & PAGE_PERMISSION_MASK) | NATIVE_FLAG_PERMISSION_PENDING;
         }
         permissionGranPage += permissionGran;
     }
+    // never deferred, the caller is about to access this memory
+    flushNativePermissions(nativePage, getNativePage(permissionGranPage) - nativePage);
+}
+
+bool Memory::isBatchingNativePermissions() {
+    return this->nativePermissionBatchDepth && this->nativePermissionBatchThread == KThread::currentThread();
+}
+
+void Memory::beginNativePermissionBatch() {
+    if (this->nativePermissionBatchDepth == 0) {
+        this->nativePermissionBatchThread = KThread::currentThread();
+        this->pendingNativePermissionStart = K_NATIVE_NUMBER_OF_PAGES;
+        this->pendingNativePermissionEnd = 0;
+    }
+    this->nativePermissionBatchDepth++;
+}
+
+void Memory::endNativePermissionBatch() {
+    this->nativePermissionBatchDepth--;
+    if (this->nativePermissionBatchDepth == 0) {
+        this->nativePermissionBatchThread = NULL;
+        if (this->pendingNativePermissionStart < this->pendingNativePermissionEnd) {
+            flushNativePermissions(this->pendingNativePermissionStart, this->pendingNativePermissionEnd - this->pendingNativePermissionStart);
+        }
+    }
+}
+
+// issues the host calls for native pages with NATIVE_FLAG_PERMISSION_PENDING, contiguous pages with the same host permission are merged into one call
+void Memory::flushNativePermissions(U32 nativePage, U32 nativePageCount) {
+    U32 runStart = 0;
+    U32 runCount = 0;
+    U32 runPermission = 0;
+
+    for (U32 i = nativePage; i < nativePage + nativePageCount; i++) {
+        U8 nativeFlag = this->nativeFlags[i];
+        bool pending = (nativeFlag & NATIVE_FLAG_PERMISSION_PENDING) != 0;
+        U32 permission = getHostPermission(nativeFlag);
+
+        if (runCount && (!pending || permission != runPermission)) {
+            Platform::updateNativePermission(this->id | (getEmulatedPage(runStart) << K_PAGE_SHIFT), runPermission, runCount << K_NATIVE_PAGE_SHIFT);
+            runCount = 0;
+        }
+        if (pending) {
+            this->nativeFlags[i] &= ~NATIVE_FLAG_PERMISSION_PENDING;
+            if (!runCount) {
+                runStart = i;
+                runPermission = permission;
+            }
+            runCount++;
+        }
+    }
+    if (runCount) {
+        Platform::updateNativePermission(this->id | (getEmulatedPage(runStart) << K_PAGE_SHIFT), runPermission, runCount << K_NATIVE_PAGE_SHIFT);
+    }
 }
 #endif
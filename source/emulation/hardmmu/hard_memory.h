@@ -23,6 +23,8 @@
 
 #define NATIVE_FLAG_COMMITTED 0x08
 #define NATIVE_FLAG_CODEPAGE_READONLY 0x10
+#define NATIVE_FLAG_PERMISSION_PENDING 0x20 // the permission bits have been updated but the host page hasn't been changed yet
+#define NATIVE_FLAG_HOST_FILE 0x40 // the host page is a private mapping of a host file, see mapHostFilePrivate
 
 INLINE void* getNativeAddress(Memory* memory, U32 address) {
     U32 page = address >> K_PAGE_SHIFT;
@@ -32,12 +34,12 @@ INLINE void* getNativeAddress(Memory* memory, U32 address) {
         kpanic("bad memory access");
     }
 #endif
-    return (void*)(address + memory->memOffsets[page]);
+    return (void*)(address + memory->id + memory->memOffsets[page]);
 }
 
 INLINE void* getNativeAddressNoCheck(Memory* memory, U32 address) {
     U32 page = address >> K_PAGE_SHIFT;
-    return (void*)(address + memory->memOffsets[page]);
+    return (void*)(address + memory->id + memory->memOffsets[page]);
 }
 
 INLINE U32 getHostAddress(KThread* thread, void* address) {
@@ -2,8 +2,10 @@
 
 #ifdef BOXEDWINE_DEFAULT_MMU
 #include "soft_code_page.h"
+#include "soft_ram.h"
 
 CodePage::CodePageEntry* CodePage::freeCodePageEntries;
+U32 CodePage::nextGeneration;
 
 CodePage::CodePageEntry* CodePage::allocCodePageEntry() {
     CodePageEntry* result;
@@ -24,6 +26,7 @@ void CodePage::freeCodePageEntry(CodePageEntry* entry) {
    
     if (entry->block)
         entry->block->dealloc(false);
+    entry->page->generation = ++nextGeneration;
 
     // remove any entries linked to this one from other pages
     if (entry->linkedPrev) {
@@ -51,12 +54,13 @@ void CodePage::freeCodePageEntry(CodePageEntry* entry) {
     freeCodePageEntries = entry; 
 }
 
-CodePage* CodePage::alloc(U8* page, U32 address, U32 flags) {
-    return new CodePage(page, address, flags);
+CodePage* CodePage::alloc(U8* page, U32 address, U32 flags, bool copyOnWrite) {
+    return new CodePage(page, address, flags, copyOnWrite);
 }
 
-CodePage::CodePage(U8* page, U32 address, U32 flags) : RWPage(page, address, flags, Code_Page) {
+CodePage::CodePage(U8* page, U32 address, U32 flags, bool copyOnWrite) : RWPage(page, address, flags, Code_Page), copyOnWrite(copyOnWrite) {
     memset(this->entries, 0, sizeof(this->entries));
+    this->generation = ++nextGeneration;
 }
 
 CodePage::~CodePage() {
@@ -174,9 +178,27 @@ DecodedBlock* CodePage::getCode(U32 eip) {
     return 0;
 }
 
+// the blocks stay valid since the copy has the same bytes, only the write that follows changes them
+void CodePage::copyRamOnWrite() {
+    if (!this->copyOnWrite) {
+        return;
+    }
+    this->copyOnWrite = false;
+    if (ramPageRefCount(this->page) < 2) {
+        return;
+    }
+    U8* ram = ramPageAlloc();
+    if (this->page != ramPageZero()) {
+        memcpy(ram, this->page, K_PAGE_SIZE);
+    }
+    ramPageDecRef(this->page);
+    this->page = ram;
+}
+
 void CodePage::writeb(U32 address, U8 value) {    
     if (value!=this->readb(address)) {
         removeBlockAt(address, 1);
+        copyRamOnWrite();
         RWPage::writeb(address, value);
     }
 }
@@ -184,6 +206,7 @@ void CodePage::writeb(U32 address, U8 value) {
 void CodePage::writew(U32 address, U16 value) {
     if (value!=this->readw(address)) {
         removeBlockAt(address, 2);
+        copyRamOnWrite();
         RWPage::writew(address, value);
     }
 }
@@ -191,10 +214,111 @@ void CodePage::writew(U32 address, U16 value) {
 void CodePage::writed(U32 address, U32 value) {
     if (value!=this->readd(address)) {
         removeBlockAt(address, 4);
+        copyRamOnWrite();
         RWPage::writed(address, value);
     }
 }
 
+#define MAX_SHARED_BLOCKS 0x10000
+
+class SharedCodeBlock {
+public:
+    U32 eip;
+    bool big;
+    U32 bytes;
+    U32 opCount;
+    DecodedOp* op;
+    U8* code;
+};
+
+static BOXEDWINE_MUTEX sharedBlocksMutex;
+static std::unordered_map<U64, SharedCodeBlock*> sharedBlocks; // key is the host address of the first byte of the block
+
+static DecodedOp* cloneOps(DecodedOp* op) {
+    DecodedOp* result = NULL;
+    DecodedOp** next = &result;
+
+    while (op) {
+        DecodedOp* copy = DecodedOp::alloc();
+        *copy = *op;
+        copy->next = NULL;
+        *next = copy;
+        next = &copy->next;
+        op = op->next;
+    }
+    return result;
+}
+
+static void freeSharedBlock(SharedCodeBlock* shared) {
+    shared->op->dealloc(true);
+    delete[] shared->code;
+    delete shared;
+}
+
+// only ram that is referenced more than once can be shared with another process
+static U8* getSharedRam(U32 eip) {
+    Page* page = KThread::currentThread()->memory->getPage(eip >> K_PAGE_SHIFT);
+    if (page->type != Page::Type::Code_Page && page->type != Page::Type::RO_Page && page->type != Page::Type::Copy_On_Write_Page) {
+        return NULL;
+    }
+    U8* ram = ((RWPage*)page)->page;
+    if (ramPageRefCount(ram) < 2) {
+        return NULL;
+    }
+    return ram;
+}
+
+bool CodePage::copySharedBlock(U32 eip, bool big, DecodedBlock* block) {
+    U8* ram = getSharedRam(eip);
+    if (!ram) {
+        return false;
+    }
+    U8* code = ram + (eip & K_PAGE_MASK);
+    BOXEDWINE_CRITICAL_SECTION_WITH_MUTEX(sharedBlocksMutex);
+    std::unordered_map<U64, SharedCodeBlock*>::iterator it = sharedBlocks.find((U64)(size_t)code);
+    if (it == sharedBlocks.end()) {
+        return false;
+    }
+    SharedCodeBlock* shared = it->second;
+    if (shared->eip != eip || shared->big != big || memcmp(shared->code, code, shared->bytes)) {
+        return false;
+    }
+    block->op = cloneOps(shared->op);
+    block->bytes = shared->bytes;
+    block->opCount = shared->opCount;
+    return true;
+}
+
+void CodePage::addSharedBlock(U32 eip, bool big, DecodedBlock* block) {
+    if ((eip & K_PAGE_MASK) + block->bytes > K_PAGE_SIZE || !block->op) {
+        return; // the next page might not be the same in another process
+    }
+    U8* ram = getSharedRam(eip);
+    if (!ram) {
+        return;
+    }
+    U8* code = ram + (eip & K_PAGE_MASK);
+    BOXEDWINE_CRITICAL_SECTION_WITH_MUTEX(sharedBlocksMutex);
+    if (sharedBlocks.size() >= MAX_SHARED_BLOCKS) {
+        for (auto& n : sharedBlocks) {
+            freeSharedBlock(n.second);
+        }
+        sharedBlocks.clear();
+    }
+    SharedCodeBlock*& shared = sharedBlocks[(U64)(size_t)code];
+    if (shared) {
+        freeSharedBlock(shared);
+    }
+    shared = new SharedCodeBlock();
+    shared->eip = eip;
+    shared->big = big;
+    shared->bytes = block->bytes;
+    shared->opCount = block->opCount;
+    shared->op = cloneOps(block->op);
+    shared->code = new U8[block->bytes];
+    memcpy(shared->code, code, block->bytes);
+}
+
 U8* CodePage::getCurrentReadPtr() {
     return this->page;
 }
@@ -28,11 +28,12 @@
 
 class CodePage : public RWPage {
 protected:
-    CodePage(U8* page, U32 address, U32 flags);
+    CodePage(U8* page, U32 address, U32 flags, bool copyOnWrite);
     ~CodePage();
 
 public:
-    static CodePage* alloc(U8* page, U32 address, U32 flags);
+    // copyOnWrite is for ram that came from a CopyOnWritePage, it will be copied on the first write that changes it
+    static CodePage* alloc(U8* page, U32 address, U32 flags, bool copyOnWrite=false);
 
     void writeb(U32 address, U8 value);
     void writew(U32 address, U16 value);
@@ -45,7 +46,20 @@ public:
 
     void addCode(U32 eip, DecodedBlock* block, U32 len);
     DecodedBlock* getCode(U32 eip);
+
+    U32 generation; // unique across all code pages, it changes whenever a block on this page is freed
+
+    // Blocks decoded from ram that is shared with other processes, like the file cache pages of a dll, are saved here so
+    // that the next process that runs the same code can copy the ops instead of decoding them again.  The code bytes are
+    // saved with the ops and compared before they are used, so a page that was written to or reused just misses.
+    static bool copySharedBlock(U32 eip, bool big, DecodedBlock* block);
+    static void addSharedBlock(U32 eip, bool big, DecodedBlock* block);
 private:
+    static U32 nextGeneration;
+
+    bool copyOnWrite;
+    void copyRamOnWrite();
+
     class CodePageEntry {
     public:
         DecodedBlock* block;
@@ -21,7 +21,9 @@ void CopyOnWritePage::copyOnWrite(U32 address) {
     bool write = this->canWrite();
     U8* ram;
 
-    if (ramPageRefCount(this->page)>1) {
+    if (this->page == ramPageZero()) {
+        ram = ramPageAlloc();
+    } else if (ramPageRefCount(this->page)>1) {
         ram = ramPageAlloc();
         memcpy(ram, this->page, K_PAGE_SIZE);
     } else {
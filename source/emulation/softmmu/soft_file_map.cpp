@@ -33,39 +33,157 @@ FilePage* FilePage::alloc(const BoxedPtr<MappedFile>& mapped, U32 index, U32 fla
     return new FilePage(mapped, index, flags);
 }
 
+// pages that are only read, or are shared, use the frame in the system file cache instead of a private copy
+bool FilePage::usesFileCache() {
+    return ((this->canRead() || this->canExec()) && !this->canWrite()) || this->mapShared();
+}
+
+U8* FilePage::getCachedFrame(U32 fileIndex) {
+    MappedFileCache* cache = this->mapped->systemCacheEntry.get();
+    if (fileIndex < cache->dataSize) {
+        return cache->data[fileIndex];
+    }
+    return NULL;
+}
+
+void FilePage::setCachedFrame(U32 fileIndex, U8* ram) {
+    MappedFileCache* cache = this->mapped->systemCacheEntry.get();
+    if (fileIndex < cache->dataSize) {
+        cache->data[fileIndex] = ram;
+        ramPageIncRef(ram);
+    }
+}
+
+// the neighbour of a faulting page is worth reading in the same host read if it is still an untouched page of the same
+// mapping whose frame will end up in the file cache.  A page past the end of the cache can't hold a frame, populating it
+// would read the file again.
+static FilePage* getFaultAroundPage(Memory* memory, const BoxedPtr<MappedFile>& mapped, U32 page, U32 fileIndex) {
+    if (fileIndex >= mapped->systemCacheEntry->dataSize) {
+        return NULL;
+    }
+    Page* p = memory->getPage(page);
+    if (p->type != Page::Type::File_Page) {
+        return NULL;
+    }
+    FilePage* filePage = (FilePage*)p;
+    if (filePage->mapped.get() != mapped.get() || filePage->index != fileIndex || !filePage->usesFileCache() || filePage->getCachedFrame(fileIndex)) {
+        return NULL;
+    }
+    return filePage;
+}
+
+// reads the file page for this fault into ram.  Instead of one host read per page fault, the aligned window around the
+// page is read at once and the neighbouring pages of this mapping that would be read into the file cache anyway are
+// populated from it.  The window grows while the faults walk through the file in order.
+void FilePage::readFileAround(Memory* memory, U32 page, U8* ram) {
+    MappedFile* mapped = this->mapped.get();
+    U32 windowPages = KSystem::fileReadAheadPages;
+
+    if (windowPages > 1 && mapped->readAheadPages && this->index == mapped->readAheadIndex) {
+        windowPages = mapped->readAheadPages << 1;
+        if (windowPages > (KSystem::fileReadAheadPages << 2)) {
+            windowPages = KSystem::fileReadAheadPages << 2;
+        }
+    }
+    U32 firstIndex = this->index;
+    U32 lastIndex = this->index + 1;
+
+    if (windowPages > 1) {
+        U32 windowStart = this->index & ~(windowPages - 1);
+        U32 windowEnd = windowStart + windowPages;
+        U32 mappedStart = (U32)(mapped->offset >> K_PAGE_SHIFT);
+        U32 mappedEnd = mappedStart + (U32)(mapped->len >> K_PAGE_SHIFT);
+
+        if (windowStart < mappedStart) {
+            windowStart = mappedStart;
+        }
+        if (windowEnd > mappedEnd) {
+            windowEnd = mappedEnd;
+        }
+        while (firstIndex > windowStart && getFaultAroundPage(memory, this->mapped, page - (this->index - firstIndex + 1), firstIndex - 1)) {
+            firstIndex--;
+        }
+        while (lastIndex < windowEnd && getFaultAroundPage(memory, this->mapped, page + (lastIndex - this->index), lastIndex)) {
+            lastIndex++;
+        }
+        mapped->readAheadIndex = lastIndex;
+        mapped->readAheadPages = windowPages;
+    }
+
+    U32 len = (lastIndex - firstIndex) << K_PAGE_SHIFT;
+    U8* buffer = (lastIndex - firstIndex == 1) ? ram : new U8[len];
+    U64 pos = mapped->file->getPos();
+    mapped->file->seek(((U64)firstIndex) << K_PAGE_SHIFT);
+    U32 read = mapped->file->readNative(buffer, len);
+    mapped->file->seek(pos);
+    if ((S32)read < 0) {
+        // read error, the guest gets zeros instead of whatever was in the buffer
+        read = 0;
+    }
+    if (read < len) {
+        // past the end of the file
+        memset(buffer + read, 0, len - read);
+    }
+    if (buffer != ram) {
+        memcpy(ram, buffer + ((this->index - firstIndex) << K_PAGE_SHIFT), K_PAGE_SIZE);
+    }
+    // cache this frame before the neighbours are populated so that nothing below can treat this page as untouched
+    if (this->usesFileCache()) {
+        this->setCachedFrame(this->index, ram);
+    }
+    if (buffer == ram) {
+        return;
+    }
+    for (U32 i = firstIndex; i < lastIndex; i++) {
+        if (i == this->index) {
+            continue;
+        }
+        U32 neighbourPage = page + i - this->index;
+        FilePage* neighbour = (FilePage*)memory->getPage(neighbourPage);
+        U8* neighbourRam = ramPageAlloc();
+
+        memcpy(neighbourRam, buffer + ((i - firstIndex) << K_PAGE_SHIFT), K_PAGE_SIZE);
+        neighbour->setCachedFrame(i, neighbourRam);
+        // will find the frame in the cache, so this won't read the file again
+        neighbour->ondemmandFile(neighbourPage << K_PAGE_SHIFT);
+        ramPageDecRef(neighbourRam);
+    }
+    delete[] buffer;
+}
+
 // :TODO: what about sync'ing the writes back to the file?
 void FilePage::ondemmandFile(U32 address) {
     Memory* memory = KThread::currentThread()->process->memory;
     U32 page = address >> K_PAGE_SHIFT;
     bool read = this->canRead() || this->canExec();
     bool write = this->canWrite();
-    bool shared = this->mapShared();
+    bool cached = this->usesFileCache();
     U8* ram=NULL;
+    bool allocated = false;
 
     address = address & (~K_PAGE_MASK);
-    if ((read && !write) || shared) {
-        ram = mapped->systemCacheEntry->data[this->index];   
+    if (cached) {
+        ram = this->getCachedFrame(this->index);
     } 
     if (!ram) {
         ram = ramPageAlloc();
-        U64 pos = this->mapped->file->getPos();
-        this->mapped->file->seek(((U64)this->index) << K_PAGE_SHIFT);
-        this->mapped->file->readNative(ram, K_PAGE_SIZE);
-        this->mapped->file->seek(pos);
-        if (!write || shared) {
-            mapped->systemCacheEntry->data[this->index] = ram;
-            ramPageIncRef(ram);
-        }
+        allocated = true;
+        this->readFileAround(memory, page, ram);
     }
+    U32 flags = this->flags; // setPage will delete this
 
     if (read && write) {
-        memory->setPage(page, RWPage::alloc(ram, address, this->flags));
+        memory->setPage(page, RWPage::alloc(ram, address, flags));
     } else if (write) {
-        memory->setPage(page, WOPage::alloc(ram, address, this->flags));
+        memory->setPage(page, WOPage::alloc(ram, address, flags));
     } else if (read) { 
-        memory->setPage(page, CopyOnWritePage::alloc(ram, address, this->flags));
+        memory->setPage(page, CopyOnWritePage::alloc(ram, address, flags));
     } else {
-        memory->setPage(page, NOPage::alloc(ram, address, this->flags));
+        memory->setPage(page, NOPage::alloc(ram, address, flags));
+    }
+    if (allocated) {
+        // the new page and the file cache hold their own references
+        ramPageDecRef(ram);
     }
 }
 
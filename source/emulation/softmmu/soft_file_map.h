@@ -45,9 +45,15 @@ public:
     void close() {delete this;}
 
     void ondemmandFile(U32 address);
+    bool usesFileCache();
+    U8* getCachedFrame(U32 fileIndex);
+    void setCachedFrame(U32 fileIndex, U8* ram);
 
      BoxedPtr<MappedFile> mapped;
      U32 index;
+
+private:
+    void readFileAround(Memory* memory, U32 page, U8* ram);
 };
 
 #endif
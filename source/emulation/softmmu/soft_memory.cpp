@@ -33,15 +33,56 @@
 #include "soft_native_page.h"
 #include "soft_ram.h"
 #include "devfb.h"
+#include "loader.h"
 
 #include <string.h>
 #include <setjmp.h>
 
 //#undef LOG_OPS
 
+#ifdef BOXEDWINE_WORKER_THREADS
+THREAD_LOCAL Page** Memory::currentMMU;
+THREAD_LOCAL U8** Memory::currentMMUReadPtr;
+THREAD_LOCAL U8** Memory::currentMMUWritePtr;
+#else
 Page** Memory::currentMMU;
 U8** Memory::currentMMUReadPtr;
 U8** Memory::currentMMUWritePtr;
+#endif
+
+#define PAGE_POOL_MAX_SIZE 64 // bigger pages, like CodePage, come from the heap
+#define PAGE_POOL_CHUNK_COUNT 256
+
+static void* freePagesBySize[PAGE_POOL_MAX_SIZE / 8 + 1]; // the first bytes of each free entry point to the next one
+
+void* Page::operator new(size_t size) {
+    if (size > PAGE_POOL_MAX_SIZE) {
+        return ::operator new(size);
+    }
+    U32 index = (U32)((size + 7) >> 3);
+    if (!freePagesBySize[index]) {
+        U32 entrySize = index << 3;
+        U8* chunk = (U8*)::operator new(entrySize * PAGE_POOL_CHUNK_COUNT);
+        for (int i = PAGE_POOL_CHUNK_COUNT - 1; i >= 0; i--) {
+            void* entry = chunk + entrySize * i;
+            *(void**)entry = freePagesBySize[index];
+            freePagesBySize[index] = entry;
+        }
+    }
+    void* result = freePagesBySize[index];
+    freePagesBySize[index] = *(void**)result;
+    return result;
+}
+
+void Page::operator delete(void* p, size_t size) {
+    if (size > PAGE_POOL_MAX_SIZE) {
+        ::operator delete(p);
+        return;
+    }
+    U32 index = (U32)((size + 7) >> 3);
+    *(void**)p = freePagesBySize[index];
+    freePagesBySize[index] = p;
+}
 
 void Memory::log_pf(KThread* thread, U32 address) {
     U32 start = 0;
@@ -74,6 +115,8 @@ void Memory::log_pf(KThread* thread, U32 address) {
 
 U8* Memory::callbackRam;
 U32 Memory::callbackRamPos;
+U8* Memory::vdsoRam;
+U8* Memory::vdsoTimeRam;
 
 void Memory::addCallback(OpCallback func) {
     U64 funcAddress = (U64)func;
@@ -110,6 +153,8 @@ Memory::Memory() : nativeAddressStart(0) {
         this->mmuReadPtr[i] = NULL;
         this->mmuWritePtr[i] = NULL;
     }
+    this->freePages.setRange(0, K_NUMBER_OF_PAGES, true);
+    memset(this->codeBlockCache, 0, sizeof(this->codeBlockCache));
 
     if (!callbackRam) {
         callbackRam = ramPageAlloc();
@@ -117,6 +162,7 @@ Memory::Memory() : nativeAddressStart(0) {
     }
 
     this->setPage(CALL_BACK_ADDRESS>>K_PAGE_SHIFT, NativePage::alloc(callbackRam, CALL_BACK_ADDRESS, PAGE_READ|PAGE_EXEC));
+    this->mapVDSO();
 
 #ifdef BOXEDWINE_DYNAMIC
     this->dynamicExecutableMemoryPos = 0;
@@ -142,6 +188,22 @@ void Memory::reset() {
         this->setPage(i, invalidPage);
     }
     this->setPage(CALL_BACK_ADDRESS>>K_PAGE_SHIFT, NativePage::alloc(callbackRam, CALL_BACK_ADDRESS, PAGE_READ|PAGE_EXEC));
+    this->mapVDSO();
+}
+
+void Memory::mapVDSO() {
+    if (!vdsoRam) {
+        vdsoRam = ramPageAlloc();
+        vdsoTimeRam = ramPageAlloc();
+        ElfLoader::writeVDSO(vdsoRam);
+        KSystem::updateTimePage(this);
+    }
+    this->setPage(VDSO_TIME_ADDRESS>>K_PAGE_SHIFT, NativePage::alloc(vdsoTimeRam, VDSO_TIME_ADDRESS, PAGE_READ));
+    this->setPage(VDSO_ADDRESS>>K_PAGE_SHIFT, NativePage::alloc(vdsoRam, VDSO_ADDRESS, PAGE_READ|PAGE_EXEC));
+}
+
+U8* Memory::getTimePage() {
+    return vdsoTimeRam;
 }
 
 void Memory::reset(U32 page, U32 pageCount) {
@@ -222,26 +284,29 @@ void Memory::clone(Memory* from) {
 }
 
 void zeroMemory(U32 address, int len) {
-    for (int i=0;i<len;i++) {
-        writeb(address, 0);
-        address++;
+    while (len > 0) {
+        U32 todo = K_PAGE_SIZE - (address & K_PAGE_MASK);
+        if (todo > (U32)len)
+            todo = len;
+        U8* ram = getPhysicalWriteAddress(address, todo);
+        if (ram) {
+            memset(ram, 0, todo);
+        } else {
+            for (U32 i = 0; i < todo; i++) {
+                writeb(address + i, 0);
+            }
+        }
+        address += todo;
+        len -= todo;
     }
 }
 
 void readMemory(U8* data, U32 address, int len) {
-    for (int i=0;i<len;i++) {
-        *data=readb(address);
-        address++;
-        data++;
-    }
+    memcopyToNative(address, data, len);
 }
 
 void writeMemory(U32 address, U8* data, int len) {
-    for (int i=0;i<len;i++) {
-        writeb(address, *data);
-        address++;
-        data++;
-    }
+    memcopyFromNative(address, data, len);
 }
 
 void Memory::allocPages(U32 page, U32 pageCount, U8 permissions, FD fd, U64 offset, const BoxedPtr<MappedFile>& mappedFile) {
@@ -308,7 +373,9 @@ void Memory::protectPage(U32 i, U32 permissions) {
             memcpy(ram, p->page, K_PAGE_SIZE);
             this->setPage(i, NOPage::alloc(ram, p->address, flags));
         }
-    } else if (page->type == Page::Type::File_Page || page->type == Page::Type::On_Demand_Page) {
+    } else if (page->type == Page::Type::On_Demand_Page) {
+        this->setPage(i, OnDemandPage::alloc(flags)); // shared between pages, so it can't be changed
+    } else if (page->type == Page::Type::File_Page) {
         page->flags = flags;
     } else if (page->type == Page::Type::Code_Page) {
         if (!(permissions & PAGE_READ)) {
@@ -321,34 +388,24 @@ void Memory::protectPage(U32 i, U32 permissions) {
 }
 
 bool Memory::findFirstAvailablePage(U32 startingPage, U32 pageCount, U32* result, bool canBeReMapped, bool alignNative) {
-    U32 i;
-    
-    for (i=startingPage;i<K_NUMBER_OF_PAGES;i++) {
-        if (alignNative && !isAlignedNativePage(i)) {
-            continue;
-        }
-        if (i + pageCount >= K_NUMBER_OF_PAGES) {
-            return false;
-        }
-        if (this->getPage(i)->type==Page::Type::Invalid_Page || (canBeReMapped && (this->getPage(i)->flags & PAGE_MAPPED))) {
-            U32 j;
-            bool success = true;
-
-            for (j=1;j<pageCount;j++) {
-                U32 nextPage = i+j; // could be done a different way, but this helps the static analysis
-                if (nextPage < K_NUMBER_OF_PAGES && this->getPage(nextPage)->type!=Page::Type::Invalid_Page && (!canBeReMapped || !(this->getPage(i)->flags & PAGE_MAPPED))) {
-                    success = false;
-                    break;
-                }
-            }
-            if (success) {
-                *result = i;
-                return true;
-            }
-            i+=j; // no reason to check all the pages again
-        }
+    U32 page;
+
+    if (!this->freePages.findRun(startingPage, pageCount, alignNative ? K_NATIVE_PAGES_PER_PAGE : 1, canBeReMapped ? &this->mappedPages : NULL, &page)) {
+        return false;
+    }
+    if (page + pageCount >= K_NUMBER_OF_PAGES) {
+        return false;
+    }
+    *result = page;
+    return true;
+}
+
+void Memory::updateAvailablePages(U32 page, U32 pageCount) {
+    for (U32 i = page; i < page + pageCount; i++) {
+        Page* p = this->mmu[i];
+        this->freePages.set(i, p->type == Page::Type::Invalid_Page);
+        this->mappedPages.set(i, (p->flags & PAGE_MAPPED) != 0);
     }
-    return false;
 }
 
 bool Memory::isValidReadAddress(U32 address, U32 len) {
@@ -411,37 +468,29 @@ void memcopyFromNative(U32 address, const void* pv, U32 len) {
         writeb(address+i, p[i]);
     }
 #else
-    U32 i;
-    U8* p = (U8*)pv;
-
-    if (len>4) {
-        U32 todo = K_PAGE_SIZE-(address & (K_PAGE_SIZE-1));
-        if (todo>len)
-            todo=len;
-        U8* ram = getPhysicalWriteAddress(address, todo);
-    
-        if (ram) {            
-            while (1) {
-                memcpy(ram, p, todo);
-                len-=todo;
-                if (!len) {
-                    return;
-                }
-                address+=todo;
-                p+=todo;
-                ram = getPhysicalWriteAddress(address, todo);
-                if (!ram) {
-                    break;
-                }
-                todo = K_PAGE_SIZE;
-                if (todo>len)
-                    todo=len;
+    const U8* p = (const U8*)pv;
+
+    // one memcpy per page, only pages that can't be written to directly go through writeb
+    while (len) {
+        U32 todo = K_PAGE_SIZE - (address & K_PAGE_MASK);
+        if (todo > len)
+            todo = len;
+        U8* ram = Memory::currentMMUWritePtr[address >> K_PAGE_SHIFT];
+        if (ram) {
+            ram += address & K_PAGE_MASK;
+        } else {
+            ram = getPhysicalWriteAddress(address, todo);
+        }
+        if (ram) {
+            memcpy(ram, p, todo);
+        } else {
+            for (U32 i = 0; i < todo; i++) {
+                writeb(address + i, p[i]);
             }
         }
-    }
-
-    for (i=0;i<len;i++) {
-        writeb(address+i, p[i]);
+        address += todo;
+        p += todo;
+        len -= todo;
     }
 #endif
 }
@@ -454,34 +503,28 @@ void memcopyToNative(U32 address, void* pv, U32 len) {
     }
 #else
     U8* p = (U8*)pv;
-    if (len>4) {
-        U32 todo = K_PAGE_SIZE-(address & (K_PAGE_SIZE-1));
-        if (todo>len)
-            todo=len;
-        U8* ram = getPhysicalReadAddress(address, todo);
-    
-        if (ram) {            
-            while (1) {
-                memcpy(p, ram, todo);
-                len-=todo;
-                if (!len) {
-                    return;
-                }
-                address+=todo;
-                p+=todo;
-                ram = getPhysicalReadAddress(address, todo);
-                if (!ram) {
-                    break;
-                }
-                todo = K_PAGE_SIZE;
-                if (todo>len)
-                    todo=len;
+
+    // one memcpy per page, only pages that can't be read directly go through readb
+    while (len) {
+        U32 todo = K_PAGE_SIZE - (address & K_PAGE_MASK);
+        if (todo > len)
+            todo = len;
+        U8* ram = Memory::currentMMUReadPtr[address >> K_PAGE_SHIFT];
+        if (ram) {
+            ram += address & K_PAGE_MASK;
+        } else {
+            ram = getPhysicalReadAddress(address, todo);
+        }
+        if (ram) {
+            memcpy(p, ram, todo);
+        } else {
+            for (U32 i = 0; i < todo; i++) {
+                p[i] = readb(address + i);
             }
         }
-    }
-    
-    for (U32 i=0;i<len;i++) {
-        p[i] = readb(address+i);
+        address += todo;
+        p += todo;
+        len -= todo;
     }
 #endif
 }
@@ -611,11 +654,44 @@ void Memory::map(U32 startPage, const std::vector<U8*>& pages, U32 permissions)
     }
 }
 
+static inline U32 getCodeBlockCacheIndex(U32 eip) {
+    return (eip * 0x9E3779B1) >> (32 - CODE_BLOCK_CACHE_SHIFT);
+}
+
+void Memory::cacheCodeBlock(U32 eip, DecodedBlock* block, U32 generation) {
+    U32 index = getCodeBlockCacheIndex(eip);
+    CodeBlockCacheEntry* entry = &this->codeBlockCache[index];
+
+    // use the first empty slot in the probe window, if they are all full then replace the first one
+    for (U32 i = 0; i < CODE_BLOCK_CACHE_PROBES; i++) {
+        CodeBlockCacheEntry* e = &this->codeBlockCache[(index + i) & (CODE_BLOCK_CACHE_SIZE - 1)];
+        if (!e->block || e->eip == eip) {
+            entry = e;
+            break;
+        }
+    }
+    entry->eip = eip;
+    entry->generation = generation;
+    entry->block = block;
+}
+
 DecodedBlock* Memory::getCodeBlock(U32 startIp) {
     Page* page = this->getPage(startIp >> K_PAGE_SHIFT);
     if (page->type == Page::Type::Code_Page) {
         CodePage* codePage = (CodePage*)page;
-        return codePage->getCode(startIp);
+        U32 index = getCodeBlockCacheIndex(startIp);
+
+        for (U32 i = 0; i < CODE_BLOCK_CACHE_PROBES; i++) {
+            CodeBlockCacheEntry* entry = &this->codeBlockCache[(index + i) & (CODE_BLOCK_CACHE_SIZE - 1)];
+            if (entry->eip == startIp && entry->block && entry->generation == codePage->generation) {
+                return entry->block;
+            }
+        }
+        DecodedBlock* block = codePage->getCode(startIp);
+        if (block) {
+            cacheCodeBlock(startIp, block, codePage->generation);
+        }
+        return block;
     }
     return NULL;
 }
@@ -624,13 +700,15 @@ void Memory::addCodeBlock(U32 startIp, DecodedBlock* block) {
     // might have changed after a read
     Page* page = this->getPage(startIp >> K_PAGE_SHIFT);
 
-    CodePage* codePage; 
+    CodePage* codePage;
     if (page->type == Page::Type::Code_Page) {
         codePage = (CodePage*)page;
     } else {
         if (page->type == Page::Type::RO_Page || page->type == Page::Type::RW_Page || page->type == Page::Type::Copy_On_Write_Page || page->type == Page::Type::Native_Page) {
             RWPage* p = (RWPage*)page;
-            codePage = CodePage::alloc(p->page, p->address, p->flags);
+            // the ram of a copy on write page can be the zero page or shared with another process, the code page keeps
+            // sharing it until it is written to
+            codePage = CodePage::alloc(p->page, p->address, p->flags, page->type == Page::Type::Copy_On_Write_Page);
             this->setPage(startIp >> K_PAGE_SHIFT, codePage);
         } else {
             kpanic("Unhandled code caching page type: %d", page->type);
@@ -638,6 +716,7 @@ void Memory::addCodeBlock(U32 startIp, DecodedBlock* block) {
         }
     }
     codePage->addCode(startIp, block, block->bytes);
+    cacheCodeBlock(startIp, block, codePage->generation);
 }
 
 U32 Memory::getPageFlags(U32 page) {
@@ -659,6 +738,7 @@ void Memory::setPage(U32 index, Page* page) {
     this->mmu[index] = page; 
     this->mmuReadPtr[index] = page->getCurrentReadPtr();
     this->mmuWritePtr[index] = page->getCurrentWritePtr();
+    this->updateAvailablePages(index, 1);
     p->close();
 }
 #endif
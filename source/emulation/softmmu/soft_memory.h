@@ -21,10 +21,16 @@
 
 #ifdef BOXEDWINE_DEFAULT_MMU
 
+// Memory::currentMMUReadPtr/currentMMUWritePtr have an entry for every page, so unlike a hashed TLB a lookup can't miss
+// because of a conflict, a NULL entry means the page needs to be handled by its Page object (no permission, copy on write,
+// not loaded yet, etc).  The Page objects are kernel state, so with scheduler workers they are only called with the
+// kernel lock held
+
 inline U8 readb(U32 address) {
     int index = address >> 12;
     if (Memory::currentMMUReadPtr[index])
         return Memory::currentMMUReadPtr[index][address & 0xFFF];
+    BOXEDWINE_KERNEL_LOCK;
     return Memory::currentMMU[index]->readb(address);
 }
 
@@ -32,8 +38,44 @@ inline void writeb(U32 address, U8 value) {
     int index = address >> 12;
     if (Memory::currentMMUWritePtr[index])
         Memory::currentMMUWritePtr[index][address & 0xFFF] = value;
-    else
+    else {
+        BOXEDWINE_KERNEL_LOCK;
         Memory::currentMMU[index]->writeb(address, value);
+    }
+}
+
+// for an access that crosses into the next page, returns false if either page doesn't have a pointer
+inline bool getSplitReadPtrs(U32 address, U8** first, U8** second) {
+    *first = Memory::currentMMUReadPtr[address >> 12];
+    *second = Memory::currentMMUReadPtr[((address >> 12) + 1) & 0xFFFFF];
+    return *first && *second;
+}
+
+inline bool getSplitWritePtrs(U32 address, U8** first, U8** second) {
+    *first = Memory::currentMMUWritePtr[address >> 12];
+    *second = Memory::currentMMUWritePtr[((address >> 12) + 1) & 0xFFFFF];
+    return *first && *second;
+}
+
+// reads len bytes that cross a page boundary, the first page has (0x1000 - offset) of them
+inline U64 readSplit(U8* first, U8* second, U32 offset, U32 len) {
+    U64 result = 0;
+    for (U32 i = 0; i < len; i++) {
+        U32 pos = offset + i;
+        result |= (U64)(pos < 0x1000 ? first[pos] : second[pos - 0x1000]) << (i * 8);
+    }
+    return result;
+}
+
+inline void writeSplit(U8* first, U8* second, U32 offset, U32 len, U64 value) {
+    for (U32 i = 0; i < len; i++) {
+        U32 pos = offset + i;
+        if (pos < 0x1000) {
+            first[pos] = (U8)(value >> (i * 8));
+        } else {
+            second[pos - 0x1000] = (U8)(value >> (i * 8));
+        }
+    }
 }
 
 inline U16 readw(U32 address) {
@@ -43,8 +85,14 @@ inline U16 readw(U32 address) {
         if (Memory::currentMMUReadPtr[index])
             return *(U16*)(&Memory::currentMMUReadPtr[index][address & 0xFFF]);
 #endif
+        BOXEDWINE_KERNEL_LOCK;
         return Memory::currentMMU[index]->readw(address);
     }
+    U8* first;
+    U8* second;
+    if (getSplitReadPtrs(address, &first, &second)) {
+        return (U16)readSplit(first, second, address & 0xFFF, 2);
+    }
     return readb(address) | (readb(address+1) << 8);
 }
 
@@ -56,8 +104,17 @@ inline void writew(U32 address, U16 value) {
             *(U16*)(&Memory::currentMMUWritePtr[index][address & 0xFFF]) = value;
         else
 #endif
+        {
+            BOXEDWINE_KERNEL_LOCK;
             Memory::currentMMU[index]->writew(address, value);
+        }
     } else {
+        U8* first;
+        U8* second;
+        if (getSplitWritePtrs(address, &first, &second)) {
+            writeSplit(first, second, address & 0xFFF, 2, value);
+            return;
+        }
         writeb(address, (U8)value);
         writeb(address+1, (U8)(value >> 8));
     }
@@ -70,8 +127,14 @@ inline U32 readd(U32 address) {
         if (Memory::currentMMUReadPtr[index])
             return *(U32*)(&Memory::currentMMUReadPtr[index][address & 0xFFF]);
 #endif
+        BOXEDWINE_KERNEL_LOCK;
         return Memory::currentMMU[index]->readd(address);
     } else {
+        U8* first;
+        U8* second;
+        if (getSplitReadPtrs(address, &first, &second)) {
+            return (U32)readSplit(first, second, address & 0xFFF, 4);
+        }
         return readb(address) | (readb(address+1) << 8) | (readb(address+2) << 16) | (readb(address+3) << 24);
     }
 }
@@ -84,8 +147,17 @@ inline void writed(U32 address, U32 value) {
             *(U32*)(&Memory::currentMMUWritePtr[index][address & 0xFFF]) = value;
         else
 #endif
-            Memory::currentMMU[index]->writed(address, value);		
+        {
+            BOXEDWINE_KERNEL_LOCK;
+            Memory::currentMMU[index]->writed(address, value);
+        }
     } else {
+        U8* first;
+        U8* second;
+        if (getSplitWritePtrs(address, &first, &second)) {
+            writeSplit(first, second, address & 0xFFF, 4, value);
+            return;
+        }
         writeb(address, value);
         writeb(address+1, value >> 8);
         writeb(address+2, value >> 16);
@@ -94,27 +166,40 @@ inline void writed(U32 address, U32 value) {
 }
 
 inline U64 readq(U32 address) {
-#ifndef UNALIGNED_MEMORY
     if ((address & 0xFFF) < 0xFF9) {
+#ifndef UNALIGNED_MEMORY
         int index = address >> 12;
-        if (Memory::currentMMUWritePtr[index]) {
+        if (Memory::currentMMUReadPtr[index]) {
             return *(U64*)(&Memory::currentMMUReadPtr[index][address & 0xFFF]);
         }
-    }
 #endif
+    } else {
+        U8* first;
+        U8* second;
+        if (getSplitReadPtrs(address, &first, &second)) {
+            return readSplit(first, second, address & 0xFFF, 8);
+        }
+    }
     return readd(address) | ((U64)readd(address + 4) << 32);
 }
 
 inline void writeq(U32 address, U64 value) {
-#ifndef UNALIGNED_MEMORY
     if ((address & 0xFFF) < 0xFF9) {
+#ifndef UNALIGNED_MEMORY
         int index = address >> 12;
         if (Memory::currentMMUWritePtr[index]) {
             *(U64*)(&Memory::currentMMUWritePtr[index][address & 0xFFF]) = value;
             return;
         }
-    }
 #endif
+    } else {
+        U8* first;
+        U8* second;
+        if (getSplitWritePtrs(address, &first, &second)) {
+            writeSplit(first, second, address & 0xFFF, 8, value);
+            return;
+        }
+    }
     writed(address, (U32)value); writed(address + 4, (U32)(value >> 32));
 }
 #endif
@@ -8,17 +8,32 @@
 #include "soft_rw_page.h"
 #include "soft_invalid_page.h"
 #include "soft_wo_page.h"
+#include "soft_copy_on_write_page.h"
+#include "soft_ram.h"
+
+static OnDemandPage* onDemandPages[256];
 
 OnDemandPage* OnDemandPage::alloc(U32 flags) {
-    return new OnDemandPage(flags);
+    OnDemandPage* result = onDemandPages[flags & 0xFF];
+    if (!result) {
+        result = new OnDemandPage(flags);
+        onDemandPages[flags & 0xFF] = result;
+    }
+    return result;
 }
 
-void OnDemandPage::ondemmand(U32 address) {
+void OnDemandPage::ondemmand(U32 address, bool forWrite) {
     Memory* memory = KThread::currentThread()->memory;
     U32 page = address >> K_PAGE_SHIFT;
     bool read = this->canRead() || this->canExec();
     bool write = this->canWrite();
     
+    // until the page is written to, reads can share the zero page.  If code runs from it, the code page keeps sharing it
+    // until the first write too.
+    if (!forWrite && this->canRead() && !this->mapShared()) {
+        memory->setPage(page, CopyOnWritePage::alloc(ramPageZero(), page << K_PAGE_SHIFT, this->flags));
+        return;
+    }
     if (read && write) {
         memory->setPage(page, RWPage::alloc(NULL, page << K_PAGE_SHIFT, this->flags));
     } else if (write) {
@@ -31,7 +46,7 @@ void OnDemandPage::ondemmand(U32 address) {
 }
 
 U8 OnDemandPage::readb(U32 address) {
-    ondemmand(address);
+    ondemmand(address, false);
     return ::readb(address);
 }
 
@@ -41,7 +56,7 @@ void OnDemandPage::writeb( U32 address, U8 value) {
 }
 
 U16 OnDemandPage::readw(U32 address) {
-    ondemmand(address);
+    ondemmand(address, false);
     return ::readw(address);
 }
 
@@ -51,7 +66,7 @@ void OnDemandPage::writew(U32 address, U16 value) {
 }
 
 U32 OnDemandPage::readd(U32 address) {
-    ondemmand(address);
+    ondemmand(address, false);
     return ::readd(address);
 }
 
@@ -69,7 +84,7 @@ U8* OnDemandPage::getCurrentWritePtr() {
 }
 
 U8* OnDemandPage::getReadAddress(U32 address, U32 len) {    
-    ondemmand(address);
+    ondemmand(address, false);
     return KThread::currentThread()->memory->getPage(address>>K_PAGE_SHIFT)->getReadAddress(address, len);
 }
 
@@ -28,7 +28,7 @@ protected:
     OnDemandPage(U32 flags) : Page(On_Demand_Page, flags) {}
 
 public:
-    static OnDemandPage* alloc(U32 flags);
+    static OnDemandPage* alloc(U32 flags); // the returned page is shared by every page with the same flags
 
     U8 readb(U32 address);
     void writeb(U32 address, U8 value);
@@ -43,9 +43,9 @@ public:
     U8* getReadWriteAddress(U32 address, U32 len);
 
     bool inRam() {return false;}
-    void close() {delete this;}
+    void close() {}
 
-    void ondemmand(U32 address);
+    void ondemmand(U32 address, bool forWrite = true);
 };
 
 #endif
@@ -72,6 +72,10 @@ public:
     bool canExec() {return (this->flags & PAGE_EXEC)!=0;}
     bool mapShared() {return (this->flags & PAGE_SHARED)!=0;}
 
+    // pages change type all the time, so they are pooled by size instead of each one being a separate heap allocation
+    static void* operator new(size_t size);
+    static void operator delete(void* p, size_t size);
+
     U8 flags;
     const Type type;
 };
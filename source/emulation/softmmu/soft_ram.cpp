@@ -1,25 +1,142 @@
 #include "boxedwine.h"
+#include "soft_ram.h"
+
+// Ram pages are carved out of slabs so that they don't each need their own heap allocation.  Each page is followed by a
+// small header with its ref count and its slab, so ref counting doesn't need a lookup or a lock.  ramMutex only
+// protects the free lists, a slab is given back to the heap once all of its pages are free, unless it is the only slab
+// with free pages left.
+//
+// Because of the headers, pages are RAM_PAGE_SLOT_SIZE apart and only have the alignment of a heap allocation, they are
+// not page aligned.  Nothing in the soft mmu needs more than that, it never hands ram to the host as a page.  Page
+// aligned pages would need the ref counts in a separate array and a way to find a page's slab from its address, which is
+// what the header avoids.
+#define RAM_SLAB_PAGES 64
+#define RAM_PAGE_HEADER_SIZE 16
+#define RAM_PAGE_SLOT_SIZE (K_PAGE_SIZE + RAM_PAGE_HEADER_SIZE)
+
+class RamSlab;
+
+class RamPageHeader {
+public:
+    std::atomic<U32> refCount;
+    RamSlab* slab;
+};
+
+static_assert(sizeof(RamPageHeader) <= RAM_PAGE_HEADER_SIZE, "RamPageHeader is too big");
+
+class RamSlab {
+public:
+    U8* memory;
+    U8* freePages; // the first bytes of each free page points to the next free page
+    U32 usedCount;
+    RamSlab* prev; // slabsWithFreePages list
+    RamSlab* next;
+};
+
+static BOXEDWINE_MUTEX ramMutex;
+static RamSlab* slabsWithFreePages;
+static U8* zeroRamPage;
+
+static RamPageHeader* ramPageHeader(U8* ram) {
+    return (RamPageHeader*)(ram + K_PAGE_SIZE);
+}
+
+static void ramSlabLink(RamSlab* slab) {
+    slab->prev = NULL;
+    slab->next = slabsWithFreePages;
+    if (slabsWithFreePages) {
+        slabsWithFreePages->prev = slab;
+    }
+    slabsWithFreePages = slab;
+}
+
+static void ramSlabUnlink(RamSlab* slab) {
+    if (slab->prev) {
+        slab->prev->next = slab->next;
+    } else {
+        slabsWithFreePages = slab->next;
+    }
+    if (slab->next) {
+        slab->next->prev = slab->prev;
+    }
+    slab->prev = NULL;
+    slab->next = NULL;
+}
+
+static void ramSlabAlloc() {
+    RamSlab* slab = new RamSlab();
+
+    slab->memory = new U8[RAM_SLAB_PAGES * RAM_PAGE_SLOT_SIZE];
+    slab->freePages = NULL;
+    slab->usedCount = 0;
+    for (int i = RAM_SLAB_PAGES - 1; i >= 0; i--) {
+        U8* ram = slab->memory + i * RAM_PAGE_SLOT_SIZE;
+        RamPageHeader* header = new (ram + K_PAGE_SIZE) RamPageHeader();
+        header->refCount = 0;
+        header->slab = slab;
+        *(U8**)ram = slab->freePages;
+        slab->freePages = ram;
+    }
+    ramSlabLink(slab);
+}
 
 U8* ramPageAlloc() {
-    U8* ram = new U8[K_PAGE_SIZE+1];
+    U8* ram;
+    {
+        BOXEDWINE_CRITICAL_SECTION_WITH_MUTEX(ramMutex);
+        if (!slabsWithFreePages) {
+            ramSlabAlloc();
+        }
+        RamSlab* slab = slabsWithFreePages;
+        ram = slab->freePages;
+        slab->freePages = *(U8**)ram;
+        slab->usedCount++;
+        if (!slab->freePages) {
+            ramSlabUnlink(slab);
+        }
+    }
+    ramPageHeader(ram)->refCount = 1;
     memset(ram, 0, K_PAGE_SIZE);
-    ram[K_PAGE_SIZE] = 1;
     return ram;
 }
 
-void ramPageIncRef(U8* ram) {
-    if (ram[K_PAGE_SIZE]==255) {
-        kpanic("max ram page ref count reached");
+U8* ramPageZero() {
+    BOXEDWINE_CRITICAL_SECTION_WITH_MUTEX(ramMutex);
+    if (!zeroRamPage) {
+        zeroRamPage = ramPageAlloc(); // this ref is never released
     }
-    ram[K_PAGE_SIZE]++;
+    return zeroRamPage;
+}
+
+void ramPageIncRef(U8* ram) {
+    ramPageHeader(ram)->refCount++;
 }
 
 void ramPageDecRef(U8* ram) {
-    ram[K_PAGE_SIZE]--;
-    if (ram[K_PAGE_SIZE]==0)
-        delete[] ram;
+    RamPageHeader* header = ramPageHeader(ram);
+    U32 refCount = header->refCount--;
+
+    if (refCount == 0) {
+        kpanic("ramPageDecRef: page %p was already freed", ram);
+    }
+    if (refCount > 1) {
+        return;
+    }
+    BOXEDWINE_CRITICAL_SECTION_WITH_MUTEX(ramMutex);
+    RamSlab* slab = header->slab;
+    if (!slab->freePages) {
+        ramSlabLink(slab);
+    }
+    *(U8**)ram = slab->freePages;
+    slab->freePages = ram;
+    slab->usedCount--;
+    if (slab->usedCount == 0 && (slab->prev || slab->next)) {
+        ramSlabUnlink(slab);
+        delete[] slab->memory;
+        delete slab;
+    }
 }
 
 U32 ramPageRefCount(U8* ram) {
-    return ram[K_PAGE_SIZE];
-}
\ No newline at end of file
+    return ramPageHeader(ram)->refCount;
+}
@@ -4,6 +4,7 @@
 #include "platform.h"
 
 U8* ramPageAlloc();
+U8* ramPageZero(); // shared page that is always 0, it must be copied before it is written to
 void ramPageIncRef(U8* ram);
 void ramPageDecRef(U8* ram);
 U32 ramPageRefCount(U8* ram);
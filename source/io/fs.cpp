@@ -16,13 +16,45 @@
 #include MKDIR_INCLUDE
 
 std::atomic_int Fs::nextNodeId=1;
+std::atomic<U32> Fs::namespaceGeneration;
 
 BoxedPtr<FsFileNode> Fs::rootNode;
 BString Fs::nativePathSeperator;
 
+// full path -> node cache so that repeated lookups of the same path don't walk every component.  Lookups that fail are
+// cached too (node is NULL), since wine probes a lot of paths that don't exist.  Each entry remembers the directories
+// it walked through, an entry is only used if none of their children have changed since.  Changes that aren't about
+// children, like a link being repointed, bump Fs::namespaceGeneration which drops the whole cache on the next lookup.
+struct FsPathCacheEntry {
+    BoxedPtr<FsNode> node;
+    BoxedPtr<FsNode> lastNode;
+    std::vector<BString> missingParts;
+    std::vector<FsPathDir> dirs;
+    bool isLink;
+};
+
+#define FS_PATH_CACHE_MAX_ENTRIES 8192
+
+static std::unordered_map<BString, FsPathCacheEntry> pathCache[2]; // indexed by followLink
+static U32 pathCacheGeneration;
+static BOXEDWINE_MUTEX pathCacheMutex;
+
+static void clearPathCache() {
+    pathCache[0].clear();
+    pathCache[1].clear();
+}
+
 void Fs::shutDown() {
+    {
+        BOXEDWINE_CRITICAL_SECTION_WITH_MUTEX(pathCacheMutex);
+        clearPathCache();
+    }
 	rootNode = NULL;
 }
+
+void Fs::invalidatePathCache() {
+    Fs::namespaceGeneration++;
+}
 bool Fs::initFileSystem(BString rootPath) {
     Fs::nextNodeId = 1;
     BString path;
@@ -136,6 +168,69 @@ BoxedPtr<FsNode> Fs::getNodeFromLocalPath(BString currentDirectory, BString path
 
     if (fullpath.length()==0 || fullpath=="/")
         return Fs::rootNode;
+
+    U32 generation = Fs::namespaceGeneration;
+    {
+        BOXEDWINE_CRITICAL_SECTION_WITH_MUTEX(pathCacheMutex);
+        if (pathCacheGeneration != generation) {
+            clearPathCache();
+            pathCacheGeneration = generation;
+        }
+        std::unordered_map<BString, FsPathCacheEntry>& cache = pathCache[followLink ? 1 : 0];
+        auto it = cache.find(fullpath);
+        if (it != cache.end()) {
+            const FsPathCacheEntry& entry = it->second;
+            for (const FsPathDir& dir : entry.dirs) {
+                if (dir.node->childrenGeneration != dir.generation) {
+                    cache.erase(it);
+                    it = cache.end();
+                    break;
+                }
+            }
+        }
+        if (it != cache.end()) {
+            const FsPathCacheEntry& entry = it->second;
+            if (!entry.node && entry.lastNode) {
+                lastNode = entry.lastNode;
+                missingParts.insert(missingParts.end(), entry.missingParts.begin(), entry.missingParts.end());
+            }
+            if (isLink && entry.isLink) {
+                *isLink = true;
+            }
+            return entry.node;
+        }
+    }
+
+    FsPathCacheEntry entry;
+    bool cacheable = true;
+
+    entry.isLink = false;
+    entry.node = Fs::walkLocalPath(fullpath, entry.lastNode, entry.missingParts, followLink, &entry.isLink, cacheable, entry.dirs);
+    if (!entry.node && entry.lastNode) {
+        lastNode = entry.lastNode;
+        missingParts.insert(missingParts.end(), entry.missingParts.begin(), entry.missingParts.end());
+    }
+    if (isLink && entry.isLink) {
+        *isLink = true;
+    }
+    if (cacheable && Fs::rootNode) {
+        BOXEDWINE_CRITICAL_SECTION_WITH_MUTEX(pathCacheMutex);
+        // if the namespace changed while we were walking, the result might already be stale.  A child change during the
+        // walk is caught by entry.dirs on the next lookup since the generations were read before the children.
+        if (pathCacheGeneration == generation && Fs::namespaceGeneration == generation) {
+            std::unordered_map<BString, FsPathCacheEntry>& cache = pathCache[followLink ? 1 : 0];
+            if (cache.size() >= FS_PATH_CACHE_MAX_ENTRIES) {
+                cache.clear();
+            }
+            BoxedPtr<FsNode> result = entry.node;
+            cache[fullpath] = std::move(entry);
+            return result;
+        }
+    }
+    return entry.node;
+}
+
+BoxedPtr<FsNode> Fs::walkLocalPath(BString fullpath, BoxedPtr<FsNode>& lastNode, std::vector<BString>& missingParts, bool followLink, bool* isLink, bool& cacheable, std::vector<FsPathDir>& dirs) {
     std::vector<BString> parts;
     Fs::splitPath(fullpath, parts);
     BoxedPtr<FsNode> node = Fs::rootNode;
@@ -157,6 +252,7 @@ BoxedPtr<FsNode> Fs::getNodeFromLocalPath(BString currentDirectory, BString path
             i++;
             continue;
         }
+        dirs.push_back({node, node->childrenGeneration});
         node = node->getChildByName(parts[i]);
         if (!node) {
             for (;i<parts.size();i++) {
@@ -170,6 +266,10 @@ BoxedPtr<FsNode> Fs::getNodeFromLocalPath(BString currentDirectory, BString path
             if (i==parts.size()-1 && isLink) {
                 *isLink = true;
             }
+            if (node->link.length()==0) {
+                // dynamic link like /proc/self, the target can be different on every call
+                cacheable = false;
+            }
 
             std::vector<BString> linkParts;
             Fs::splitPath(node->getLink(), linkParts);
@@ -193,11 +293,15 @@ BoxedPtr<FsNode> Fs::getNodeFromLocalPath(BString currentDirectory, BString path
 }
 
 BoxedPtr<FsNode> Fs::addFileNode(BString path, BString link, BString nativePath, bool isDirectory, const BoxedPtr<FsNode>& parent) {
-    BoxedPtr<FsFileNode> result = new FsFileNode(Fs::nextNodeId++, 0, path, link, nativePath, isDirectory, false, parent);
+    BoxedPtr<FsNode> result = Fs::createFileNode(path, link, nativePath, isDirectory, parent);
     parent->addChild(result);
     return result;
 }
 
+BoxedPtr<FsNode> Fs::createFileNode(BString path, BString link, BString nativePath, bool isDirectory, const BoxedPtr<FsNode>& parent) {
+    return new FsFileNode(Fs::nextNodeId++, 0, path, link, nativePath, isDirectory, false, parent);
+}
+
 BoxedPtr<FsNode> Fs::addRootDirectoryNode(BString path, BString nativePath, const BoxedPtr<FsNode>& parent) {
     BoxedPtr<FsFileNode> result = new FsFileNode(Fs::nextNodeId++, 0, path, B(""), nativePath, true, false, parent);
     parent->addChild(result);
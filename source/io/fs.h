@@ -47,11 +47,19 @@ typedef FsOpenNode* (*OpenVirtualNode)(const BoxedPtr<FsNode>& node, U32 flags,
 
 class FsFileNode;
 
+// a directory that a path lookup read the children of, along with its FsNode::childrenGeneration at the time
+struct FsPathDir {
+    BoxedPtr<FsNode> node;
+    U32 generation;
+};
+
 class Fs {
 public:   
     static bool initFileSystem(BString rootPath);
     static BoxedPtr<FsNode> getNodeFromLocalPath(BString currentDirectory, BString path, bool followLink, bool* isLink=NULL);    
     static BoxedPtr<FsNode> addFileNode(BString path, BString link, BString nativePath, bool isDirectory, const BoxedPtr<FsNode>& parent);
+    // like addFileNode but the caller is responsible for adding it to parent
+    static BoxedPtr<FsNode> createFileNode(BString path, BString link, BString nativePath, bool isDirectory, const BoxedPtr<FsNode>& parent);
     static BoxedPtr<FsNode> addVirtualFile(BString path, OpenVirtualNode func, U32 mode, U32 rdev, const BoxedPtr<FsNode>& parent, U32 data=0);
     static BoxedPtr<FsNode> addDynamicLinkFile(BString path, U32 rdev, const BoxedPtr<FsNode>& parent, bool isDirectory, std::function<BString(void)> fnGetLink);
     static BoxedPtr<FsNode> addRootDirectoryNode(BString path, BString nativePath, const BoxedPtr<FsNode>& parent);
@@ -84,12 +92,19 @@ public:
 
     static BoxedPtr<FsFileNode> rootNode;
 	static void shutDown();
+
+    // call after anything that changes which node a path resolves to, other than adding or removing a child which is
+    // tracked by FsNode::childrenGeneration
+    static void invalidatePathCache();
 private:
     friend class KUnixSocketObject;
 
     static BoxedPtr<FsNode> getNodeFromLocalPath(BString currentDirectory, BString path, BoxedPtr<FsNode>& lastNode, std::vector<BString>& missingParts, bool followLink, bool* isLink=NULL);
 
+    static BoxedPtr<FsNode> walkLocalPath(BString fullpath, BoxedPtr<FsNode>& lastNode, std::vector<BString>& missingParts, bool followLink, bool* isLink, bool& cacheable, std::vector<FsPathDir>& dirs);
+
     static std::atomic_int nextNodeId;
+    static std::atomic<U32> namespaceGeneration;
 };
 
 #endif
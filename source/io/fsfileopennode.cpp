@@ -40,6 +40,10 @@ bool FsFileOpenNode::isOpen() {
     return this->handle!=0xFFFFFFFF;
 }
 
+S32 FsFileOpenNode::getNativeHandle() {
+    return (S32)this->handle;
+}
+
 void FsFileOpenNode::reopen() {
     int openFlags = O_BINARY;
     int flags = this->flags;
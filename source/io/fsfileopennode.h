@@ -27,6 +27,7 @@ public:
     virtual void close();
     virtual void reopen();
     virtual bool isOpen();
+    virtual S32 getNativeHandle();
 
 private:
     BoxedPtr<FsFileNode> fileNode;
@@ -11,6 +11,7 @@ FsNode::FsNode(Type type, U32 id, U32 rdev, BString path, BString link, BString
     rdev(rdev),
     hardLinkCount(1),
     type(type),  
+    childrenGeneration(0),
     parent(parent),
     isDir(isDirectory),  
     locksCS(B("FsNode.lockCS")),
@@ -33,7 +34,8 @@ bool FsNode::canWrite() {
 
 void FsNode::removeNodeFromParent() {
     BOXEDWINE_CRITICAL_SECTION_WITH_MUTEX(this->parent->childrenByNameMutex);
-    this->parent->childrenByName.erase(this->name);
+    this->parent->internalRemoveChild(this->name);
+    this->parent->childrenGeneration++;
 }
 
 void FsNode::loadChildren() {
@@ -57,8 +59,10 @@ void FsNode::loadChildren() {
                 if (localPath.endsWith(".mixed")) {
                     localPath.remove(localPath.length() - 6);
                 }
+                // a lookup has to load the children before it can see them, so these don't bump childrenGeneration
+                BoxedPtr<FsNode> child;
                 if (!localPath.endsWith(".link")) {
-                    Fs::addFileNode(localPath, B(""), remotePath, n.isDirectory, this);
+                    child = Fs::createFileNode(localPath, B(""), remotePath, n.isDirectory, this);
                 } else {
                     U8 tmp[MAX_FILEPATH_LEN];
                     U32 result = Fs::readNativeFile(remotePath, tmp, MAX_FILEPATH_LEN-1);
@@ -67,8 +71,10 @@ void FsNode::loadChildren() {
                         kwarn("Could not read link file from filesystem: %s", localPath.c_str());
                     }
                     localPath = localPath.substr(0, localPath.length()-5);
-                    Fs::addFileNode(localPath, BString::copy((const char*)tmp), remotePath, n.isDirectory, this);
-                }           
+                    child = Fs::createFileNode(localPath, BString::copy((const char*)tmp), remotePath, n.isDirectory, this);
+                }
+                BOXEDWINE_CRITICAL_SECTION_WITH_MUTEX(this->childrenByNameMutex);
+                this->internalAddChild(child);
             }
         }
     }
@@ -86,10 +92,9 @@ BoxedPtr<FsNode> FsNode::getChildByName(BString name) {
 BoxedPtr<FsNode> FsNode::getChildByNameIgnoreCase(BString name) {
     this->loadChildren();
     BOXEDWINE_CRITICAL_SECTION_WITH_MUTEX(this->childrenByNameMutex);
-    for (auto& n : this->childrenByName) {
-        if (n.first.compareTo(name, true) == 0) {
-            return n.second;
-        }
+    auto it = this->childrenByLowerCaseName.find(name.toLowerCase());
+    if (it != this->childrenByLowerCaseName.end()) {
+        return it->second;
     }
     return NULL;
 }
@@ -103,13 +108,39 @@ U32 FsNode::getChildCount() {
 void FsNode::addChild(BoxedPtr<FsNode> node) {    
     this->loadChildren();
     BOXEDWINE_CRITICAL_SECTION_WITH_MUTEX(this->childrenByNameMutex);
-    this->childrenByName[node->name] = node;
+    this->internalAddChild(node);
+    this->childrenGeneration++;
 }
 
 void FsNode::removeChildByName(BString name) {
     this->loadChildren();
     BOXEDWINE_CRITICAL_SECTION_WITH_MUTEX(this->childrenByNameMutex);
-    this->childrenByName.erase(name);
+    this->internalRemoveChild(name);
+    this->childrenGeneration++;
+}
+
+// childrenByNameMutex must be held
+void FsNode::internalAddChild(const BoxedPtr<FsNode>& node) {
+    this->internalRemoveChild(node->name);
+    this->childrenByName[node->name] = node;
+    this->childrenByLowerCaseName.insert(std::make_pair(node->name.toLowerCase(), node));
+}
+
+// childrenByNameMutex must be held
+void FsNode::internalRemoveChild(BString name) {
+    auto it = this->childrenByName.find(name);
+    if (it == this->childrenByName.end()) {
+        return;
+    }
+    // more than one child can fold to the same lower case name, only remove this one
+    auto range = this->childrenByLowerCaseName.equal_range(name.toLowerCase());
+    for (auto i = range.first; i != range.second; ++i) {
+        if (i->second == it->second) {
+            this->childrenByLowerCaseName.erase(i);
+            break;
+        }
+    }
+    this->childrenByName.erase(it);
 }
 
 void FsNode::getAllChildren(std::vector<BoxedPtr<FsNode> > & results) {    
@@ -70,6 +70,10 @@ public:
     void unlockAll(U32 pid);
 
     void addOpenNode(KListNode<FsOpenNode*>* node);
+
+    // bumped whenever a child is added or removed, other than when the children are first loaded from the host, so that
+    // Fs::getNodeFromLocalPath can tell if a cached lookup through this directory is stale
+    std::atomic<U32> childrenGeneration;
 protected:
     BoxedPtr<FsNode> parent;
 
@@ -81,12 +85,15 @@ private:
     bool hasLoadedChildrenFromFileSystem;    
 
     std::unordered_map<BString, BoxedPtr<FsNode> > childrenByName;
+    std::unordered_multimap<BString, BoxedPtr<FsNode> > childrenByLowerCaseName; // same children as childrenByName, used by getChildByNameIgnoreCase
     BOXEDWINE_MUTEX childrenByNameMutex;
 
     std::vector<KFileLock> locks;       
     BOXEDWINE_CONDITION locksCS;    
 
     void loadChildren();
+    void internalAddChild(const BoxedPtr<FsNode>& node);
+    void internalRemoveChild(BString name);
     KFileLock* internalGetLock(KFileLock* lock, bool otherProcess);
 };
 
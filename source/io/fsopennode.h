@@ -33,6 +33,7 @@ public:
     virtual void close()=0;
     virtual void reopen()=0;
     virtual bool isOpen()=0;
+    virtual S32 getNativeHandle() {return -1;} // host file handle that can be passed to Platform::mapNativeFile
 
     BoxedPtr<FsNode> const node;
     const U32 flags;     
@@ -527,6 +527,11 @@ U32 DevFB::ioctl(U32 request) {
             writeVarInfo(IOCTL_ARG1, &fb_var_screeninfo);
             break;
         case 0x4601: // FBIOPUT_VSCREENINFO
+#ifdef BOXEDWINE_WORKER_THREADS
+            if (!runOnMainWorker(thread)) {
+                return -K_WAIT; // the syscall runs again once the main thread picks up this thread
+            }
+#endif
             readVarInfo(IOCTL_ARG1, &fb_var_screeninfo);
             fbSetupScreen();
             break;
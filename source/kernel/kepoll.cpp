@@ -22,12 +22,21 @@
 
 #include <string.h>
 
-KEPoll::KEPoll() : KObject(KTYPE_EPOLL) {
+KEPoll::Data::Data(KEPoll* epoll) : epoll(epoll), fd(0), data(0), events(0), readyNode(this), cond(B("KEPoll::Data")) {
+    BOXEDWINE_CONDITION_ADD_PARENT(this->cond, &epoll->cond);
+    this->cond.setSignalCallback(onDataSignaled, this);
+}
+
+KEPoll::KEPoll() : KObject(KTYPE_EPOLL), cond(B("KEPoll")) {
 }
 
 KEPoll::~KEPoll() {
-     for( const auto& n : this->data ) {
-         delete n.second;
+    for( const auto& n : this->data ) {
+        this->unwatch(n.second);
+        delete n.second;
+    }
+    for (Data* d : this->unusedData) {
+        delete d;
     }
 }
 
@@ -129,6 +138,42 @@ void KEPoll::close() {
 #define K_EPOLL_CTL_DEL 2
 #define K_EPOLL_CTL_MOD 3
 
+#define K_EPOLLONESHOT 0x40000000
+#define K_EPOLLET 0x80000000
+#define K_EPOLL_POLL_EVENTS 0xFFFF
+
+// called by the condition of a registered fd, directly or through the object's conditions, when the object changes
+void KEPoll::onDataSignaled(void* p) {
+    Data* d = (Data*)p;
+    d->epoll->addToReadyList(d);
+}
+
+void KEPoll::addToReadyList(Data* d) {
+    BOXEDWINE_CRITICAL_SECTION_WITH_MUTEX(this->readyListMutex);
+    if (!d->readyNode.isInList()) {
+        this->readyList.addToBack(&d->readyNode);
+    }
+}
+
+// fds are watched from EPOLL_CTL_ADD until EPOLL_CTL_DEL, so the ready list always knows about every change
+void KEPoll::watch(Data* d) {
+    if (d->watchedObject || !(d->events & K_EPOLL_POLL_EVENTS)) {
+        return;
+    }
+    KFileDescriptor* fd = KThread::currentThread()->process->getFileDescriptor(d->fd);
+    if (fd) {
+        d->watchedObject = fd->kobject;
+        d->watchedObject->waitForEvents(d->cond, d->events & K_EPOLL_POLL_EVENTS);
+    }
+}
+
+void KEPoll::unwatch(Data* d) {
+    if (d->watchedObject) {
+        d->watchedObject->waitForEvents(d->cond, 0);
+        d->watchedObject = nullptr;
+    }
+}
+
 U32 KEPoll::ctl(U32 op, FD fd, U32 address) {
     KFileDescriptor* targetFD = KThread::currentThread()->process->getFileDescriptor(fd);
     Data* existing = NULL;
@@ -136,7 +181,7 @@ U32 KEPoll::ctl(U32 op, FD fd, U32 address) {
     if (!targetFD) {
         return -K_EBADF;
     }
-
+    BOXEDWINE_CRITICAL_SECTION_WITH_CONDITION(this->cond);
     if (this->data.count(fd))
         existing = this->data[fd];
 
@@ -145,23 +190,40 @@ U32 KEPoll::ctl(U32 op, FD fd, U32 address) {
             if (existing) {
                 return -K_EEXIST;
             }
-            existing = new Data();
+            if (this->unusedData.size()) {
+                existing = this->unusedData.back();
+                this->unusedData.pop_back();
+            } else {
+                existing = new Data(this);
+            }
             existing->fd = fd;
             existing->events = readd(address);
             existing->data = readq(address + 4);
             this->data[fd] = existing;
+            this->watch(existing);
+            // anything that was already ready won't signal
+            this->addToReadyList(existing);
             break;
         case K_EPOLL_CTL_DEL:
             if (!existing)
                 return -K_ENOENT;
             this->data.erase(fd);
-            delete existing;
+            this->unwatch(existing);
+            {
+                BOXEDWINE_CRITICAL_SECTION_WITH_MUTEX(this->readyListMutex);
+                existing->readyNode.remove();
+            }
+            this->unusedData.push_back(existing);
             break;
         case K_EPOLL_CTL_MOD:
             if (!existing)
                 return -K_ENOENT;
+            // the object might need to watch different conditions
+            this->unwatch(existing);
             existing->events = readd(address);
             existing->data = readq(address + 4);
+            this->watch(existing);
+            this->addToReadyList(existing);
             break;
         default:
             return -K_EINVAL;
@@ -169,37 +231,115 @@ U32 KEPoll::ctl(U32 op, FD fd, U32 address) {
     return 0;
 }
 
-U32 KEPoll::wait(U32 events, U32 maxevents, U32 timeout) {    
-    S32 result = 0;
-    U32 i;
-    THREAD_LOCAL static KPollData pollData[256];	
-    U32 pollCount=0;
+U32 KEPoll::getReadyEvents(Data* d, KFileDescriptor* fd) {
+    U32 events = d->events;
+    U32 result = 0;
 
-    for( const auto& n : this->data ) {
-        if (pollCount>=256) {
-            kpanic("Wasn't expect a poll count of more than 256");
+    if (!fd->kobject->isOpen()) {
+        return K_POLLHUP;
+    }
+    if ((events & K_POLLPRI) && fd->kobject->isPriorityReadReady()) {
+        result |= K_POLLPRI;
+    }
+    if ((events & K_POLLIN) && fd->kobject->isReadReady()) {
+        result |= K_POLLIN;
+    }
+    if ((events & K_POLLOUT) && fd->kobject->isWriteReady()) {
+        result |= K_POLLOUT;
+    }
+    return result;
+}
+
+// only looks at the fds on the ready list.  Level triggered fds that are still ready go back on the end of the list so
+// that the next wait reports them again after the others, edge triggered ones wait for the object to signal again and
+// one shot ones are disabled until EPOLL_CTL_MOD
+U32 KEPoll::collectReadyEvents(U32 events, U32 maxevents) {
+    KProcess* process = KThread::currentThread()->process.get();
+    KListNode<Data*>* last;
+    U32 result = 0;
+
+    {
+        BOXEDWINE_CRITICAL_SECTION_WITH_MUTEX(this->readyListMutex);
+        last = this->readyList.back();
+    }
+    while (last && result < maxevents) {
+        KListNode<Data*>* node;
+        {
+            BOXEDWINE_CRITICAL_SECTION_WITH_MUTEX(this->readyListMutex);
+            node = this->readyList.front();
+            if (!node) {
+                break;
+            }
+            node->remove();
+        }
+        Data* d = node->data;
+        KFileDescriptor* fd = process->getFileDescriptor(d->fd);
+        U32 revents = 0;
+
+        if (fd && (d->events & K_EPOLL_POLL_EVENTS)) {
+            revents = this->getReadyEvents(d, fd);
+        }
+        if (revents) {
+            writed(events + result * 12, revents);
+            writeq(events + result * 12 + 4, d->data);
+            result++;
+            if (d->events & K_EPOLLONESHOT) {
+                d->events &= ~K_EPOLL_POLL_EVENTS;
+                this->unwatch(d);
+            } else if (!(d->events & K_EPOLLET)) {
+                this->addToReadyList(d);
+            }
+        }
+        if (node == last) {
             break;
         }
-        Data* next = n.second;
-        pollData[pollCount].events = next->events;
-        pollData[pollCount].fd = next->fd;
-        pollData[pollCount].data = next->data;
-        pollCount++;	
     }
-    result = internal_poll(pollData, pollCount, timeout);
-    if (result >= 0) {
-        result = 0;
-        for (i=0;i<pollCount;i++) {
-            if (pollData[i].revents!=0) {
-                writed(events + result * 12, pollData[i].revents);        
-                writeq(events + result * 12 + 4, pollData[i].data);
-                result++;
-                if (result>=(S32)maxevents) {
-                    kwarn("possible starvation in epoll, more events are ready than can be received.");
-                    break;
-                }
-            }        
+    return result;
+}
+
+U32 KEPoll::wait(U32 events, U32 maxevents, U32 timeout) {
+    KThread* thread = KThread::currentThread();
+
+    while (true) {
+        BOXEDWINE_CRITICAL_SECTION_WITH_CONDITION(this->cond);
+        bool interrupted = !thread->inSignal && thread->interrupted;
+
+        if (interrupted)
+            thread->interrupted = false;
+
+        U32 result = this->collectReadyEvents(events, maxevents);
+        if (result || timeout == 0) {
+            thread->condStartWaitTime = 0;
+            return result;
+        }
+        if (interrupted) {
+            thread->condStartWaitTime = 0;
+            return -K_EINTR;
         }
+        U32 now = KSystem::getMilliesSinceStart();
+        if (!thread->condStartWaitTime) {
+            thread->condStartWaitTime = now;
+        }
+        U32 elapsed = now - thread->condStartWaitTime;
+        if (timeout <= 0xF0000000 && elapsed >= timeout) {
+            thread->condStartWaitTime = 0;
+            return 0;
+        }
+        if (timeout>0xF0000000) {
+            BOXEDWINE_CONDITION_WAIT(this->cond);
+        } else {
+            BOXEDWINE_CONDITION_WAIT_TIMEOUT(this->cond, timeout - elapsed);
+        }
+#ifdef BOXEDWINE_MULTI_THREADED
+        if (thread->terminating) {
+            thread->condStartWaitTime = 0;
+            return -K_EINTR;
+        }
+        if (thread->startSignal) {
+            thread->startSignal = false;
+            thread->condStartWaitTime = 0;
+            return -K_CONTINUE;
+        }
+#endif
     }
-    return result;
 }
@@ -1,10 +1,44 @@
 #include "boxedwine.h"
 
 MappedFileCache::~MappedFileCache() {
+    if (this->nativeMappingLen) {
+        Platform::releaseNativeMemory(this->data[0], this->nativeMappingLen);
+        this->data[0] = NULL;
+    }
     for (U32 i = 0; i < this->dataSize; i++) {
         if (this->data[i]) {
             delete[] this->data[i];
         }
     }
     delete[] this->data;
-}
\ No newline at end of file
+}
+
+U32 memcopyFromNativeIov(U32 iov, U32 iovcnt, const void* pv, U32 len) {
+    const U8* p = (const U8*)pv;
+    U32 result = 0;
+
+    for (U32 i = 0; i < iovcnt && result < len; i++) {
+        U32 buffer = readd(iov + i * 8);
+        U32 todo = readd(iov + i * 8 + 4);
+        if (todo > len - result)
+            todo = len - result;
+        memcopyFromNative(buffer, p + result, todo);
+        result += todo;
+    }
+    return result;
+}
+
+U32 memcopyToNativeIov(U32 iov, U32 iovcnt, void* pv, U32 len) {
+    U8* p = (U8*)pv;
+    U32 result = 0;
+
+    for (U32 i = 0; i < iovcnt && result < len; i++) {
+        U32 buffer = readd(iov + i * 8);
+        U32 todo = readd(iov + i * 8 + 4);
+        if (todo > len - result)
+            todo = len - result;
+        memcopyToNative(buffer, p + result, todo);
+        result += todo;
+    }
+    return result;
+}
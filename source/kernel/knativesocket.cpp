@@ -63,12 +63,12 @@ void updateWaitingList() {
             kpanic("updateWaitingList %s socket is too large to select on", s->nativeSocket);
         }
 #endif
-        if (s->readingCond.parent) {
+        if (s->readingCond.hasParentCondition()) {
             FD_SET(s->nativeSocket, &waitingReadset);
             FD_SET(s->nativeSocket, &waitingErrorset);
             errorSet = true;
         }
-        if (s->writingCond.parent) {
+        if (s->writingCond.hasParentCondition()) {
             FD_SET(s->nativeSocket, &waitingWriteset);
             if (!errorSet)
                 FD_SET(s->nativeSocket, &waitingErrorset);
@@ -110,10 +110,10 @@ bool checkWaitingNativeSockets(int timeout) {
                 BOXEDWINE_CRITICAL_SECTION_WITH_MUTEX(waitingNodeMutex);                
 
                 for (auto& s : waitingNativeSockets) {
-                    if (FD_ISSET(s->nativeSocket, &waitingReadset) && s->readingCond.parent) {
+                    if (FD_ISSET(s->nativeSocket, &waitingReadset) && s->readingCond.hasParentCondition()) {
                         if (conditionCount<1024) conditions[conditionCount++]=&s->readingCond;
                     }
-                    if (FD_ISSET(s->nativeSocket, &waitingWriteset) && s->writingCond.parent) {                    
+                    if (FD_ISSET(s->nativeSocket, &waitingWriteset) && s->writingCond.hasParentCondition()) {                    
                         if (conditionCount<1024) conditions[conditionCount++]=&s->writingCond;
                     }
                     if (FD_ISSET(s->nativeSocket, &waitingErrorset)) {
@@ -466,16 +466,17 @@ bool KNativeSocketObject::isWriteReady() {
 
 void KNativeSocketObject::waitForEvents(BOXEDWINE_CONDITION& parentCondition, U32 events) {
     if (events & K_POLLIN) {
-        BOXEDWINE_CONDITION_SET_PARENT(this->readingCond, &parentCondition);
+        BOXEDWINE_CONDITION_ADD_PARENT(this->readingCond, &parentCondition);
     } else {
-        BOXEDWINE_CONDITION_SET_PARENT(this->readingCond, nullptr);
+        BOXEDWINE_CONDITION_REMOVE_PARENT(this->readingCond, &parentCondition);
     }
     if (events & K_POLLOUT) {
-        BOXEDWINE_CONDITION_SET_PARENT(this->writingCond, &parentCondition);
+        BOXEDWINE_CONDITION_ADD_PARENT(this->writingCond, &parentCondition);
     } else {
-        BOXEDWINE_CONDITION_SET_PARENT(this->writingCond, nullptr);
+        BOXEDWINE_CONDITION_REMOVE_PARENT(this->writingCond, &parentCondition);
     }
-    if (events == 0) {
+    // someone else might still be watching it
+    if (!this->readingCond.hasParentCondition() && !this->writingCond.hasParentCondition()) {
         removeWaitingSocket(this->nativeSocket);
     } else {
         std::shared_ptr< KNativeSocketObject> t = std::dynamic_pointer_cast<KNativeSocketObject>(shared_from_this());
@@ -649,6 +650,10 @@ U32 KNativeSocketObject::accept(KFileDescriptor* fd, U32 address, U32 len, U32 f
     if (result>=0) {
         std::shared_ptr<KNativeSocketObject> s = std::make_shared<KNativeSocketObject>(this->domain, this->type, this->protocol);
         KFileDescriptor* resultFD = KThread::currentThread()->process->allocFileDescriptor(s, K_O_RDWR, 0, -1, 0);
+        if (!resultFD) {
+            closesocket(result);
+            return -K_EMFILE;
+        }
 
         if (flags & FD_CLOEXEC) {
             resultFD->descriptorFlags|=FD_CLOEXEC;
@@ -986,13 +991,7 @@ U32 KNativeSocketObject::sendmsg(KFileDescriptor* fd, U32 address, U32 flags) {
         len += readd(hdr.msg_iov + 8 * i + 4);
     }
     U8* buffer = new U8[len];
-    len = 0;
-    for (U32 i = 0; i < hdr.msg_iovlen; i++) {
-        U32 p = readd(hdr.msg_iov + 8 * i);
-        U32 toCopy = readd(hdr.msg_iov + 8 * i + 4);
-        memcopyToNative(p, buffer + len, toCopy);
-        len += toCopy;
-    }
+    memcopyToNativeIov(hdr.msg_iov, hdr.msg_iovlen, buffer, len);
     struct sockaddr dest;
     U32 destLen = std::min((U32)sizeof(struct sockaddr), hdr.msg_namelen);
     if (destLen) {
@@ -38,14 +38,15 @@
 #include <time.h> 
 
 #define MAX_ARG_COUNT 1024
+#define FD_TABLE_INITIAL_SIZE 64
 
 bool KProcessTimer::run() {
     bool result = false;
-    if (this->resetMillies==0) {
+    if (this->resetMicros==0) {
         result = true;
-        this->millies = 0;
+        this->micros = 0;
     } else {
-        this->millies = this->resetMillies + KSystem::getMilliesSinceStart();
+        this->micros = this->resetMicros + KSystem::getMicroCounter();
     }
     std::shared_ptr<KProcess> p = this->process.lock();
     if (p) {
@@ -86,6 +87,9 @@ KProcess::KProcess(U32 id) : id(id),
     threadRemovedCondition(B("KProcess::threadRemovedCondition")),
     systemProcess(false) {
 
+    this->fdTable = new KFileDescriptorTable(FD_TABLE_INITIAL_SIZE);
+    this->freeFds.setRange(0, MAX_NUMBER_OF_FILES + 1, true);
+
 #ifdef BOXEDWINE_BINARY_TRANSLATOR
     emulateFPU=false;
     returnToLoopAddress = NULL;
@@ -133,9 +137,9 @@ KProcess::KProcess(U32 id) : id(id),
 }
 
 void KProcess::onExec() {
-    std::unordered_map<U32, KFileDescriptor*> fdsToClose = this->fds; // make a copy since we can't remove from it while iterating
-    for( const auto& n : fdsToClose ) {
-        KFileDescriptor* fd = n.second;
+    std::vector<KFileDescriptor*> fdsToClose; // make a copy since we can't remove from the table while iterating
+    this->getFileDescriptors(fdsToClose);
+    for (KFileDescriptor* fd : fdsToClose) {
         if (fd->descriptorFlags) {
             fd->refCount = 1; // make sure it is really closed
             fd->close();
@@ -210,14 +214,18 @@ KProcess::~KProcess() {
 	if (this->memory) {
 		this->memory->decRefCount();
 	}
+    for (KFileDescriptorTable* table : this->retiredFdTables) {
+        delete table;
+    }
+    delete this->fdTable.load();
 }
 
 void KProcess::cleanupProcess() {    
     removeTimer(&this->timer);
 
-    std::unordered_map<U32, KFileDescriptor*> fdsToClose = this->fds; // make a copy since we can't remove from it while iterating
-    for( const auto& n : fdsToClose ) {
-        KFileDescriptor* fd = n.second;
+    std::vector<KFileDescriptor*> fdsToClose; // make a copy since we can't remove from the table while iterating
+    this->getFileDescriptors(fdsToClose);
+    for (KFileDescriptor* fd : fdsToClose) {
         fd->refCount = 1; // make sure it is really closed
         fd->close();
     }
@@ -312,10 +320,14 @@ void KProcess::clone(const std::shared_ptr<KProcess>& from) {
     this->effectiveGroupId = from->effectiveGroupId;
     this->currentDirectory = from->currentDirectory;
     this->brkEnd = from->brkEnd;
-    for (auto& n : from->fds) {
-        KFileDescriptor* fd = n.second;
-        this->fds[n.first] = this->allocFileDescriptor(fd->kobject, fd->accessFlags, fd->descriptorFlags, n.first, 0);
-        this->fds[n.first]->refCount = fd->refCount;
+    std::vector<KFileDescriptor*> fromFds;
+    from->getFileDescriptors(fromFds);
+    for (KFileDescriptor* fd : fromFds) {
+        KFileDescriptor* result = this->allocFileDescriptor(fd->kobject, fd->accessFlags, fd->descriptorFlags, fd->handle, 0);
+        if (!result) {
+            continue;
+        }
+        result->refCount = fd->refCount;
     }
     // :TODO: not thread safe if from has multiple threads
     this->mappedFiles = from->mappedFiles;
@@ -405,6 +417,8 @@ static void pushThreadStack(KThread* thread, CPU* cpu, int argc, U32* a, int env
     cpu->push32(0);		
     
 
+    cpu->push32(VDSO_ADDRESS);
+    cpu->push32(33); // AT_SYSINFO_EHDR
     cpu->push32(randomAddress);
     cpu->push32(25); // AT_RANDOM
     cpu->push32(100);
@@ -479,31 +493,73 @@ static void setupThreadStack(KThread* thread, CPU* cpu, BString programName, con
     pushThreadStack(thread, cpu, (U32)args.size(), a, (U32)env.size(), e);
 }
 
-U32 KProcess::getNextFileDescriptorHandle(int after) {
+// returns -1 if every handle at or above after is in use.  The handle is not reserved, callers that want to use it must
+// hold fdsMutex until the descriptor is published with setFileDescriptor
+S32 KProcess::getNextFileDescriptorHandle(int after) {
     BOXEDWINE_CRITICAL_SECTION_WITH_MUTEX(fdsMutex);
-    U32 i=after;
+    U32 result;
 
-    while (1) {
-		if (!this->fds[i])
-            return i;
-        i++;
+    if (!this->freeFds.findRun(after, 1, 1, NULL, &result)) {
+        return -1;
     }
+    return (S32)result;
 }
 
-KFileDescriptor* KProcess::allocFileDescriptor(const std::shared_ptr<KObject>& kobject, U32 accessFlags, U32 descriptorFlags, S32 handle, U32 afterHandle) {    
-    KFileDescriptor* result;
+void KProcess::setFileDescriptor(U32 handle, KFileDescriptor* fd) {
+    KFileDescriptorTable* table = this->fdTable.load(std::memory_order_relaxed);
 
-    if (handle<0) {
-        handle = this->getNextFileDescriptorHandle(afterHandle);
+    if (handle >= table->size) {
+        U32 size = table->size;
+        while (size <= handle) {
+            size *= 2;
+        }
+        if (size > MAX_NUMBER_OF_FILES + 1) {
+            size = MAX_NUMBER_OF_FILES + 1;
+        }
+        KFileDescriptorTable* grown = new KFileDescriptorTable(size);
+        for (U32 i = 0; i < table->size; i++) {
+            grown->fds[i].store(table->fds[i].load(std::memory_order_relaxed), std::memory_order_relaxed);
+        }
+        this->fdTable.store(grown, std::memory_order_release);
+        this->retiredFdTables.push_back(table);
+        table = grown;
+    }
+    table->fds[handle].store(fd, std::memory_order_release);
+    this->freeFds.set(handle, fd == NULL);
+}
+
+void KProcess::getFileDescriptors(std::vector<KFileDescriptor*>& result) {
+    BOXEDWINE_CRITICAL_SECTION_WITH_MUTEX(fdsMutex);
+    KFileDescriptorTable* table = this->fdTable.load(std::memory_order_relaxed);
+
+    for (U32 i = 0; i < table->size; i++) {
+        KFileDescriptor* fd = table->fds[i].load(std::memory_order_relaxed);
+        if (fd) {
+            result.push_back(fd);
+        }
     }
-    result = new KFileDescriptor(shared_from_this(), kobject, accessFlags, descriptorFlags, handle);
+}
 
-    KFileDescriptor* old = this->getFileDescriptor(handle);
+KFileDescriptor* KProcess::allocFileDescriptor(const std::shared_ptr<KObject>& kobject, U32 accessFlags, U32 descriptorFlags, S32 handle, U32 afterHandle) {    
+    KFileDescriptor* result;
+    KFileDescriptor* old;
+    {
+        // finding the handle and publishing the descriptor happen under one lock hold, otherwise two threads could be
+        // handed the same free handle and the second would close the first one's new descriptor as old
+        BOXEDWINE_CRITICAL_SECTION_WITH_MUTEX(fdsMutex);
+        if (handle<0) {
+            handle = this->getNextFileDescriptorHandle(afterHandle);
+            if (handle<0) {
+                return NULL;
+            }
+        }
+        result = new KFileDescriptor(shared_from_this(), kobject, accessFlags, descriptorFlags, handle);
+        old = this->getFileDescriptor(handle);
+        this->setFileDescriptor(handle, result);
+    }
     if (old) {
         old->close();
     }
-    BOXEDWINE_CRITICAL_SECTION_WITH_MUTEX(fdsMutex);
-    this->fds[handle] = result;
     return result;
 }
 
@@ -522,6 +578,10 @@ U32 KProcess::openFileDescriptor(BString currentDirectory, BString localPath, U3
     FsOpenNode* openNode;
     std::shared_ptr<KObject> kobject;
 
+    // check before anything is created on disk, like Linux does
+    if (handle<0 && this->getNextFileDescriptorHandle(afterHandle)<0) {
+        return -K_EMFILE;
+    }
     node = Fs::getNodeFromLocalPath(currentDirectory, localPath, true);
     if (!node && (accessFlags & (K_O_CREAT|K_O_TMPFILE))==0) {
         return -K_ENOENT;
@@ -574,6 +634,9 @@ U32 KProcess::openFileDescriptor(BString currentDirectory, BString localPath, U3
         kobject = std::make_shared<KFile>(openNode);
     }
     KFileDescriptor* f = this->allocFileDescriptor(kobject, accessFlags, descriptorFlags, handle, afterHandle);
+    if (!f) {
+        return -K_EMFILE;
+    }
     if (result) {
         *result = f;
     }
@@ -683,15 +746,18 @@ U32 KProcess::exit(U32 code) {
 }
 
 KFileDescriptor* KProcess::getFileDescriptor(FD handle) {
-    BOXEDWINE_CRITICAL_SECTION_WITH_MUTEX(fdsMutex);
-    if (this->fds.count(handle))
-        return this->fds[handle];
+    KFileDescriptorTable* table = this->fdTable.load(std::memory_order_acquire);
+    if ((U32)handle < table->size)
+        return table->fds[handle].load(std::memory_order_acquire);
     return NULL;
 }
 
-void KProcess::clearFdHandle(FD handle) {
+// only clears the handle if fd still owns it, dup2 may have already published a new descriptor there
+void KProcess::clearFdHandle(FD handle, KFileDescriptor* fd) {
     BOXEDWINE_CRITICAL_SECTION_WITH_MUTEX(fdsMutex);
-    this->fds.erase(handle);
+    if (this->getFileDescriptor(handle) == fd) {
+        this->setFileDescriptor(handle, NULL);
+    }
 }
 
 bool KProcess::isStopped() {
@@ -726,23 +792,20 @@ U32 KProcess::getModuleEip(U32 eip) {
 }
 
 U32 KProcess::alarm(U32 seconds) {
-    U32 prev = this->timer.millies;
+    U64 prev = this->timer.micros;
     if (seconds == 0) {
-        if (this->timer.millies!=0) {
+        if (this->timer.micros!=0) {
             removeTimer(&this->timer);
-            this->timer.millies = 0;
+            this->timer.micros = 0;
         }
     } else {
-        this->timer.resetMillies = 0;
-        if (this->timer.millies!=0) {
-            this->timer.millies = seconds*1000 + KSystem::getMilliesSinceStart();
-        } else {
-            this->timer.millies = seconds*1000 + KSystem::getMilliesSinceStart();
-            addTimer(&this->timer);
-        }
+        this->timer.resetMicros = 0;
+        // addTimer will move the timer if it is already active
+        this->timer.micros = (U64)seconds * 1000000 + KSystem::getMicroCounter();
+        addTimer(&this->timer);
     }
     if (prev) {
-        return (prev - KSystem::getMilliesSinceStart())/1000;
+        return (U32)((prev - KSystem::getMicroCounter()) / 1000000);
     }
     return 0;
 }
@@ -875,6 +938,7 @@ void KProcess::signalProcess(U32 signal) {
         BOXEDWINE_CRITICAL_SECTION_WITH_MUTEX(this->pendingSignalsMutex);
         this->pendingSignals |= signalMask;
     }
+    this->addPendingSignalWork();
 
 #ifdef BOXEDWINE_MULTI_THREADED
     // give each thread a chance to run a signal, some or all of them might have the signal masked off.  
@@ -937,7 +1001,11 @@ U32 KProcess::dup(U32 fildes) {
     if (!fd) {
         return -K_EBADF;
     }
-    return this->allocFileDescriptor(fd->kobject, fd->accessFlags, 0, -1, 0)->handle; // do not copy file descriptor flags
+    KFileDescriptor* result = this->allocFileDescriptor(fd->kobject, fd->accessFlags, 0, -1, 0); // do not copy file descriptor flags
+    if (!result) {
+        return -K_EMFILE;
+    }
+    return result->handle;
 }
 
 U32 KProcess::rmdir(BString path) {
@@ -1210,7 +1278,7 @@ U32 KProcess::dup2(FD fildes, FD fildes2) {
     KFileDescriptor* fd = this->getFileDescriptor(fildes);
     KFileDescriptor* fd2;
 
-    if (!fd || fildes2<0) {
+    if (!fd || fildes2<0 || fildes2>MAX_NUMBER_OF_FILES) {
         return -K_EBADF;
     }
     if (fildes == fildes2) {
@@ -1357,6 +1425,9 @@ U32 KProcess::readlink(BString path, U32 buffer, U32 bufSize) {
 
 U32 KProcess::mmap(U32 addr, U32 len, S32 prot, S32 flags, FD fildes, U64 off) {
     BOXEDWINE_CRITICAL_SECTION_WITH_MUTEX(memory->pageMutex); // race condition between findFirstAvailablePage and setting the flags
+#ifdef BOXEDWINE_BINARY_TRANSLATOR
+    NativePermissionBatch nativePermissionBatch(memory);
+#endif
     bool shared = (flags & K_MAP_SHARED)!=0;
     bool priv = (flags & K_MAP_PRIVATE)!=0;
     bool read = (prot & K_PROT_READ)!=0;
@@ -1476,6 +1547,10 @@ U32 KProcess::mmap(U32 addr, U32 len, S32 prot, S32 flags, FD fildes, U64 off) {
 }
 
 U32 KProcess::unmap(U32 address, U32 len) {
+    BOXEDWINE_CRITICAL_SECTION_WITH_MUTEX(memory->pageMutex);
+#ifdef BOXEDWINE_BINARY_TRANSLATOR
+    NativePermissionBatch nativePermissionBatch(memory);
+#endif
     U32 pageStart = address >> K_PAGE_SHIFT;
     U32 pageCount = (len+K_PAGE_SIZE-1)>>K_PAGE_SHIFT;
     
@@ -1574,30 +1649,28 @@ U32 KProcess::setitimer(U32 which, U32 newValue, U32 oldValue) {
         kpanic("setitimer which=%d not supported", which);
     }
     if (oldValue) {
-        U32 remaining = this->timer.millies - KSystem::getMilliesSinceStart();
+        U64 now = KSystem::getMicroCounter();
+        U64 remaining = (this->timer.micros > now) ? this->timer.micros - now : 0;
 
-        writed(oldValue, this->timer.resetMillies / 1000);
-        writed(oldValue, (this->timer.resetMillies % 1000) * 1000);
-        writed(oldValue + 8, remaining / 1000);
-        writed(oldValue + 12, (remaining % 1000) * 1000);
+        writed(oldValue, (U32)(this->timer.resetMicros / 1000000));
+        writed(oldValue + 4, (U32)(this->timer.resetMicros % 1000000));
+        writed(oldValue + 8, (U32)(remaining / 1000000));
+        writed(oldValue + 12, (U32)(remaining % 1000000));
     }
     if (newValue) {
-        U32 millies = readd(newValue + 8) * 1000 + readd(newValue + 12) / 1000;
-        U32 resetMillies = readd(newValue) * 1000 + readd(newValue + 4) / 1000;
+        U64 micros = (U64)readd(newValue + 8) * 1000000 + readd(newValue + 12);
+        U64 resetMicros = (U64)readd(newValue) * 1000000 + readd(newValue + 4);
 
-        if (millies == 0) {
-            if (this->timer.millies!=0) {
+        if (micros == 0) {
+            if (this->timer.micros!=0) {
                 removeTimer(&this->timer);
-                this->timer.millies = 0;
+                this->timer.micros = 0;
             }
         } else {
-            this->timer.resetMillies = resetMillies;			
-            if (this->timer.millies!=0) {
-                this->timer.millies = millies + KSystem::getMilliesSinceStart();
-            } else {
-                this->timer.millies = millies + KSystem::getMilliesSinceStart();
-                addTimer(&this->timer);
-            }
+            this->timer.resetMicros = resetMicros;
+            // addTimer will move the timer if it is already active
+            this->timer.micros = micros + KSystem::getMicroCounter();
+            addTimer(&this->timer);
         }
     }	
     return 0;
@@ -1725,6 +1798,10 @@ U32 KProcess::clone(U32 flags, U32 child_stack, U32 ptid, U32 tls, U32 ctid) {
             newThread->cpu->setSegment(GS, desc.entry_number << 3);
         }
         newThread->clear_child_tid = ctid;
+        newThread->nice = KThread::currentThread()->nice;
+        newThread->schedPolicy = KThread::currentThread()->schedPolicy;
+        newThread->schedPriority = KThread::currentThread()->schedPriority;
+        newThread->cpuAffinity = KThread::currentThread()->cpuAffinity;
         writed(ptid, newThread->id);
         newThread->cpu->reg[4].u32 = child_stack;
         newThread->cpu->reg[4].u32+=8;
@@ -1802,6 +1879,9 @@ U32 KProcess::exitgroup(U32 code) {
 
 U32 KProcess::mprotect(U32 address, U32 len, U32 prot) {
     BOXEDWINE_CRITICAL_SECTION_WITH_MUTEX(memory->pageMutex);
+#ifdef BOXEDWINE_BINARY_TRANSLATOR
+    NativePermissionBatch nativePermissionBatch(memory);
+#endif
     bool read = (prot & K_PROT_READ)!=0;
     bool write = (prot & K_PROT_WRITE)!=0;
     bool exec = (prot & K_PROT_EXEC)!=0;
@@ -1980,7 +2060,11 @@ U32 KProcess::memfd_create(BString name, U32 flags) {
     if (!(flags & 2)) { // MFD_ALLOW_SEALING	
         openNode->addSeals(K_F_SEAL_SEAL);
     }
-    return this->allocFileDescriptor(kobject, K_O_RDWR, descriptorFlags, -1, 0)->handle;
+    KFileDescriptor* result = this->allocFileDescriptor(kobject, K_O_RDWR, descriptorFlags, -1, 0);
+    if (!result) {
+        return -K_EMFILE;
+    }
+    return result->handle;
 }
 
 U32 KProcess::mlock(U32 addr, U32 len) {
@@ -2206,11 +2290,23 @@ U32 KProcess::fcntrl(FD fildes, U32 cmd, U32 arg) {
             }
             return 0;
         case K_F_DUPFD: {
-            KFileDescriptor* result = this->allocFileDescriptor(fd->kobject, fd->accessFlags, fd->descriptorFlags, -1, arg);        
+            if (arg > MAX_NUMBER_OF_FILES) {
+                return -K_EINVAL;
+            }
+            KFileDescriptor* result = this->allocFileDescriptor(fd->kobject, fd->accessFlags, fd->descriptorFlags, -1, arg);
+            if (!result) {
+                return -K_EMFILE;
+            }
             return result->handle;
         }
         case K_F_DUPFD_CLOEXEC: {
+            if (arg > MAX_NUMBER_OF_FILES) {
+                return -K_EINVAL;
+            }
             KFileDescriptor* result = this->allocFileDescriptor(fd->kobject, fd->accessFlags, fd->descriptorFlags, -1, arg);
+            if (!result) {
+                return -K_EMFILE;
+            }
             result->descriptorFlags=FD_CLOEXEC;
             return result->handle;
         }
@@ -2329,6 +2425,9 @@ U32 KProcess::set_thread_area(U32 info) {
 U32 KProcess::epollcreate(U32 size, U32 flags) {
     std::shared_ptr<KObject> o = std::make_shared<KEPoll>();
     KFileDescriptor* result = this->allocFileDescriptor(o, K_O_RDWR, flags, -1, 0);
+    if (!result) {
+        return -K_EMFILE;
+    }
     return result->handle;
 }
 
@@ -2686,15 +2785,27 @@ U32 KProcess::signal(U32 signal) {
         }
     }
     // didn't find a thread that could handle it
-    BOXEDWINE_CRITICAL_SECTION_WITH_MUTEX(this->pendingSignalsMutex);
-    this->pendingSignals |= ((U64)1 << (signal-1));
-    this->signalFd(NULL, signal);
+    {
+        BOXEDWINE_CRITICAL_SECTION_WITH_MUTEX(this->pendingSignalsMutex);
+        this->pendingSignals |= ((U64)1 << (signal-1));
+        this->signalFd(NULL, signal);
+    }
+    this->addPendingSignalWork();
     return 0;
 }
 
+// each thread will check if it can run the signal the next time it makes a syscall or unmasks a signal
+void KProcess::addPendingSignalWork() {
+    iterateThreads([](KThread* thread) {
+        thread->addPendingWork(KTHREAD_WORK_SIGNAL);
+        return true;
+    });
+}
+
 void KProcess::signalFd(KThread* thread, U32 signal) {
-    for (auto& n : this->fds) {
-        KFileDescriptor* fd = n.second;
+    std::vector<KFileDescriptor*> fds;
+    this->getFileDescriptors(fds);
+    for (KFileDescriptor* fd : fds) {
         if (fd->kobject->type == KTYPE_SIGNAL) {
             std::shared_ptr<KSignal> p = std::dynamic_pointer_cast<KSignal>(fd->kobject);
             if ((p->mask & signal) && (!thread || thread->waitingCond == &p->lockCond)) {
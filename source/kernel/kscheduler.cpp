@@ -17,54 +17,141 @@
  */
 #include "boxedwine.h"
 
+// active timers are kept in a binary min heap ordered by when they expire, this way adding and removing a timer is
+// O(log n), finding the next timer is O(1) and running timers only looks at the ones that expired
+#define TIMER_NOT_IN_HEAP 0xFFFFFFFF
+
+static std::vector<KTimer*> timerHeap;
+
+static void timerHeapSet(U32 index, KTimer* timer) {
+    timerHeap[index] = timer;
+    timer->heapIndex = index;
+}
+
+static void timerHeapSiftUp(U32 index) {
+    KTimer* timer = timerHeap[index];
+    while (index > 0) {
+        U32 parent = (index - 1) / 2;
+        if (timerHeap[parent]->micros <= timer->micros) {
+            break;
+        }
+        timerHeapSet(index, timerHeap[parent]);
+        index = parent;
+    }
+    timerHeapSet(index, timer);
+}
+
+static void timerHeapSiftDown(U32 index) {
+    U32 count = (U32)timerHeap.size();
+    KTimer* timer = timerHeap[index];
+    while (true) {
+        U32 child = index * 2 + 1;
+        if (child >= count) {
+            break;
+        }
+        if (child + 1 < count && timerHeap[child + 1]->micros < timerHeap[child]->micros) {
+            child++;
+        }
+        if (timer->micros <= timerHeap[child]->micros) {
+            break;
+        }
+        timerHeapSet(index, timerHeap[child]);
+        index = child;
+    }
+    timerHeapSet(index, timer);
+}
+
+static void timerHeapRemove(KTimer* timer) {
+    U32 index = timer->heapIndex;
+    KTimer* last = timerHeap.back();
+
+    timerHeap.pop_back();
+    timer->heapIndex = TIMER_NOT_IN_HEAP;
+    if (last != timer) {
+        timerHeapSet(index, last);
+        timerHeapSiftUp(index);
+        timerHeapSiftDown(last->heapIndex);
+    }
+}
+
+// if the timer is already active, then its micros were changed and it will be moved to its new spot
+static void timerHeapAdd(KTimer* timer) {
+    if (timer->active && timer->heapIndex != TIMER_NOT_IN_HEAP) {
+        timerHeapSiftUp(timer->heapIndex);
+        timerHeapSiftDown(timer->heapIndex);
+    } else {
+        timerHeap.push_back(timer);
+        timerHeapSiftUp((U32)timerHeap.size() - 1);
+    }
+    timer->active = true;
+}
+
+static void timerHeapCancel(KTimer* timer) {
+    if (timer->active && timer->heapIndex != TIMER_NOT_IN_HEAP) {
+        timerHeapRemove(timer);
+    }
+    timer->active = false;
+}
+
+static void timerHeapRun() {
+    U64 now = KSystem::getMicroCounter();
+    // a timer that keeps itself active without moving its expire time forward will only run once per call
+    U32 count = (U32)timerHeap.size();
+
+    while (count && !timerHeap.empty() && timerHeap[0]->micros <= now) {
+        KTimer* timer = timerHeap[0];
+
+        count--;
+        // the timer stays active while it runs so that it can remove or add itself
+        timerHeapRemove(timer);
+        if (timer->run()) {
+            if (timer->heapIndex == TIMER_NOT_IN_HEAP) {
+                timer->active = false;
+            }
+        } else if (timer->active && timer->heapIndex == TIMER_NOT_IN_HEAP) {
+            timerHeap.push_back(timer);
+            timerHeapSiftUp((U32)timerHeap.size() - 1);
+        }
+    }
+}
+
+// the callers wait in milliseconds, so this rounds up to make sure the timer has expired by the time they wake up
+static U32 timerHeapNext() {
+    if (timerHeap.empty()) {
+        return 0xFFFFFFFF;
+    }
+    U64 now = KSystem::getMicroCounter();
+    U64 next = timerHeap[0]->micros;
+    if (next <= now) {
+        return 0;
+    }
+    U64 millies = (next - now + 999) / 1000;
+    if (millies >= 0xFFFFFFFF) {
+        return 0xFFFFFFFE;
+    }
+    return (U32)millies;
+}
+
 #ifdef BOXEDWINE_MULTI_THREADED
-static KList<KTimer*> timers;
 static BOXEDWINE_MUTEX timerMutex;
 void runTimers() {
     BOXEDWINE_CRITICAL_SECTION_WITH_MUTEX(timerMutex);
-    U32 millies = KSystem::getMilliesSinceStart();
-    timers.for_each([millies](KListNode<KTimer*>* node) {
-        KTimer* timer = node->data;
-
-        if (timer->millies <= millies) {
-            if (timer->run()) {
-                timer->node.remove();
-            }
-        }
-        });
+    timerHeapRun();
 }
 
 U32 getNextTimer() {
     BOXEDWINE_CRITICAL_SECTION_WITH_MUTEX(timerMutex);
-    U32 millies = KSystem::getMilliesSinceStart();
-    U32 result = 0xFFFFFFFF;
-
-    timers.for_each([millies, &result](KListNode<KTimer*>* node) {
-        KTimer* timer = node->data;
-        U32 next;
-        if (timer->millies <= millies) {
-            next = 0;
-        }
-        else {
-            next = timer->millies - millies;
-        }
-        if (next < result) {
-            result = next;
-        }
-        });
-    return result;
+    return timerHeapNext();
 }
 
 void addTimer(KTimer* timer) {
     BOXEDWINE_CRITICAL_SECTION_WITH_MUTEX(timerMutex);
-    timers.addToBack(&timer->node);
-    timer->active = true;
+    timerHeapAdd(timer);
 }
 
 void removeTimer(KTimer* timer) {
     BOXEDWINE_CRITICAL_SECTION_WITH_MUTEX(timerMutex);
-    timer->node.remove();
-    timer->active = false;
+    timerHeapCancel(timer);
 }
 #else
 #include "devfb.h"
@@ -77,16 +164,96 @@ void removeTimer(KTimer* timer) {
 
 KList<KThread*> scheduledThreads;
 KList<KThread*> waitThreads;
-KList<KTimer*> timers;
+
+#ifdef BOXEDWINE_WORKER_THREADS
+#include <thread>
+#include <unordered_set>
+
+// With -workers greater than 1 the emulated threads run on a pool of host threads.  Worker 0 is the main thread, the
+// others are started by startSchedulerWorkers.  Each worker has its own run queue, a worker with nothing it can run on
+// its own queue takes a thread from another worker's queue.
+//
+// Only guest code runs without the kernel lock (see BoxedWineKernelLock), everything else in the kernel still runs one
+// at a time.  The threads of one process share the soft mmu page tables and the decoded blocks, which have no locks of
+// their own, so they take turns and only different processes run at the same time.  Locked instructions are not atomic
+// between processes that share memory.  Threads that used the native window, OpenGL or audio only run on the main
+// thread, since SDL expects to be called from there.
+//
+// With 1 worker (the default) none of this is used and runSlice runs every thread on the main thread in the same order
+// each time.
+struct SchedulerWorker {
+    KList<KThread*> runQueue;
+    std::thread thread;
+};
+
+static std::vector<SchedulerWorker*> schedulerWorkers;
+static std::mutex schedulerMutex; // run queues, KThread::schedulerRunning, KThread::mainWorkerOnly and runningMemory
+static std::condition_variable schedulerWorkAvailable;
+static std::unordered_set<Memory*> runningMemory;
+static std::atomic<bool> schedulerWorkersDone;
+THREAD_LOCAL static U32 schedulerWorkerIndex;
+
+// schedulerMutex must be held
+static void addToRunQueue(KThread* thread, bool front) {
+    KList<KThread*>& runQueue = schedulerWorkers[thread->mainWorkerOnly ? 0 : thread->schedulerWorker]->runQueue;
+
+    if (front) {
+        runQueue.addToFront(&thread->scheduledThreadNode);
+    } else {
+        runQueue.addToBack(&thread->scheduledThreadNode);
+    }
+    schedulerWorkAvailable.notify_all();
+}
+
+// schedulerMutex must be held, a worker looks at its own run queue first
+static KListNode<KThread*>* findRunnableThread(U32 index) {
+    U32 count = (U32)schedulerWorkers.size();
+
+    for (U32 i = 0; i < count; i++) {
+        KListNode<KThread*>* node = schedulerWorkers[(index + i) % count]->runQueue.front();
+        while (node) {
+            KThread* thread = node->data;
+            if ((index == 0 || !thread->mainWorkerOnly) && runningMemory.find(thread->memory) == runningMemory.end()) {
+                return node;
+            }
+            node = node->getNext();
+        }
+    }
+    return NULL;
+}
+
+static void scheduleThreadOnWorker(KThread* thread) {
+    std::lock_guard<std::mutex> lock(schedulerMutex);
+
+    // a running thread goes back on a run queue at the end of its slice, unless it is waiting again by then
+    if (thread->schedulerRunning || thread->scheduledThreadNode.isInList()) {
+        return;
+    }
+    thread->cpu->yield = false;
+    addToRunQueue(thread, thread->interactive || thread->schedPolicy == K_SCHED_FIFO || thread->schedPolicy == K_SCHED_RR);
+}
+
+bool runOnMainWorker(KThread* thread) {
+    if (schedulerWorkerIndex == 0) {
+        return true;
+    }
+    std::lock_guard<std::mutex> lock(schedulerMutex);
+    thread->mainWorkerOnly = true;
+    thread->cpu->yield = true;
+    return false;
+}
+
+bool isMainSchedulerWorker() {
+    return schedulerWorkerIndex == 0;
+}
+#endif
 
 void addTimer(KTimer* timer) {
-    timers.addToBack(&timer->node);
-    timer->active = true;
+    timerHeapAdd(timer);
 }
 
 void removeTimer(KTimer* timer) {
-    timer->node.remove();
-    timer->active = false;
+    timerHeapCancel(timer);
 }
 
 void scheduleThread(KThread* thread) {
@@ -97,12 +264,26 @@ void scheduleThread(KThread* thread) {
     if (thread->condTimer.active) {
         kpanic("can't schedule a thread that is waiting on a timer");
     }
+#endif
+#ifdef BOXEDWINE_WORKER_THREADS
+    if (schedulerWorkers.size() > 1) {
+        scheduleThreadOnWorker(thread);
+        return;
+    }
 #endif
     thread->cpu->yield = false;
-    scheduledThreads.addToFront(&thread->scheduledThreadNode);
+    // threads that block quickly, like audio and input threads, run before threads that used up their last time slice
+    if (thread->interactive || thread->schedPolicy == K_SCHED_FIFO || thread->schedPolicy == K_SCHED_RR) {
+        scheduledThreads.addToFront(&thread->scheduledThreadNode);
+    } else {
+        scheduledThreads.addToBack(&thread->scheduledThreadNode);
+    }
 }
 
 void unscheduleThread(KThread* thread) {	    
+#ifdef BOXEDWINE_WORKER_THREADS
+    std::lock_guard<std::mutex> lock(schedulerMutex);
+#endif
     thread->scheduledThreadNode.remove();
     thread->cpu->yield = true;
 }
@@ -110,6 +291,18 @@ void unscheduleThread(KThread* thread) {
 void terminateOtherThread(const std::shared_ptr<KProcess>& process, U32 threadId) {
     KThread* thread = process->getThreadById(threadId);
     if (thread) {
+#ifdef BOXEDWINE_WORKER_THREADS
+        {
+            std::lock_guard<std::mutex> lock(schedulerMutex);
+            if (thread->schedulerRunning) {
+                // a thread of another process, its worker deletes it at the end of the slice
+                thread->terminating = true;
+                thread->addPendingWork(KTHREAD_WORK_TERMINATE);
+                thread->cpu->yield = true;
+                return;
+            }
+        }
+#endif
         unscheduleThread(thread);
         delete thread;
     }
@@ -117,16 +310,61 @@ void terminateOtherThread(const std::shared_ptr<KProcess>& process, U32 threadId
 
 void terminateCurrentThread(KThread* thread) {
 	thread->terminating = true;
+	thread->addPendingWork(KTHREAD_WORK_TERMINATE);
 	unscheduleThread(thread);
 }
 
+#ifdef BOXEDWINE_WORKER_THREADS
+// each scheduler worker keeps track of its own 10ms slices
+THREAD_LOCAL S32 contextTime = 100000;
+THREAD_LOCAL S32 contextTimeRemaining = 100000;
+THREAD_LOCAL S32 threadSliceTime = 100000;
+#else
 S32 contextTime = 100000;
 S32 contextTimeRemaining = 100000;
+S32 threadSliceTime = 100000;
+#endif
 int count;
 extern struct Block emptyBlock;
 
+// same as the Linux CFS weights, each nice level is about 1.25 times the cpu time of the next one and nice 0 is 1024
+static const U32 niceToWeight[40] = {
+    88761, 71755, 56483, 46273, 36291,
+    29154, 23254, 18705, 14949, 11916,
+     9548,  7620,  6100,  4904,  3906,
+     3121,  2501,  1991,  1586,  1277,
+     1024,   820,   655,   526,   423,
+      335,   272,   215,   172,   137,
+      110,    87,    70,    56,    45,
+       36,    29,    23,    18,    15,
+};
+
+// a thread gets its share of what is left of the current 10ms slice, scaled by its priority
+static S32 getThreadSliceTime(KThread* thread) {
+    U32 weight;
+
+    if (thread->schedPolicy == K_SCHED_FIFO || thread->schedPolicy == K_SCHED_RR) {
+        weight = niceToWeight[0];
+    } else if (thread->schedPolicy == K_SCHED_IDLE) {
+        weight = 3;
+    } else {
+        weight = niceToWeight[thread->nice + 20];
+    }
+    S64 result = ((S64)contextTimeRemaining * weight) >> 10;
+    if (result > (S64)contextTime * 2) {
+        result = (S64)contextTime * 2;
+    } else if (result < 1000) {
+        result = 1000;
+    }
+    return (S32)result;
+}
+
 void runThreadSlice(KThread* thread) {
     CPU* cpu;
+#ifdef BOXEDWINE_WORKER_THREADS
+    // a longjmp out of the cpu skips the destructors of the kernel locks that were taken on the way
+    U32 kernelLockDepth = BoxedWineKernelLock::getDepth();
+#endif
 
     cpu = thread->cpu;
     cpu->blockInstructionCount = 0;
@@ -137,11 +375,14 @@ void runThreadSlice(KThread* thread) {
 #endif
         do {
             cpu->run();
-        } while ((int)cpu->blockInstructionCount < contextTimeRemaining && !cpu->yield);	
+        } while ((int)cpu->blockInstructionCount < threadSliceTime && !cpu->yield);	
 
 #ifdef BOXEDWINE_HAS_SETJMP
     } else {
         cpu->nextBlock = NULL;
+#ifdef BOXEDWINE_WORKER_THREADS
+        BoxedWineKernelLock::unlockTo(kernelLockDepth);
+#endif
     }
 #endif
 
@@ -149,25 +390,215 @@ void runThreadSlice(KThread* thread) {
 }
 
 void runTimers() {
-    U32 millies = KSystem::getMilliesSinceStart();
-    timers.for_each([millies] (KListNode<KTimer*>* node) {
-        KTimer* timer = node->data;
+    timerHeapRun();
+}
 
-        if (timer->millies<=millies) {
-            if (timer->run()) {                
-                timer->node.remove();
-            }
-        }
-    });
+U32 getNextTimer() {
+    return timerHeapNext();
 }
 
+#ifdef BOXEDWINE_WORKER_THREADS
+extern THREAD_LOCAL U64 sysCallTime;
+#else
 extern U64 sysCallTime;
+#endif
 U64 elapsedTimeMIPS;
 U64 elapsedInstructionsMIPS;
 
+#ifdef BOXEDWINE_WORKER_THREADS
+static std::atomic<U64> workerRdtsc;
+
+// runs what this worker can get to for about 10ms, the caller holds the kernel lock.  Returns false if there was nothing
+// for this worker to run
+static bool runWorkerSlice(U32 index) {
+    U64 elapsedTime = 0;
+    bool ran = false;
+
+    contextTimeRemaining = contextTime;
+    while (elapsedTime < 9000) {
+        if (ran) {
+            // a thread woken by a timer can run next instead of waiting for the rest of the 10ms slice
+            runTimers();
+        }
+        KThread* currentThread;
+        {
+            std::lock_guard<std::mutex> lock(schedulerMutex);
+            KListNode<KThread*>* node = findRunnableThread(index);
+            if (!node) {
+                break;
+            }
+            node->remove();
+            currentThread = node->data;
+            currentThread->schedulerRunning = true;
+            currentThread->schedulerWorker = index;
+            runningMemory.insert(currentThread->memory);
+        }
+        ran = true;
+
+        // exec can change it during the slice
+        Memory* memory = currentThread->memory;
+        U64 threadStartTime = KSystem::getMicroCounter();
+        if (index == 0) {
+            KNativeWindow::getNativeWindow()->glUpdateContextForThread(currentThread);
+        }
+        sysCallTime = 0;
+
+        ChangeThread c(currentThread);
+        KSystem::updateTimePage(memory);
+        currentThread->cpu->instructionCount = workerRdtsc;
+        threadSliceTime = getThreadSliceTime(currentThread);
+
+        U32 kernelLockDepth = BoxedWineKernelLock::unlockAll();
+        platformRunThreadSlice(currentThread);
+        BoxedWineKernelLock::relock(kernelLockDepth);
+
+        // every thread starts its slice at the highest count so far, so rdtsc never goes backwards for a thread
+        workerRdtsc += currentThread->cpu->blockInstructionCount;
+
+        U64 diff = KSystem::getMicroCounter() - threadStartTime;
+
+        elapsedTime += diff;
+        elapsedTimeMIPS += diff;
+        elapsedInstructionsMIPS += currentThread->cpu->blockInstructionCount;
+
+        currentThread->userTime += diff - sysCallTime;
+        currentThread->kernelTime += sysCallTime;
+
+        if (currentThread->cpu->blockInstructionCount) {
+            contextTimeRemaining = (U32)(contextTime * (10000 - elapsedTime) / 10000);
+        }
+        if (currentThread->waitingCond) {
+            if ((S32)currentThread->cpu->blockInstructionCount < threadSliceTime / 4) {
+                currentThread->interactive = true;
+            }
+        } else if ((S32)currentThread->cpu->blockInstructionCount >= threadSliceTime) {
+            currentThread->interactive = false;
+        }
+        // the memory stays marked as running until the thread is gone, so another thread of the process can't start
+        // while this one is cleaned up
+        bool terminating = currentThread->terminating;
+        if (terminating) {
+            delete currentThread;
+        }
+        std::lock_guard<std::mutex> lock(schedulerMutex);
+        runningMemory.erase(memory);
+        if (!terminating) {
+            currentThread->schedulerRunning = false;
+            if (!currentThread->waitingCond) {
+                // make sure we are behind any threads that were recently scheduled
+                addToRunQueue(currentThread, false);
+            }
+        }
+        schedulerWorkAvailable.notify_all();
+    }
+    if (elapsedTime >= 9000) {
+        if (elapsedTime > 11000) {
+            if (contextTime > 100000)
+                contextTime -= 20000;
+        } else if (elapsedTime < 9500) {
+            contextTime += 20000;
+        }
+    }
+    return ran;
+}
+
+// the caller holds the kernel lock, it is let go while waiting so that the other workers can get into the kernel
+void waitForScheduledThread(U32 timeout) {
+    if (timeout > 20) {
+        timeout = 20;
+    }
+    U32 kernelLockDepth = BoxedWineKernelLock::unlockAll();
+    {
+        std::unique_lock<std::mutex> lock(schedulerMutex);
+        if (!schedulerWorkersDone && !findRunnableThread(schedulerWorkerIndex)) {
+            schedulerWorkAvailable.wait_for(lock, std::chrono::milliseconds(timeout));
+        }
+    }
+    BoxedWineKernelLock::relock(kernelLockDepth);
+}
+
+static void runSchedulerWorker(U32 index) {
+    schedulerWorkerIndex = index;
+
+    BOXEDWINE_KERNEL_LOCK;
+    while (!schedulerWorkersDone) {
+        runTimers();
+        if (!runWorkerSlice(index)) {
+            waitForScheduledThread(getNextTimer());
+        }
+    }
+}
+
+void startSchedulerWorkers() {
+    U32 count = KSystem::schedulerWorkers;
+
+    if (count <= 1) {
+        return;
+    }
+    BoxedWineKernelLock::enabled = true;
+    schedulerWorkersDone = false;
+    for (U32 i = 0; i < count; i++) {
+        schedulerWorkers.push_back(new SchedulerWorker());
+    }
+    // threads that were scheduled before there were workers, like the first process
+    while (!scheduledThreads.isEmpty()) {
+        KListNode<KThread*>* node = scheduledThreads.front();
+        node->remove();
+        schedulerWorkers[0]->runQueue.addToBack(node);
+    }
+    for (U32 i = 1; i < count; i++) {
+        schedulerWorkers[i]->thread = std::thread(runSchedulerWorker, i);
+    }
+}
+
+// the caller must not hold the kernel lock, the workers need it to finish their slice
+void stopSchedulerWorkers() {
+    if (schedulerWorkers.size() <= 1) {
+        return;
+    }
+    {
+        std::lock_guard<std::mutex> lock(schedulerMutex);
+        schedulerWorkersDone = true;
+        schedulerWorkAvailable.notify_all();
+    }
+    for (U32 i = 1; i < schedulerWorkers.size(); i++) {
+        schedulerWorkers[i]->thread.join();
+    }
+    // back to the main thread only, in case doMainLoop is called again
+    for (auto& worker : schedulerWorkers) {
+        while (!worker->runQueue.isEmpty()) {
+            KListNode<KThread*>* node = worker->runQueue.front();
+            node->remove();
+            scheduledThreads.addToBack(node);
+        }
+        delete worker;
+    }
+    schedulerWorkers.clear();
+    runningMemory.clear();
+    BoxedWineKernelLock::enabled = false;
+}
+#endif
+
 bool runSlice() {    
     runTimers();
 
+#ifdef BOXEDWINE_WORKER_THREADS
+    if (schedulerWorkers.size() > 1) {
+        static U64 lastFlipRdtsc;
+
+        // the other workers can draw to the frame buffer while the main thread has nothing to run
+        if (lastFlipRdtsc != workerRdtsc) {
+            lastFlipRdtsc = workerRdtsc;
+            flipFB();
+            std::shared_ptr<KNativeWindow> window = KNativeWindow::getNativeWindow();
+            if (window) {
+                window->flipFB();
+            }
+        }
+        return runWorkerSlice(0);
+    }
+#endif
+
     if (scheduledThreads.isEmpty())
         return false;
     
@@ -180,6 +611,10 @@ bool runSlice() {
 
     contextTimeRemaining = contextTime;
     while (!scheduledThreads.isEmpty() && elapsedTime<9000) {
+        if (elapsedTime) {
+            // a thread woken by a timer can run next instead of waiting for the rest of the 10ms slice
+            runTimers();
+        }
         U64 threadStartTime = KSystem::getMicroCounter();
         KListNode<KThread*>* node = scheduledThreads.front();
         KThread* currentThread = (KThread*)node->data;
@@ -187,8 +622,10 @@ bool runSlice() {
         sysCallTime = 0;    
 
         ChangeThread c(currentThread);
+        KSystem::updateTimePage(currentThread->memory);
         static U64 rdtsc;
         currentThread->cpu->instructionCount = rdtsc;
+        threadSliceTime = getThreadSliceTime(currentThread);
         platformRunThreadSlice(currentThread);
         rdtsc = currentThread->cpu->instructionCount;
 
@@ -206,6 +643,13 @@ bool runSlice() {
         if (currentThread->cpu->blockInstructionCount) {
             contextTimeRemaining = (U32)(contextTime * (10000-elapsedTime) / 10000);
         }
+        if (currentThread->waitingCond) {
+            if ((S32)currentThread->cpu->blockInstructionCount < threadSliceTime / 4) {
+                currentThread->interactive = true;
+            }
+        } else if ((S32)currentThread->cpu->blockInstructionCount >= threadSliceTime) {
+            currentThread->interactive = false;
+        }
         // this is how we signal to delete the current thread, since we can't delete it in the syscall, maybe we should use smart_ptr for threads
         if (currentThread->terminating) {
             delete currentThread;
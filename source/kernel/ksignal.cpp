@@ -81,9 +81,9 @@ bool KSignal::isOpen() {
 
 void KSignal::waitForEvents(BOXEDWINE_CONDITION& parentCondition, U32 events) {
     if (events & K_POLLIN) {
-        BOXEDWINE_CONDITION_SET_PARENT(this->lockCond, &parentCondition);
+        BOXEDWINE_CONDITION_ADD_PARENT(this->lockCond, &parentCondition);
     } else {
-        BOXEDWINE_CONDITION_SET_PARENT(this->lockCond, nullptr);
+        BOXEDWINE_CONDITION_REMOVE_PARENT(this->lockCond, &parentCondition);
     }
     if (events & K_POLLOUT) {
         kpanic("waiting on a signal not implemented yet");
@@ -153,7 +153,7 @@ U32 KSignal::readNative(U8* buffer, U32 len) {
                 U64 todo = thread->pendingSignals & this->mask;
                 for (U32 i=0;i<32;i++) {
                     if ((todo & ((U64)1 << i))!=0) {
-                        thread->pendingSignals &= ~(1 << i);                
+                        thread->pendingSignals &= ~((U64)1 << i);                
                         writeSignal(buffer, i, this->signalingPid, this->signalingUid, (this->sigAction.sigInfo[0]==i)?&this->sigAction:NULL);
                         result+=128;
                         len-=128;
@@ -171,7 +171,7 @@ U32 KSignal::readNative(U8* buffer, U32 len) {
                 U64 todo = thread->process->pendingSignals & this->mask;
                 for (U32 i=0;i<32;i++) {
                     if ((todo & ((U64)1 << i))!=0) {
-                        thread->process->pendingSignals &= ~(1 << i);                
+                        thread->process->pendingSignals &= ~((U64)1 << i);                
                         writeSignal(buffer, i, this->signalingPid, this->signalingUid, (this->sigAction.sigInfo[0]==i)?&this->sigAction:NULL);
                         result+=128;
                         len-=128;
@@ -253,6 +253,9 @@ U32 syscall_signalfd4(S32 fildes, U32 mask, U32 maskSize, U32 flags) {
     } else {
         std::shared_ptr<KSignal> o = std::make_shared<KSignal>();
         fd =  thread->process->allocFileDescriptor(o, K_O_RDONLY, 0, -1, 0);
+        if (!fd) {
+            return -K_EMFILE;
+        }
     }    
     if (flags & K_O_CLOEXEC) {
         fd->descriptorFlags|=FD_CLOEXEC;
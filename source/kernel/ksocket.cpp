@@ -49,6 +49,9 @@ U32 ksocket(U32 domain, U32 type, U32 protocol) {
     if (domain==K_AF_UNIX || domain==K_AF_NETLINK) {
         std::shared_ptr<KUnixSocketObject> kSocket = std::make_shared<KUnixSocketObject>(KThread::currentThread()->process->id, domain, type, protocol);
         KFileDescriptor* result = KThread::currentThread()->process->allocFileDescriptor(kSocket, K_O_RDWR, 0, -1, 0);
+        if (!result) {
+            return -K_EMFILE;
+        }
         return result->handle;
     } else if (domain == K_AF_INET) {   
         std::shared_ptr<KNativeSocketObject> s = std::make_shared<KNativeSocketObject>(domain, type, protocol);
@@ -56,6 +59,9 @@ U32 ksocket(U32 domain, U32 type, U32 protocol) {
             return s->error;
         } else {
             KFileDescriptor* result = KThread::currentThread()->process->allocFileDescriptor(s, K_O_RDWR, 0, -1, 0);
+            if (!result) {
+                return -K_EMFILE;
+            }
             return result->handle;
         }
     }
@@ -172,7 +178,14 @@ U32 ksocketpair(U32 af, U32 type, U32 protocol, U32 socks, U32 flags) {
         return -1;
     }
     fd1 = ksocket(af, type, protocol);
+    if (fd1 < 0) {
+        return fd1;
+    }
     fd2 = ksocket(af, type, protocol);
+    if (fd2 < 0) {
+        thread->process->close(fd1);
+        return fd2;
+    }
     f1 = thread->process->getFileDescriptor(fd1);
     f2 = thread->process->getFileDescriptor(fd2);
     s1 = std::dynamic_pointer_cast<KUnixSocketObject>(f1->kobject);
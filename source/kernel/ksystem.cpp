@@ -28,6 +28,14 @@
 
 #include <time.h>
 
+#if defined(BOXEDWINE_BINARY_TRANSLATOR) && defined(BOXEDWINE_X64)
+#ifdef _MSC_VER
+#include <intrin.h>
+#else
+#include <x86intrin.h>
+#endif
+#endif
+
 bool KSystem::modesInitialized = false;
 U32 KSystem::skipFrameFPS = 0;
 bool KSystem::videoEnabled = true;
@@ -64,8 +72,18 @@ bool KSystem::useLargeAddressSpace = true;
 #endif
 bool KSystem::useSingleMemOffset = true;
 #endif
+#ifdef BOXEDWINE_64BIT_MMU
+bool KSystem::useHugePages = false;
+#endif
+#ifdef BOXEDWINE_DEFAULT_MMU
+U32 KSystem::fileReadAheadPages = 16;
+#endif
 #ifdef BOXEDWINE_MULTI_THREADED
 U32 KSystem::cpuAffinityCountForApp = 0;
+S32 KSystem::mainThreadCpu = -1;
+#endif
+#ifdef BOXEDWINE_WORKER_THREADS
+U32 KSystem::schedulerWorkers = 1;
 #endif
 U32 KSystem::pollRate = DEFAULT_POLL_RATE;
 FILE* KSystem::logFile;
@@ -132,6 +150,19 @@ U32 KSystem::getProcessCount() {
     return (U32)KSystem::processes.size();
 }
 
+U32 KSystem::getCpuCount() {
+    U32 count = Platform::getCpuCount();
+#ifdef BOXEDWINE_MULTI_THREADED
+    if (KSystem::cpuAffinityCountForApp != 0 && KSystem::cpuAffinityCountForApp < count) {
+        count = KSystem::cpuAffinityCountForApp;
+    }
+#endif
+    if (count > 64) {
+        count = 64; // sched_setaffinity masks are kept in a U64
+    }
+    return count;
+}
+
 U32 KSystem::uname(U32 address) {
     writeNativeString(address, "Linux"); // sysname
     writeNativeString(address + 65, "Linux"); // nodename
@@ -185,15 +216,126 @@ U32 KSystem::ugetrlimit(U32 resource, U32 rlim) {
     return 0;
 }
 
+#if defined(BOXEDWINE_BINARY_TRANSLATOR) && defined(BOXEDWINE_X64)
+#define BOXEDWINE_VDSO_TSC
+// the x64 translator runs rdtsc natively
+static U64 readGuestTsc() {
+    return __rdtsc();
+}
+#elif defined(BOXEDWINE_ARMV8BT) && defined(__GNUC__)
+#define BOXEDWINE_VDSO_TSC
+// the armv8 translator returns the virtual counter for rdtsc
+static U64 readGuestTsc() {
+    U64 result;
+    __asm__ volatile("mrs %0, cntvct_el0" : "=r"(result));
+    return result;
+}
+#endif
+
+static BOXEDWINE_MUTEX timePageMutex;
+
+#ifdef BOXEDWINE_VDSO_TSC
+static bool tscCalibrationStarted;
+static U64 tscCalibrationStartTicks;
+static U64 tscCalibrationStartNs;
+
+// finds mult and shift so that nanoseconds = ticks * mult >> shift, it's measured over all the time since the first
+// call so it gets more accurate the longer Boxedwine runs.  Returns false until there has been enough time to measure it
+static bool getTscScale(U64 tsc, U64 ns, U32* mult, U32* shift) {
+    if (!tscCalibrationStarted) {
+        tscCalibrationStarted = true;
+        tscCalibrationStartTicks = tsc;
+        tscCalibrationStartNs = ns;
+        return false;
+    }
+    U64 elapsedNs = ns - tscCalibrationStartNs;
+    U64 elapsedTicks = tsc - tscCalibrationStartTicks;
+    if (elapsedNs < 100000000l || !elapsedTicks) {
+        return false;
+    }
+    double nsPerTick = (double)elapsedNs / (double)elapsedTicks;
+    for (U32 i = 31; i > 0; i--) {
+        double m = nsPerTick * (double)((U64)1 << i);
+        if (m < 4294967296.0) {
+            *mult = (U32)m;
+            *shift = i;
+            return true;
+        }
+    }
+    return false;
+}
+#endif
+
+static void writeTimePageTime(U8* address, U64 ns) {
+    U64 seconds = ns / 1000000000l;
+    *(U32*)address = (U32)seconds;
+    *(U32*)(address + 4) = (U32)(seconds >> 32);
+    *(U32*)(address + 8) = (U32)(ns % 1000000000l);
+}
+
+static U64 readTimePageTime(U8* address) {
+    U64 seconds = *(U32*)address | ((U64)*(U32*)(address + 4) << 32);
+    return seconds * 1000000000l + *(U32*)(address + 8);
+}
+
+U64 KSystem::updateTimePage(Memory* memory) {
+    BOXEDWINE_CRITICAL_SECTION_WITH_MUTEX(timePageMutex);
+    U8* page = memory->getTimePage();
+    U64 monotonic = KSystem::getMicroCounter() * 1000;
+    U64 realtime = KSystem::getSystemTimeAsMicroSeconds() * 1000;
+    U64 tsc = 0;
+    U32 mult = 0;
+    U32 shift = 0;
+    U32 flags = 0;
+
+#ifndef BOXEDWINE_MULTI_THREADED
+    // the scheduler updates the page before each thread runs
+    flags |= VDSO_TIME_FLAG_COARSE;
+#endif
+#ifdef BOXEDWINE_VDSO_TSC
+    tsc = readGuestTsc();
+    if (getTscScale(tsc, monotonic, &mult, &shift)) {
+        flags |= VDSO_TIME_FLAG_TSC;
+        if (*(U32*)(page + VDSO_TIME_FLAGS) & VDSO_TIME_FLAG_TSC) {
+            // with the old values the guest might have already seen a time later than what the host just returned,
+            // monotonic time can't go backwards
+            U64 ticks = tsc - *(U64*)(page + VDSO_TIME_TSC);
+            if (ticks <= 0xFFFFFFFF) {
+                U64 seen = readTimePageTime(page + VDSO_TIME_MONOTONIC) + ((ticks * *(U32*)(page + VDSO_TIME_MULT)) >> *(U32*)(page + VDSO_TIME_SHIFT));
+                if (seen > monotonic) {
+                    monotonic = seen;
+                }
+            }
+        }
+    }
+#endif
+
+    // the vdso will retry while the sequence is odd or if it changed while it was reading
+    volatile U32* seq = (volatile U32*)(page + VDSO_TIME_SEQ);
+    U32 nextSeq = (*seq | 1) + 1;
+    *seq = nextSeq - 1;
+    std::atomic_thread_fence(std::memory_order_release);
+    *(U32*)(page + VDSO_TIME_FLAGS) = flags;
+    *(U64*)(page + VDSO_TIME_TSC) = tsc;
+    *(U32*)(page + VDSO_TIME_MULT) = mult;
+    *(U32*)(page + VDSO_TIME_SHIFT) = shift;
+    writeTimePageTime(page + VDSO_TIME_MONOTONIC, monotonic);
+    writeTimePageTime(page + VDSO_TIME_REALTIME, realtime);
+    std::atomic_thread_fence(std::memory_order_release);
+    *seq = nextSeq;
+    return monotonic;
+}
+
 U32 KSystem::clock_gettime(U32 clock_id, U32 tp) {    
+    U64 monotonic = KSystem::updateTimePage(KThread::currentThread()->memory);
     if (clock_id==0 || clock_id==5) { // CLOCK_REALTIME / CLOCK_REALTIME_COARSE
         U64 m = KSystem::getSystemTimeAsMicroSeconds();
         writed(tp, (U32)(m / 1000000l));
         writed(tp + 4, (U32)(m % 1000000l) * 1000);
     } else if (clock_id==1 || clock_id==2 || clock_id==4 || clock_id==6) { // CLOCK_MONOTONIC_RAW, CLOCK_PROCESS_CPUTIME_ID , CLOCK_MONOTONIC_COARSE
-        U64 diff = KSystem::getMicroCounter();
-        writed(tp, (U32)(diff / 1000000l));
-        writed(tp + 4, (U32)(diff % 1000000l) * 1000);
+        // the same time the vdso would have returned
+        writed(tp, (U32)(monotonic / 1000000000l));
+        writed(tp + 4, (U32)(monotonic % 1000000000l));
     } else {
         kpanic("Unknown clock id for clock_gettime: %d",clock_id);
     }
@@ -201,15 +343,15 @@ U32 KSystem::clock_gettime(U32 clock_id, U32 tp) {
 }
 
 U32 KSystem::clock_gettime64(U32 clock_id, U32 tp) {
+    U64 monotonic = KSystem::updateTimePage(KThread::currentThread()->memory);
     if (clock_id == 0 || clock_id == 5) { // CLOCK_REALTIME / CLOCK_REALTIME_COARSE
         U64 m = KSystem::getSystemTimeAsMicroSeconds();
         writeq(tp, m / 1000000l);
-        writed(tp + 4, (U32)(m % 1000000l) * 1000);
+        writeq(tp + 8, (U32)(m % 1000000l) * 1000);
     }
     else if (clock_id == 1 || clock_id == 2 || clock_id == 4 || clock_id == 6) { // CLOCK_MONOTONIC_RAW, CLOCK_PROCESS_CPUTIME_ID , CLOCK_MONOTONIC_COARSE
-        U64 diff = KSystem::getMicroCounter();
-        writeq(tp, diff / 1000000l);
-        writed(tp + 4, (U32)(diff % 1000000l) * 1000);
+        writeq(tp, monotonic / 1000000000l);
+        writeq(tp + 8, monotonic % 1000000000l);
     }
     else {
         kpanic("Unknown clock id for clock_gettime64: %d", clock_id);
@@ -225,7 +367,7 @@ U32 KSystem::clock_getres(U32 clk_id, U32 timespecAddress) {
 
 U32 KSystem::clock_getres64(U32 clk_id, U32 timespecAddress) {
     writeq(timespecAddress, 0);
-    writed(timespecAddress + 4, 1000000);
+    writeq(timespecAddress + 8, 1000000);
     return 0;
 }
 
@@ -446,6 +588,7 @@ U32 KSystem::getpgid(U32 pid) {
 }
 
 U32 KSystem::gettimeofday(U32 tv, U32 tz) {
+    KSystem::updateTimePage(KThread::currentThread()->memory);
     U64 m = Platform::getSystemTimeAsMicroSeconds();
     
     writed(tv, (U32)(m / 1000000l));
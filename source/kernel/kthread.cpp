@@ -24,14 +24,13 @@
 #include "ksignal.h"
 #include <string.h>
 #include <setjmp.h>
+#include <thread>
 
-#ifdef BOXEDWINE_BINARY_TRANSLATOR
+#if defined(BOXEDWINE_BINARY_TRANSLATOR) || defined(BOXEDWINE_WORKER_THREADS)
 THREAD_LOCAL
 #endif
 KThread* KThread::runningThread;
 
-BOXEDWINE_MUTEX KThread::futexesMutex;
-
 KThread::~KThread() {    
     this->cleanup();
     CPU* cpu = this->cpu;
@@ -131,9 +130,19 @@ KThread::KThread(U32 id, const std::shared_ptr<KProcess>& process) :
     userTime(0),
     kernelTime(0),
     inSysCall(0),
+    nice(0),
+    schedPolicy(K_SCHED_OTHER),
+    schedPriority(0),
+    cpuAffinity(0),
+    yieldSpinCount(0),
+    lastYieldTime(0),
+#ifndef BOXEDWINE_MULTI_THREADED
+    interactive(true),
+#endif
     waitingForSignalToEndCond(B("KThread::waitingForSignalToEndCond")),
     waitingForSignalToEndMaskToRestore(0),
     pendingSignals(0),
+    pendingWork(0),
     hasContextBeenMadeCurrentSinceCreation(false),
     glContext(0),
     currentContext(0),
@@ -143,6 +152,11 @@ KThread::KThread(U32 id, const std::shared_ptr<KProcess>& process) :
 #ifndef BOXEDWINE_MULTI_THREADED
     scheduledThreadNode(this),
     waitThreadNode(this),            
+#ifdef BOXEDWINE_WORKER_THREADS
+    schedulerWorker(0),
+    schedulerRunning(false),
+    mainWorkerOnly(false),
+#endif
 #endif
     condStartWaitTime(0),
     sleepCond(B("KThread::sleepCond"))
@@ -213,6 +227,7 @@ U32 KThread::signal(U32 signal, bool wait) {
                     BOXEDWINE_CRITICAL_SECTION_WITH_MUTEX(this->pendingSignalsMutex);
                     this->pendingSignals |= ((U64)1 << (signal - 1));
                 }
+                this->addPendingWork(KTHREAD_WORK_SIGNAL);
                 if (signal == K_SIGQUIT && waitingCond) {
                     BOXEDWINE_CRITICAL_SECTION_WITH_MUTEX(this->waitingCondSync);
                     if (waitingCond) {
@@ -236,6 +251,7 @@ U32 KThread::signal(U32 signal, bool wait) {
     } else {
         BOXEDWINE_CRITICAL_SECTION_WITH_MUTEX(this->pendingSignalsMutex);
         this->pendingSignals |= ((U64)1 << (signal-1));
+        this->addPendingWork(KTHREAD_WORK_SIGNAL);
         this->process->signalFd(this, signal);
     }
     return 0;
@@ -243,150 +259,321 @@ U32 KThread::signal(U32 signal, bool wait) {
 
 #define FUTEX_WAIT 0
 #define FUTEX_WAKE 1
-#define FUTEX_WAIT_PRIVATE 128
-#define FUTEX_WAKE_PRIVATE 129
-#define FUTEX_WAIT_BITSET_PRIVATE 137
-#define FUTEX_WAKE_BITSET_PRIVATE 138
+#define FUTEX_REQUEUE 3
+#define FUTEX_CMP_REQUEUE 4
+#define FUTEX_WAKE_OP 5
+#define FUTEX_WAIT_BITSET 9
+#define FUTEX_WAKE_BITSET 10
+#define FUTEX_PRIVATE_FLAG 128
 #define FUTEX_CLOCK_REALTIME 256
 
-struct futex {
+#define FUTEX_BITSET_MATCH_ANY 0xFFFFFFFF
+
+#define FUTEX_OP_SET 0
+#define FUTEX_OP_ADD 1
+#define FUTEX_OP_OR 2
+#define FUTEX_OP_ANDN 3
+#define FUTEX_OP_XOR 4
+#define FUTEX_OP_OPARG_SHIFT 8
+
+#define FUTEX_OP_CMP_EQ 0
+#define FUTEX_OP_CMP_NE 1
+#define FUTEX_OP_CMP_LT 2
+#define FUTEX_OP_CMP_LE 3
+#define FUTEX_OP_CMP_GT 4
+#define FUTEX_OP_CMP_GE 5
+
+// waiters are hashed by the host address of the futex word, so futexes in shared memory work across processes.  Each
+// bucket keeps its waiters in the order they started waiting so that wakes are FIFO
+#define FUTEX_HASH_BITS 8
+
+class KFutexBucket {
 public:
-    futex() : cond(B("futex")) {}
-    KThread* thread;
-    U8* address;  
-    U32 expireTimeInMillies;
-    U32 mask;
-    bool wake;
-    BOXEDWINE_CONDITION cond;
+    BOXEDWINE_MUTEX mutex;
+    KList<KFutexWaiter*> waiters;
 };
 
-#define MAX_FUTEXES 128
+static KFutexBucket futexBuckets[1 << FUTEX_HASH_BITS];
 
-struct futex system_futex[MAX_FUTEXES];
+static KFutexBucket* getFutexBucket(U8* address) {
+    U64 key = (U64)(size_t)address >> 2;
+    return &futexBuckets[(U32)((key * 0x9E3779B97F4A7C15ull) >> (64 - FUTEX_HASH_BITS))];
+}
 
-struct futex* getFutex(KThread* thread, U8* address) {
-    int i=0;
+// buckets are always locked in the same order so that two requeues going in opposite directions can't deadlock
+static void lockFutexBuckets(KFutexBucket* bucket1, KFutexBucket* bucket2) {
+    if (bucket1 > bucket2) {
+        std::swap(bucket1, bucket2);
+    }
+    BOXEDWINE_MUTEX_LOCK(bucket1->mutex);
+    if (bucket1 != bucket2) {
+        BOXEDWINE_MUTEX_LOCK(bucket2->mutex);
+    }
+}
 
-    for (i=0;i<MAX_FUTEXES;i++) {
-        if (system_futex[i].address == address && system_futex[i].thread==thread) {
-            return &system_futex[i];
+static void unlockFutexBuckets(KFutexBucket* bucket1, KFutexBucket* bucket2) {
+    BOXEDWINE_MUTEX_UNLOCK(bucket1->mutex);
+    if (bucket1 != bucket2) {
+        BOXEDWINE_MUTEX_UNLOCK(bucket2->mutex);
+    }
+}
+
+// removes the waiter from its wait queue, returns false if a wake already removed it
+static bool dequeueFutexWaiter(KFutexWaiter* waiter) {
+#ifdef BOXEDWINE_MULTI_THREADED
+    // a requeue can move the waiter to another bucket until we hold the lock of the bucket its address belongs to
+    while (true) {
+        U8* address = waiter->address;
+        KFutexBucket* bucket = getFutexBucket(address);
+        BOXEDWINE_CRITICAL_SECTION_WITH_MUTEX(bucket->mutex);
+        if (waiter->address == address) {
+            bool queued = waiter->node.isInList();
+            waiter->node.remove();
+            return queued;
         }
     }
-    return 0;
+#else
+    bool queued = waiter->node.isInList();
+    waiter->node.remove();
+    return queued;
+#endif
 }
 
-struct futex* allocFutex(KThread* thread, U8* address, U32 millies) {
-    BOXEDWINE_CRITICAL_SECTION;
-    int i=0;
-
-    for (i=0;i<MAX_FUTEXES;i++) {
-        if (system_futex[i].thread==0) {
-            system_futex[i].thread = thread;
-            system_futex[i].address = address;
-            system_futex[i].expireTimeInMillies = millies;
-            system_futex[i].wake = false;
-            system_futex[i].mask = 0;
-            return &system_futex[i];
+// the bucket must be locked
+static U32 wakeFutexWaiters(KFutexBucket* bucket, U8* address, U32 count, U32 mask) {
+    U32 result = 0;
+    KListNode<KFutexWaiter*>* node = bucket->waiters.front();
+
+    while (node && result < count) {
+        KListNode<KFutexWaiter*>* next = node->getNext();
+        KFutexWaiter* waiter = node->data;
+
+        if (waiter->address == address && (waiter->mask & mask)) {
+            node->remove();
+            BOXEDWINE_CRITICAL_SECTION_WITH_CONDITION(waiter->cond);
+            waiter->wake = true;
+            BOXEDWINE_CONDITION_SIGNAL(waiter->cond);
+            result++;
         }
+        node = next;
     }
-    kpanic("ran out of futexes");
-    return 0;
+    return result;
 }
 
-void freeFutex(struct futex* f) {
-    f->thread = 0;
-    f->address = 0;
+// moves up to count waiters to another futex without waking them, both buckets must be locked
+static U32 requeueFutexWaiters(KFutexBucket* bucket, U8* address, KFutexBucket* toBucket, U8* toAddress, U32 count) {
+    U32 result = 0;
+    KListNode<KFutexWaiter*>* node = bucket->waiters.front();
+
+    while (node && result < count) {
+        KListNode<KFutexWaiter*>* next = node->getNext();
+        KFutexWaiter* waiter = node->data;
+
+        if (waiter->address == address) {
+            node->remove();
+            waiter->address = toAddress;
+            toBucket->waiters.addToBack(node);
+            result++;
+        }
+        node = next;
+    }
+    return result;
 }
 
-void KThread::clearFutexes() {
-    U32 i;
+static U32 futexWakeOpResult(U32 value, U32 encodedOp) {
+    S32 oparg = ((S32)(encodedOp << 8)) >> 20;
 
-    BOXEDWINE_CRITICAL_SECTION_WITH_MUTEX(KThread::futexesMutex);
-    for (i=0;i<MAX_FUTEXES;i++) {
-        if (system_futex[i].thread == this) {
-            freeFutex(&system_futex[i]);
+    if ((encodedOp >> 28) & FUTEX_OP_OPARG_SHIFT) {
+        oparg = 1 << (oparg & 31);
+    }
+    switch ((encodedOp >> 28) & 7) {
+    case FUTEX_OP_SET: return oparg;
+    case FUTEX_OP_ADD: return value + oparg;
+    case FUTEX_OP_OR: return value | oparg;
+    case FUTEX_OP_ANDN: return value & ~oparg;
+    case FUTEX_OP_XOR: return value ^ oparg;
+    }
+    return value;
+}
+
+static bool futexWakeOpCompare(U32 oldValue, U32 encodedOp) {
+    S32 value = (S32)oldValue;
+    S32 cmparg = ((S32)(encodedOp << 20)) >> 20;
+
+    switch ((encodedOp >> 24) & 15) {
+    case FUTEX_OP_CMP_EQ: return value == cmparg;
+    case FUTEX_OP_CMP_NE: return value != cmparg;
+    case FUTEX_OP_CMP_LT: return value < cmparg;
+    case FUTEX_OP_CMP_LE: return value <= cmparg;
+    case FUTEX_OP_CMP_GT: return value > cmparg;
+    case FUTEX_OP_CMP_GE: return value >= cmparg;
+    }
+    return false;
+}
+
+// other threads can change the word with lock prefixed instructions while we update it.  This touches guest memory, which
+// can fault, so it must be called before the bucket locks are taken
+static U32 futexWakeOpUpdate(U32 address, U32 encodedOp) {
+#ifdef BOXEDWINE_MULTI_THREADED
+    std::atomic<U32>* p = (std::atomic<U32>*)getPhysicalWriteAddress(address, 4);
+    if (p) {
+        U32 oldValue = p->load();
+        while (!p->compare_exchange_weak(oldValue, futexWakeOpResult(oldValue, encodedOp))) {
         }
+        return oldValue;
+    }
+#endif
+    U32 oldValue = readd(address);
+    writed(address, futexWakeOpResult(oldValue, encodedOp));
+    return oldValue;
+}
+
+void KThread::clearFutexes() {
+    if (this->futexWaiter.active) {
+        dequeueFutexWaiter(&this->futexWaiter);
+        this->futexWaiter.active = false;
     }
 }
 
-U32 KThread::futex(U32 addr, U32 op, U32 value, U32 pTime, U32 val2, U32 val3) {
+U32 KThread::futex(U32 addr, U32 op, U32 value, U32 pTime, U32 val2, U32 val3, U32 eipCount) {
     U8* ramAddress = getPhysicalReadAddress(addr, 4);
 
     if (ramAddress==0) {
         kpanic("Could not find futex address: %0.8X", addr);
     }
-    op = op & ~FUTEX_CLOCK_REALTIME;
-    if (op==FUTEX_WAIT || op==FUTEX_WAIT_PRIVATE || op == FUTEX_WAIT_BITSET_PRIVATE) {
-        struct futex* f=getFutex(this, ramAddress);
-        U32 expireTime;
-
-        if (pTime == 0) {
-            expireTime = 0xFFFFFFFF;
-        } else {
-            U32 seconds = readd(pTime);
-            U32 nano = readd(pTime + 4);
-            expireTime = seconds * 1000 + nano / 1000000 + KSystem::getMilliesSinceStart();
+    U32 cmd = op & ~(FUTEX_PRIVATE_FLAG | FUTEX_CLOCK_REALTIME);
+    if (cmd == FUTEX_WAIT || cmd == FUTEX_WAIT_BITSET) {
+        KFutexWaiter* f = &this->futexWaiter;
+
+        if (f->active && f->waitAddress != ramAddress) {
+            // the single threaded build delivers a signal to a blocked thread without unwinding the futex syscall, so this
+            // is a signal handler waiting on another futex.  The interrupted wait will be restarted when the handler returns.
+            dequeueFutexWaiter(f);
+            f->active = false;
         }
-        bool checkValue = false;
+        if (!f->active) {
+            U32 expireTime;
 
-        if (!f) {
-            checkValue = true;
-            f = allocFutex(this, ramAddress, expireTime);
-            if (op == FUTEX_WAIT_BITSET_PRIVATE) {
-                f->mask = val3;
+            if (cmd == FUTEX_WAIT_BITSET && !val3) {
+                return -K_EINVAL;
             }
+            if (pTime == 0) {
+                expireTime = 0xFFFFFFFF;
+            } else {
+                U32 seconds = readd(pTime);
+                U32 nano = readd(pTime + 4);
+                expireTime = seconds * 1000 + nano / 1000000 + KSystem::getMilliesSinceStart();
+            }
+            KFutexBucket* bucket = getFutexBucket(ramAddress);
+            BOXEDWINE_CRITICAL_SECTION_WITH_MUTEX(bucket->mutex);
+            // a waker changes the value before it takes the bucket lock, so checking it with the lock held can't miss a wake
+            if (readd(addr) != value) {
+                return -K_EWOULDBLOCK;
+            }
+            f->address = ramAddress;
+            f->waitAddress = ramAddress;
+            f->expireTimeInMillies = expireTime;
+            f->mask = (cmd == FUTEX_WAIT_BITSET) ? val3 : FUTEX_BITSET_MATCH_ANY;
+            f->wake = false;
+            f->active = true;
+            bucket->waiters.addToBack(&f->node);
         }
         while (true) {
-            BOXEDWINE_CRITICAL_SECTION_WITH_CONDITION(f->cond);
-            if (checkValue) {
-                checkValue = false;
-                if (readd(addr) != value) { // needs to be protected
-                    freeFutex(f);
-                    return -K_EWOULDBLOCK;
-                } 
-            }
-            if (this->pendingSignals) {
-                // I know this is a nested if statement, but it makes setting a break point easier
-                if (runSignals()) {
-                    return -K_CONTINUE;
+            U32 result;
+            bool signalPending = false;
+            {
+                BOXEDWINE_CRITICAL_SECTION_WITH_CONDITION(f->cond);
+                if (f->wake) {
+                    f->active = false;
+                    return 0;
                 }
-            }
-            if (f->wake) {
-                freeFutex(f);
-                return 0;
-            }            
-            if (f->expireTimeInMillies<0x7FFFFFFF) {
                 S32 diff = f->expireTimeInMillies - KSystem::getMilliesSinceStart();
-                if (diff<=0) {
-                    freeFutex(f);
-                    return -K_ETIMEDOUT;
+                if (this->pendingWork.load(std::memory_order_acquire) & KTHREAD_WORK_SIGNAL) {
+                    // the signal isn't run until we know that a wake didn't already take us off the queue
+                    signalPending = true;
+                    result = -K_CONTINUE;
+                } else if (f->expireTimeInMillies<0x7FFFFFFF && diff<=0) {
+                    result = -K_ETIMEDOUT;
+                } else {
+                    if (f->expireTimeInMillies<0x7FFFFFFF) {
+                        BOXEDWINE_CONDITION_WAIT_TIMEOUT(f->cond, (U32)diff);
+                    } else {
+                        BOXEDWINE_CONDITION_WAIT(f->cond);
+                    }
+#ifdef BOXEDWINE_MULTI_THREADED
+                    if (this->terminating) {
+                        result = -K_EINTR;
+                    } else if (KThread::currentThread()->startSignal) {
+                        KThread::currentThread()->startSignal = false;
+                        result = -K_CONTINUE;
+                    } else {
+                        continue;
+                    }
+#endif
                 }
-                BOXEDWINE_CONDITION_WAIT_TIMEOUT(f->cond, (U32)diff);
-            } else {
-                BOXEDWINE_CONDITION_WAIT(f->cond);
             }
+            // the bucket lock can't be taken while holding the condition, a wake takes them in the other order
+            f->active = false;
+            if (!dequeueFutexWaiter(f)) {
+                // woken while timing out or while a signal came in, the wake was counted so it must be reported
 #ifdef BOXEDWINE_MULTI_THREADED
-			if (this->terminating) {
-				return -K_EINTR;
-			}
-            if (KThread::currentThread()->startSignal) {
-                KThread::currentThread()->startSignal = false;
-                return -K_CONTINUE;
-            }
+                if (result == (U32)-K_CONTINUE && !signalPending) {
+                    // another thread already started the signal handler, it would return to the start of this syscall
+                    this->setSignalContextSyscallResult(0, eipCount);
+                    return -K_CONTINUE;
+                }
 #endif
-        }
-    } else if (op==FUTEX_WAKE_PRIVATE || op==FUTEX_WAKE || op==FUTEX_WAKE_BITSET_PRIVATE) {
-        int i;
-        U32 count = 0;
-        for (i=0;i<MAX_FUTEXES && count<value;i++) {
-            if (system_futex[i].address==ramAddress && !system_futex[i].wake && (op!= FUTEX_WAKE_BITSET_PRIVATE || (system_futex[i].mask & val3))) {
-                BOXEDWINE_CRITICAL_SECTION_WITH_CONDITION(system_futex[i].cond);
-                system_futex[i].wake = true;
-                BOXEDWINE_CONDITION_SIGNAL(system_futex[i].cond);
-                count++;
+                return 0; // a pending signal will be run at the next syscall
+            }
+            if (signalPending) {
+                // the syscall will be restarted after the signal handler and will check the value again
+                runSignals();
             }
+            return result;
+        }
+    } else if (cmd == FUTEX_WAKE || cmd == FUTEX_WAKE_BITSET) {
+        KFutexBucket* bucket = getFutexBucket(ramAddress);
+
+        if (cmd == FUTEX_WAKE_BITSET && !val3) {
+            return -K_EINVAL;
+        }
+        BOXEDWINE_CRITICAL_SECTION_WITH_MUTEX(bucket->mutex);
+        return wakeFutexWaiters(bucket, ramAddress, value, (cmd == FUTEX_WAKE_BITSET) ? val3 : FUTEX_BITSET_MATCH_ANY);
+    } else if (cmd == FUTEX_REQUEUE || cmd == FUTEX_CMP_REQUEUE) {
+        // pTime holds the number of waiters to requeue and val2 the address of the second futex
+        U8* ramAddress2 = getPhysicalReadAddress(val2, 4);
+
+        if (!ramAddress2) {
+            return -K_EFAULT;
+        }
+        KFutexBucket* bucket = getFutexBucket(ramAddress);
+        KFutexBucket* bucket2 = getFutexBucket(ramAddress2);
+        lockFutexBuckets(bucket, bucket2);
+        if (cmd == FUTEX_CMP_REQUEUE && readd(addr) != val3) {
+            unlockFutexBuckets(bucket, bucket2);
+            return -K_EAGAIN;
+        }
+        U32 result = wakeFutexWaiters(bucket, ramAddress, value, FUTEX_BITSET_MATCH_ANY);
+        result += requeueFutexWaiters(bucket, ramAddress, bucket2, ramAddress2, pTime);
+        unlockFutexBuckets(bucket, bucket2);
+        return result;
+    } else if (cmd == FUTEX_WAKE_OP) {
+        // pTime holds the number of waiters to wake on the second futex at val2
+        U8* ramAddress2 = getPhysicalReadAddress(val2, 4);
+
+        if (!ramAddress2) {
+            return -K_EFAULT;
         }
-        return count;
+        U32 oldValue = futexWakeOpUpdate(val2, val3);
+        KFutexBucket* bucket = getFutexBucket(ramAddress);
+        KFutexBucket* bucket2 = getFutexBucket(ramAddress2);
+        lockFutexBuckets(bucket, bucket2);
+        U32 result = wakeFutexWaiters(bucket, ramAddress, value, FUTEX_BITSET_MATCH_ANY);
+        if (futexWakeOpCompare(oldValue, val3)) {
+            result += wakeFutexWaiters(bucket2, ramAddress2, pTime, FUTEX_BITSET_MATCH_ANY);
+        }
+        unlockFutexBuckets(bucket, bucket2);
+        return result;
     } else {
         kwarn("syscall __NR_futex op %d not implemented", op);
         return -1;
@@ -415,7 +602,16 @@ void KThread::signalIllegalInstruction(int code) {
     this->runSignal(K_SIGILL, 13, 0); // blocking signal, signalfd can't handle this
 }
 
+void KThread::onSignalMaskChanged() {
+    if (this->pendingSignals || this->process->pendingSignals) {
+        this->addPendingWork(KTHREAD_WORK_SIGNAL);
+    }
+}
+
 bool KThread::runSignals() {
+    // cleared before looking at the pending signals, a signal sent while this runs will set it again
+    this->pendingWork.fetch_and(~KTHREAD_WORK_SIGNAL, std::memory_order_acq_rel);
+
     U64 todoProcess = this->process->pendingSignals & ~(this->inSignal?this->inSigMask:this->sigMask);
     U64 todoThread = this->pendingSignals & ~(this->inSignal?this->inSigMask:this->sigMask);
 
@@ -426,16 +622,18 @@ bool KThread::runSignals() {
             if ((todoProcess & ((U64)1 << i))!=0) {
                 BOXEDWINE_CRITICAL_SECTION_WITH_MUTEX(this->process->pendingSignalsMutex);
                 if ((this->process->pendingSignals & ((U64)1 << i))!=0 || i + 1 == K_SIGKILL) { // SIGKILL can't be ignored
-                    this->process->pendingSignals &= ~(1 << i);
+                    this->process->pendingSignals &= ~((U64)1 << i);
                     this->runSignal(i+1, -1, 0);
+                    this->onSignalMaskChanged(); // the handler might not mask off the rest
                     return true;
                 }
             }
             if ((todoThread & ((U64)1 << i))!=0) {
                 BOXEDWINE_CRITICAL_SECTION_WITH_MUTEX(this->pendingSignalsMutex);
                 if ((this->pendingSignals & ((U64)1 << i))!=0 || i+1 == K_SIGKILL) { // SIGKILL can't be ignored
-                    this->pendingSignals &= ~(1 << i);
+                    this->pendingSignals &= ~((U64)1 << i);
                     this->runSignal(i+1, -1, 0);
+                    this->onSignalMaskChanged(); // the handler might not mask off the rest
                     return true;
                 }
             }            
@@ -684,6 +882,7 @@ U32 KThread::sigreturn() {
 }
 
 void OPCALL onExitSignal(CPU* cpu, DecodedOp* op) {
+    BOXEDWINE_KERNEL_LOCK;
     U32 context;	
     U64 count = cpu->instructionCount;
 
@@ -708,6 +907,7 @@ void OPCALL onExitSignal(CPU* cpu, DecodedOp* op) {
         cpu->thread->sigMask = cpu->thread->waitingForSignalToEndMaskToRestore & RESTORE_SIGNAL_MASK;
         cpu->thread->waitingForSignalToEndMaskToRestore = SIGSUSPEND_RETURN;
     }
+    cpu->thread->onSignalMaskChanged();
 
     {
         BOXEDWINE_CRITICAL_SECTION_WITH_CONDITION(cpu->thread->waitingForSignalToEndCond);
@@ -829,6 +1029,15 @@ void KThread::runSignal(U32 signal, U32 trapNo, U32 errorNo) {
     }        
 }
 
+// runSignal saved the context with eip at the syscall, so the handler would return to it and restart it.  This makes the
+// syscall look like it finished with result instead.  It must be called before the handler runs
+void KThread::setSignalContextSyscallResult(U32 result, U32 eipCount) {
+    U32 context = readd(this->cpu->reg[4].u32 + 12); // pushed by runSignal after the return address, signal and info
+
+    writed(context + 0x40, result); // EAX
+    writed(context + 0x4C, readd(context + 0x4C) + eipCount); // EIP
+}
+
 // bit 0 - 0 = no page found, 1 = protection fault
 // bit 1 - 0 = read access, 1 = write access
 // bit 2 - 0 = kernel-mode access, 1 = user mode access
@@ -880,6 +1089,10 @@ void KThread::clone(KThread* from) {
     this->stackPageCount = from->stackPageCount;
     this->stackPageSize = from->stackPageSize;
     this->waitingForSignalToEndMaskToRestore = from->waitingForSignalToEndMaskToRestore;
+    this->nice = from->nice;
+    this->schedPolicy = from->schedPolicy;
+    this->schedPriority = from->schedPriority;
+    this->cpuAffinity = from->cpuAffinity;
     this->cpu->clone(from->cpu);
     this->cpu->thread = this;
 }
@@ -928,17 +1141,81 @@ U32 KThread::nanoSleep(U64 nano) {
     return Platform::nanoSleep(nano);
 }
 
+#define K_TIMER_ABSTIME 1
+
 U32 KThread::clockNanoSleep(U32 clock, U32 flags, U64 nano, U32 addressRemain) {
-    if (flags) {
-        kpanic("clockNanoSleep flags (%x) does not equal 0: this has not been implemented yet", flags);
+    if (flags & ~K_TIMER_ABSTIME) {
+        return -K_EINVAL;
     }
-    return Platform::nanoSleep(nano);
+    if (flags & K_TIMER_ABSTIME) {
+        U64 now;
+        if (clock == 0) { // CLOCK_REALTIME
+            now = KSystem::getSystemTimeAsMicroSeconds() * 1000;
+        } else {
+            now = KSystem::updateTimePage(this->memory);
+        }
+        if (nano <= now) {
+            this->condStartWaitTime = 0;
+            return 0;
+        }
+        nano -= now;
+#ifndef BOXEDWINE_MULTI_THREADED
+        // the syscall is re-entered each time the thread wakes up and nano is already what is left, so don't let
+        // sleep subtract the time since the first call again
+        this->condStartWaitTime = 0;
+#endif
+    }
+    return this->nanoSleep(nano);
+}
+
+#define YIELD_SPIN_COUNT 64 // this many sched_yield calls in a row and the thread is assumed to be polling
+#define YIELD_SPIN_MICROS 200 // yields further apart than this don't count as a spin
+#define YIELD_BACK_OFF_NANOS 500000
+
+// Wine turns Sleep(0) into sched_yield, games that wait for the next frame or for another thread with it would
+// keep a host core busy, so after a while of nothing but yielding the thread really sleeps
+U32 KThread::schedYield() {
+    U64 now = KSystem::getMicroCounter();
+
+    this->cpu->yield = true;
+#ifndef BOXEDWINE_MULTI_THREADED
+    if (this->condStartWaitTime) {
+        // the syscall was re-entered after waking up from the back off below
+        U32 result = this->conditionSleep(1);
+        this->lastYieldTime = KSystem::getMicroCounter();
+        return result;
+    }
+#endif
+    if (now > this->lastYieldTime + YIELD_SPIN_MICROS) {
+        this->yieldSpinCount = 0;
+    }
+    this->yieldSpinCount++;
+    if (this->yieldSpinCount < YIELD_SPIN_COUNT) {
+#ifdef BOXEDWINE_MULTI_THREADED
+        std::this_thread::yield();
+#endif
+        this->lastYieldTime = KSystem::getMicroCounter();
+        return 0;
+    }
+#ifdef BOXEDWINE_MULTI_THREADED
+    Platform::nanoSleep(YIELD_BACK_OFF_NANOS);
+    this->lastYieldTime = KSystem::getMicroCounter();
+    return 0;
+#else
+    // a host sleep would stop every emulated thread, instead wait on a timer so the scheduler can run the others
+    // or let the main loop idle
+    return this->conditionSleep(1);
+#endif
 }
 
 U32 KThread::sleep(U32 ms) {
     if (ms <= NUMBER_OF_MILLIES_TO_SPIN_FOR_WAIT) {
         return Platform::nanoSleep(((U64)ms) * 1000000l);
     }
+    return this->conditionSleep(ms);
+}
+
+U32 KThread::conditionSleep(U32 ms) {
     while (true) {
         if (!this->condStartWaitTime) {
             this->condStartWaitTime = KSystem::getMilliesSinceStart();
@@ -1001,6 +1278,7 @@ U32 KThread::sigprocmask(U32 how, U32 set, U32 oset, U32 sigsetSize) {
         } else {
             kpanic("sigprocmask how %d unsupported", how);
         }
+        this->onSignalMaskChanged();
     }
     return 0;
 }
@@ -1018,6 +1296,7 @@ U32 KThread::sigsuspend(U32 mask, U32 sigsetSize) {
     } else {
         klog("sigsuspend: can't handle sigsetSize=%d", sigsetSize);
     }
+    this->onSignalMaskChanged();
     BOXEDWINE_CRITICAL_SECTION_WITH_CONDITION(this->waitingForSignalToEndCond);
     BOXEDWINE_CONDITION_WAIT(this->waitingForSignalToEndCond);
 #ifdef BOXEDWINE_MULTI_THREADED
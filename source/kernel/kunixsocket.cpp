@@ -97,27 +97,32 @@ void KUnixSocketObject::waitForEvents(BOXEDWINE_CONDITION& parentCondition, U32
     bool addedLock = false;
 
     if (events & K_POLLIN) {
-        BOXEDWINE_CONDITION_SET_PARENT(this->lockCond, &parentCondition);
+        BOXEDWINE_CONDITION_ADD_PARENT(this->lockCond, &parentCondition);
         addedLock = true;
     }
     if (events & K_POLLOUT) {
         std::shared_ptr<KUnixSocketObject> con = this->connection.lock();
         if (con) {
-            BOXEDWINE_CONDITION_SET_PARENT(con->lockCond, &parentCondition);
+            BOXEDWINE_CONDITION_ADD_PARENT(con->lockCond, &parentCondition);
         } else {
             if (!addedLock) {
-                BOXEDWINE_CONDITION_SET_PARENT(this->lockCond, &parentCondition);
+                BOXEDWINE_CONDITION_ADD_PARENT(this->lockCond, &parentCondition);
                 addedLock = true;
             }
         }
     }
     if (events && ((events & ~(K_POLLIN | K_POLLOUT)) || this->listening)) {
         if (!addedLock) {
-            BOXEDWINE_CONDITION_SET_PARENT(this->lockCond, &parentCondition);
+            BOXEDWINE_CONDITION_ADD_PARENT(this->lockCond, &parentCondition);
         }
     }
     if (events == 0) {
-        BOXEDWINE_CONDITION_SET_PARENT(this->lockCond, nullptr);
+        BOXEDWINE_CONDITION_REMOVE_PARENT(this->lockCond, &parentCondition);
+        // POLLOUT waits on the connection
+        std::shared_ptr<KUnixSocketObject> con = this->connection.lock();
+        if (con) {
+            BOXEDWINE_CONDITION_REMOVE_PARENT(con->lockCond, &parentCondition);
+        }
     }
 }
 
@@ -536,10 +541,16 @@ U32 KUnixSocketObject::accept(KFileDescriptor* fd, U32 address, U32 len, U32 fla
         this->pendingConnections.pop_front();
     }
     
-
-    BOXEDWINE_CRITICAL_SECTION_WITH_CONDITION(pendingConnection->lockCond);
     std::shared_ptr<KUnixSocketObject> resultSocket = std::make_shared<KUnixSocketObject>(this->pid, domain, type, protocol);
     KFileDescriptor* result = KThread::currentThread()->process->allocFileDescriptor(resultSocket, K_O_RDWR, 0, -1, 0);
+    if (!result) {
+        // leave the connection pending so a later accept can still take it
+        BOXEDWINE_CRITICAL_SECTION_WITH_CONDITION(this->lockCond);
+        this->pendingConnections.push_front(pendingConnection);
+        return -K_EMFILE;
+    }
+
+    BOXEDWINE_CRITICAL_SECTION_WITH_CONDITION(pendingConnection->lockCond);
 
     if (flags & FD_CLOEXEC) {
         result->descriptorFlags|=FD_CLOEXEC;
@@ -811,6 +822,11 @@ U32 KUnixSocketObject::recvmsg(KFileDescriptor* fd, U32 address, U32 flags) {
 
         for (;i<hdr.msg_controllen/16 && i<msg->objects.size();i++) {
             KFileDescriptor* recvFd = thread->process->allocFileDescriptor(msg->objects[i].object, msg->objects[i].accessFlags, 0, -1, 0);
+            if (!recvFd) {
+                // out of descriptors, the rest of the passed objects are dropped like Linux does
+                writed(address + 24, hdr.msg_flags | K_MSG_CTRUNC);
+                break;
+            }
             writeCMsgHdr(hdr.msg_control + i * 16, 16, K_SOL_SOCKET, K_SCM_RIGHTS);
             writed(hdr.msg_control + i * 16 + 12, recvFd->handle);
         }
@@ -77,4 +77,22 @@ struct k_Elf32_Phdr{
 }
 );
 
+PACKED(
+struct k_Elf32_Dyn{
+    k_Elf32_Sword     d_tag;
+    k_Elf32_Word      d_val;
+}
+);
+
+PACKED(
+struct k_Elf32_Sym{
+    k_Elf32_Word      st_name;
+    k_Elf32_Addr      st_value;
+    k_Elf32_Word      st_size;
+    unsigned char     st_info;
+    unsigned char     st_other;
+    k_Elf32_Half      st_shndx;
+}
+);
+
 #endif
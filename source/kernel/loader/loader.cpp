@@ -305,3 +305,269 @@ bool ElfLoader::loadProgram(const std::shared_ptr<KProcess>& process, FsOpenNode
     process->entry = *eip; 
     return true;
 }
+
+#define PT_DYNAMIC 2
+
+#define DT_NULL 0
+#define DT_HASH 4
+#define DT_STRTAB 5
+#define DT_SYMTAB 6
+#define DT_STRSZ 10
+#define DT_SYMENT 11
+#define DT_SONAME 14
+
+#define TIME_PAGE_ADDRESS(offset) (U8)(VDSO_TIME_ADDRESS + (offset)), (U8)((VDSO_TIME_ADDRESS + (offset)) >> 8), (U8)((VDSO_TIME_ADDRESS + (offset)) >> 16), (U8)((VDSO_TIME_ADDRESS + (offset)) >> 24)
+
+// Each function reads the time page with the same retry loop the host uses to write it (see KSystem::updateTimePage),
+// anything the page can't answer, like an unknown clock id, a timezone or a page that hasn't been updated in a long
+// time, falls back to int 0x80 with the same arguments
+static const U8 vdsoCode[] = {
+    // __vdso_clock_gettime
+    0x53, // 000: push %ebx
+    0x56, // 001: push %esi
+    0x57, // 002: push %edi
+    0x8b, 0x44, 0x24, 0x10, // 003: mov 0x10(%esp),%eax
+    0xe8, 0xda, 0x00, 0x00, 0x00, // 007: call e6
+    0x72, 0x14, // 00c: jb 22
+    0xe8, 0xfd, 0x00, 0x00, 0x00, // 00e: call 110
+    0x72, 0x0d, // 013: jb 22
+    0x8b, 0x5c, 0x24, 0x14, // 015: mov 0x14(%esp),%ebx
+    0x89, 0x03, // 019: mov %eax,(%ebx)
+    0x89, 0x4b, 0x04, // 01b: mov %ecx,0x4(%ebx)
+    0x31, 0xc0, // 01e: xor %eax,%eax
+    0xeb, 0x0f, // 020: jmp 31
+    0x8b, 0x5c, 0x24, 0x10, // 022: mov 0x10(%esp),%ebx
+    0x8b, 0x4c, 0x24, 0x14, // 026: mov 0x14(%esp),%ecx
+    0xb8, 0x09, 0x01, 0x00, 0x00, // 02a: mov $0x109,%eax
+    0xcd, 0x80, // 02f: int $0x80
+    0x5f, // 031: pop %edi
+    0x5e, // 032: pop %esi
+    0x5b, // 033: pop %ebx
+    0xc3, // 034: ret
+    // __vdso_clock_gettime64
+    0x53, // 035: push %ebx
+    0x56, // 036: push %esi
+    0x57, // 037: push %edi
+    0x8b, 0x44, 0x24, 0x10, // 038: mov 0x10(%esp),%eax
+    0xe8, 0xa5, 0x00, 0x00, 0x00, // 03c: call e6
+    0x72, 0x1a, // 041: jb 5d
+    0xe8, 0xc8, 0x00, 0x00, 0x00, // 043: call 110
+    0x72, 0x13, // 048: jb 5d
+    0x8b, 0x5c, 0x24, 0x14, // 04a: mov 0x14(%esp),%ebx
+    0x89, 0x03, // 04e: mov %eax,(%ebx)
+    0x89, 0x53, 0x04, // 050: mov %edx,0x4(%ebx)
+    0x89, 0x4b, 0x08, // 053: mov %ecx,0x8(%ebx)
+    0x31, 0xc0, // 056: xor %eax,%eax
+    0x89, 0x43, 0x0c, // 058: mov %eax,0xc(%ebx)
+    0xeb, 0x0f, // 05b: jmp 6c
+    0x8b, 0x5c, 0x24, 0x10, // 05d: mov 0x10(%esp),%ebx
+    0x8b, 0x4c, 0x24, 0x14, // 061: mov 0x14(%esp),%ecx
+    0xb8, 0x93, 0x01, 0x00, 0x00, // 065: mov $0x193,%eax
+    0xcd, 0x80, // 06a: int $0x80
+    0x5f, // 06c: pop %edi
+    0x5e, // 06d: pop %esi
+    0x5b, // 06e: pop %ebx
+    0xc3, // 06f: ret
+    // __vdso_gettimeofday
+    0x53, // 070: push %ebx
+    0x56, // 071: push %esi
+    0x57, // 072: push %edi
+    0x83, 0x7c, 0x24, 0x14, 0x00, // 073: cmpl $0x0,0x14(%esp)
+    0x75, 0x2a, // 078: jne a4
+    0xbb, 0x0c, 0x00, 0x00, 0x00, // 07a: mov $0xc,%ebx
+    0x31, 0xff, // 07f: xor %edi,%edi
+    0xe8, 0x8a, 0x00, 0x00, 0x00, // 081: call 110
+    0x72, 0x1c, // 086: jb a4
+    0x8b, 0x5c, 0x24, 0x10, // 088: mov 0x10(%esp),%ebx
+    0x85, 0xdb, // 08c: test %ebx,%ebx
+    0x74, 0x10, // 08e: je a0
+    0x89, 0x03, // 090: mov %eax,(%ebx)
+    0x89, 0xc8, // 092: mov %ecx,%eax
+    0x31, 0xd2, // 094: xor %edx,%edx
+    0xb9, 0xe8, 0x03, 0x00, 0x00, // 096: mov $0x3e8,%ecx
+    0xf7, 0xf1, // 09b: div %ecx
+    0x89, 0x43, 0x04, // 09d: mov %eax,0x4(%ebx)
+    0x31, 0xc0, // 0a0: xor %eax,%eax
+    0xeb, 0x0f, // 0a2: jmp b3
+    0x8b, 0x5c, 0x24, 0x10, // 0a4: mov 0x10(%esp),%ebx
+    0x8b, 0x4c, 0x24, 0x14, // 0a8: mov 0x14(%esp),%ecx
+    0xb8, 0x4e, 0x00, 0x00, 0x00, // 0ac: mov $0x4e,%eax
+    0xcd, 0x80, // 0b1: int $0x80
+    0x5f, // 0b3: pop %edi
+    0x5e, // 0b4: pop %esi
+    0x5b, // 0b5: pop %ebx
+    0xc3, // 0b6: ret
+    // __vdso_time
+    0x53, // 0b7: push %ebx
+    0x56, // 0b8: push %esi
+    0x57, // 0b9: push %edi
+    0xbb, 0x0c, 0x00, 0x00, 0x00, // 0ba: mov $0xc,%ebx
+    0xbf, 0x01, 0x00, 0x00, 0x00, // 0bf: mov $0x1,%edi
+    0xe8, 0x47, 0x00, 0x00, 0x00, // 0c4: call 110
+    0x72, 0x0c, // 0c9: jb d7
+    0x8b, 0x4c, 0x24, 0x10, // 0cb: mov 0x10(%esp),%ecx
+    0x85, 0xc9, // 0cf: test %ecx,%ecx
+    0x74, 0x0f, // 0d1: je e2
+    0x89, 0x01, // 0d3: mov %eax,(%ecx)
+    0xeb, 0x0b, // 0d5: jmp e2
+    0x8b, 0x5c, 0x24, 0x10, // 0d7: mov 0x10(%esp),%ebx
+    0xb8, 0x0d, 0x00, 0x00, 0x00, // 0db: mov $0xd,%eax
+    0xcd, 0x80, // 0e0: int $0x80
+    0x5f, // 0e2: pop %edi
+    0x5e, // 0e3: pop %esi
+    0x5b, // 0e4: pop %ebx
+    0xc3, // 0e5: ret
+    // classify: %eax is the clock id, returns the offset of its base from VDSO_TIME_MONOTONIC in %ebx and
+    // %edi=1 for the coarse clocks, carry is set for clocks the vdso doesn't handle
+    0x31, 0xff, // 0e6: xor %edi,%edi
+    0xbb, 0x0c, 0x00, 0x00, 0x00, // 0e8: mov $0xc,%ebx
+    0x85, 0xc0, // 0ed: test %eax,%eax
+    0x74, 0x1d, // 0ef: je 10e
+    0x83, 0xf8, 0x05, // 0f1: cmp $0x5,%eax
+    0x74, 0x13, // 0f4: je 109
+    0x31, 0xdb, // 0f6: xor %ebx,%ebx
+    0x83, 0xf8, 0x01, // 0f8: cmp $0x1,%eax
+    0x74, 0x11, // 0fb: je 10e
+    0x83, 0xf8, 0x04, // 0fd: cmp $0x4,%eax
+    0x74, 0x0c, // 100: je 10e
+    0x83, 0xf8, 0x06, // 102: cmp $0x6,%eax
+    0x74, 0x02, // 105: je 109
+    0xf9, // 107: stc
+    0xc3, // 108: ret
+    0xbf, 0x01, 0x00, 0x00, 0x00, // 109: mov $0x1,%edi
+    0xf8, // 10e: clc
+    0xc3, // 10f: ret
+    // read_time: returns the seconds in %edx:%eax and the nanoseconds in %ecx, carry is set if a syscall is needed
+    0x8b, 0x35, TIME_PAGE_ADDRESS(VDSO_TIME_SEQ), // 110: mov seq,%esi
+    0xf7, 0xc6, 0x01, 0x00, 0x00, 0x00, // 116: test $0x1,%esi
+    0x75, 0xf2, // 11c: jne 110
+    0xf7, 0x05, TIME_PAGE_ADDRESS(VDSO_TIME_FLAGS), 0x01, 0x00, 0x00, 0x00, // 11e: testl $0x1,flags
+    0x74, 0x47, // 128: je 171
+    0x0f, 0x31, // 12a: rdtsc
+    0x2b, 0x05, TIME_PAGE_ADDRESS(VDSO_TIME_TSC), // 12c: sub tsc,%eax
+    0x1b, 0x15, TIME_PAGE_ADDRESS(VDSO_TIME_TSC + 4), // 132: sbb tsc+4,%edx
+    0x75, 0x67, // 138: jne 1a1
+    0x8b, 0x0d, TIME_PAGE_ADDRESS(VDSO_TIME_SHIFT), // 13a: mov shift,%ecx
+    0xf7, 0x25, TIME_PAGE_ADDRESS(VDSO_TIME_MULT), // 140: mull mult
+    0x0f, 0xad, 0xd0, // 146: shrd %cl,%edx,%eax
+    0xd3, 0xea, // 149: shr %cl,%edx
+    0x85, 0xd2, // 14b: test %edx,%edx
+    0x75, 0x52, // 14d: jne 1a1
+    0x03, 0x83, TIME_PAGE_ADDRESS(VDSO_TIME_MONOTONIC + 8), // 14f: add base+8(%ebx),%eax
+    0x83, 0xd2, 0x00, // 155: adc $0x0,%edx
+    0xb9, 0x00, 0xca, 0x9a, 0x3b, // 158: mov $0x3b9aca00,%ecx
+    0xf7, 0xf1, // 15d: div %ecx
+    0x89, 0xd1, // 15f: mov %edx,%ecx
+    0x31, 0xd2, // 161: xor %edx,%edx
+    0x03, 0x83, TIME_PAGE_ADDRESS(VDSO_TIME_MONOTONIC), // 163: add base(%ebx),%eax
+    0x13, 0x93, TIME_PAGE_ADDRESS(VDSO_TIME_MONOTONIC + 4), // 169: adc base+4(%ebx),%edx
+    0xeb, 0x22, // 16f: jmp 193
+    0x85, 0xff, // 171: test %edi,%edi
+    0x74, 0x2c, // 173: je 1a1
+    0xf7, 0x05, TIME_PAGE_ADDRESS(VDSO_TIME_FLAGS), 0x02, 0x00, 0x00, 0x00, // 175: testl $0x2,flags
+    0x74, 0x20, // 17f: je 1a1
+    0x8b, 0x83, TIME_PAGE_ADDRESS(VDSO_TIME_MONOTONIC), // 181: mov base(%ebx),%eax
+    0x8b, 0x93, TIME_PAGE_ADDRESS(VDSO_TIME_MONOTONIC + 4), // 187: mov base+4(%ebx),%edx
+    0x8b, 0x8b, TIME_PAGE_ADDRESS(VDSO_TIME_MONOTONIC + 8), // 18d: mov base+8(%ebx),%ecx
+    0x3b, 0x35, TIME_PAGE_ADDRESS(VDSO_TIME_SEQ), // 193: cmp seq,%esi
+    0x0f, 0x85, 0x71, 0xff, 0xff, 0xff, // 199: jne 110
+    0xf8, // 19f: clc
+    0xc3, // 1a0: ret
+    0xf9, // 1a1: stc
+    0xc3, // 1a2: ret
+};
+
+#define VDSO_CODE_OFFSET 0x200
+
+static const struct {
+    const char* name;
+    U32 offset;
+} vdsoSymbols[] = {
+    {"__vdso_clock_gettime", 0x0},
+    {"__vdso_clock_gettime64", 0x35},
+    {"__vdso_gettimeofday", 0x70},
+    {"__vdso_time", 0xb7}
+};
+
+#define VDSO_SYMBOL_COUNT (sizeof(vdsoSymbols) / sizeof(vdsoSymbols[0]))
+
+// a shared library linked at 0 that only has what ld.so looks at for the vdso: a PT_LOAD, a PT_DYNAMIC, a hash table and
+// the dynamic symbols.  There are no relocations and no symbol versions, ld.so accepts unversioned symbols when it
+// looks up LINUX_2.6
+void ElfLoader::writeVDSO(U8* page) {
+    memset(page, 0, K_PAGE_SIZE);
+
+    const U32 dynCount = 7;
+    const U32 symCount = VDSO_SYMBOL_COUNT + 1; // symbol 0 is always the undefined symbol
+    const U32 phdrPos = sizeof(struct k_Elf32_Ehdr);
+    const U32 dynPos = phdrPos + 2 * sizeof(struct k_Elf32_Phdr);
+    const U32 hashPos = dynPos + dynCount * sizeof(struct k_Elf32_Dyn);
+    const U32 symPos = hashPos + (3 + symCount) * sizeof(U32); // nbucket, nchain, 1 bucket and a chain entry per symbol
+    const U32 strPos = symPos + symCount * sizeof(struct k_Elf32_Sym);
+
+    // string table
+    U32 strLen = 1;
+    const U32 sonameIndex = strLen;
+    strcpy((char*)page + strPos + strLen, "linux-gate.so.1");
+    strLen += (U32)strlen("linux-gate.so.1") + 1;
+
+    // symbols, they all go in the one hash bucket
+    U32* hash = (U32*)(page + hashPos);
+    hash[0] = 1;
+    hash[1] = symCount;
+    hash[2] = 1;
+    for (U32 i = 0; i < VDSO_SYMBOL_COUNT; i++) {
+        struct k_Elf32_Sym* sym = (struct k_Elf32_Sym*)(page + symPos) + i + 1;
+        sym->st_name = strLen;
+        sym->st_value = VDSO_CODE_OFFSET + vdsoSymbols[i].offset;
+        sym->st_info = 0x12; // STB_GLOBAL, STT_FUNC
+        sym->st_shndx = 1; // anything other than SHN_UNDEF or SHN_ABS so that ld.so adds the load address
+        strcpy((char*)page + strPos + strLen, vdsoSymbols[i].name);
+        strLen += (U32)strlen(vdsoSymbols[i].name) + 1;
+        hash[3 + i + 1] = (i + 2 < symCount) ? i + 2 : 0;
+    }
+    if (strPos + strLen > VDSO_CODE_OFFSET || VDSO_CODE_OFFSET + sizeof(vdsoCode) > K_PAGE_SIZE) {
+        kpanic("ElfLoader::writeVDSO vdso doesn't fit in a page");
+    }
+    memcpy(page + VDSO_CODE_OFFSET, vdsoCode, sizeof(vdsoCode));
+
+    struct k_Elf32_Dyn* dyn = (struct k_Elf32_Dyn*)(page + dynPos);
+    dyn[0].d_tag = DT_HASH; dyn[0].d_val = hashPos;
+    dyn[1].d_tag = DT_STRTAB; dyn[1].d_val = strPos;
+    dyn[2].d_tag = DT_SYMTAB; dyn[2].d_val = symPos;
+    dyn[3].d_tag = DT_STRSZ; dyn[3].d_val = strLen;
+    dyn[4].d_tag = DT_SYMENT; dyn[4].d_val = sizeof(struct k_Elf32_Sym);
+    dyn[5].d_tag = DT_SONAME; dyn[5].d_val = sonameIndex;
+    dyn[6].d_tag = DT_NULL; dyn[6].d_val = 0;
+
+    struct k_Elf32_Phdr* phdr = (struct k_Elf32_Phdr*)(page + phdrPos);
+    phdr[0].p_type = PT_LOAD;
+    phdr[0].p_filesz = K_PAGE_SIZE;
+    phdr[0].p_memsz = K_PAGE_SIZE;
+    phdr[0].p_flags = 5; // PF_R | PF_X
+    phdr[0].p_align = K_PAGE_SIZE;
+    phdr[1].p_type = PT_DYNAMIC;
+    phdr[1].p_offset = dynPos;
+    phdr[1].p_vaddr = dynPos;
+    phdr[1].p_paddr = dynPos;
+    phdr[1].p_filesz = dynCount * sizeof(struct k_Elf32_Dyn);
+    phdr[1].p_memsz = dynCount * sizeof(struct k_Elf32_Dyn);
+    phdr[1].p_flags = 4; // PF_R
+    phdr[1].p_align = 4;
+
+    struct k_Elf32_Ehdr* hdr = (struct k_Elf32_Ehdr*)page;
+    hdr->e_ident[0] = 0x7F;
+    hdr->e_ident[1] = 'E';
+    hdr->e_ident[2] = 'L';
+    hdr->e_ident[3] = 'F';
+    hdr->e_ident[4] = 1; // ELFCLASS32
+    hdr->e_ident[5] = 1; // ELFDATA2LSB
+    hdr->e_ident[6] = 1; // EV_CURRENT
+    hdr->e_type = 3; // ET_DYN
+    hdr->e_machine = 3; // EM_386
+    hdr->e_version = 1;
+    hdr->e_phoff = phdrPos;
+    hdr->e_ehsize = sizeof(struct k_Elf32_Ehdr);
+    hdr->e_phentsize = sizeof(struct k_Elf32_Phdr);
+    hdr->e_phnum = 2;
+}
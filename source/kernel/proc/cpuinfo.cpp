@@ -26,12 +26,7 @@
 FsOpenNode* openCpuInfo(const BoxedPtr<FsNode>& node, U32 flags, U32 data) {
 	static BString result;
 	if (result.length() == 0) {
-		U32 count = Platform::getCpuCount();
-#ifdef BOXEDWINE_MULTI_THREADED
-		if (KSystem::cpuAffinityCountForApp != 0 && KSystem::cpuAffinityCountForApp < count) {
-			count = KSystem::cpuAffinityCountForApp;
-		}
-#endif
+		U32 count = KSystem::getCpuCount();
 		for (U32 i = 0; i < count; i++) {
 			result += "processor	: "; result += i; result += "\n";
 			result += "vendor_id	: GenuineIntel\n";
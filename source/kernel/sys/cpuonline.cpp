@@ -3,7 +3,7 @@
 #include "bufferaccess.h"
 
 FsOpenNode* openSysCpuOnline(const BoxedPtr<FsNode>& node, U32 flags, U32 data) {
-    int count = Platform::getCpuCount();
+    int count = (int)KSystem::getCpuCount();
     if (count<2) {
         return new BufferAccess(node, flags, B("0"));
     }
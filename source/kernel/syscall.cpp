@@ -25,8 +25,10 @@
 
 #include <stdarg.h>
 #include <random>
-#include <thread>
 
+#ifdef BOXEDWINE_WORKER_THREADS
+THREAD_LOCAL
+#endif
 U64 sysCallTime;
 extern struct Block emptyBlock;
 //#undef LOG_SYSCALLS
@@ -489,12 +491,45 @@ static U32 syscall_fchmod(CPU* cpu, U32 eipCount) {
     return result;
 }
 
+// on Linux a pid passed to the priority and scheduler syscalls refers to a single thread
+static KThread* getSchedulerThread(CPU* cpu, U32 pid) {
+    if (!pid) {
+        return cpu->thread;
+    }
+    return KSystem::getThreadById(pid);
+}
+
+static U32 syscall_getpriority(CPU* cpu, U32 eipCount) {
+    U32 result = 20;
+    if (ARG1 == 0) { // PRIO_PROCESS
+        KThread* thread = getSchedulerThread(cpu, ARG2);
+        if (thread) {
+            result = 20 - thread->nice; // the kernel returns 20-nice so that the result is never negative
+        } else {
+            result = -K_ESRCH;
+        }
+    }
+    SYS_LOG1(SYSCALL_SYSTEM, cpu, "getpriority: which=%d, who=%d result=%d(0x%X)\n", ARG1, ARG2, result, result);
+    return result;
+}
+
 static U32 syscall_setpriority(CPU* cpu, U32 eipCount) {	    
-#ifdef _DEBUG
-    klog("setpriority not implemented");
-#endif
     U32 result = 0;
-    SYS_LOG1(SYSCALL_SYSTEM, cpu, "setpriority: which=%d, who=%d, prio=%d result=%d(0x%X) IGNORED\n", ARG1, ARG2, ARG3, result, result);
+    if (ARG1 == 0) { // PRIO_PROCESS
+        KThread* thread = getSchedulerThread(cpu, ARG2);
+        if (thread) {
+            S32 nice = (S32)ARG3;
+            if (nice < -20) {
+                nice = -20;
+            } else if (nice > 19) {
+                nice = 19;
+            }
+            thread->nice = nice;
+        } else {
+            result = -K_ESRCH;
+        }
+    }
+    SYS_LOG1(SYSCALL_SYSTEM, cpu, "setpriority: which=%d, who=%d, prio=%d result=%d(0x%X)\n", ARG1, ARG2, ARG3, result, result);
     return result;
 }
 
@@ -767,34 +802,88 @@ static U32 syscall_mlock(CPU* cpu, U32 eipCount) {
     return result;
 }
 
+static bool isValidSchedulerPriority(U32 policy, U32 priority) {
+    if (policy == K_SCHED_FIFO || policy == K_SCHED_RR) {
+        return priority >= 1 && priority <= 99;
+    }
+    return priority == 0;
+}
+
+static U32 syscall_sched_setparam(CPU* cpu, U32 eipCount) {
+    U32 result = 0;
+    KThread* thread = getSchedulerThread(cpu, ARG1);
+    if (!ARG2) {
+        result = -K_EINVAL;
+    } else if (!thread) {
+        result = -K_ESRCH;
+    } else {
+        U32 priority = readd(ARG2);
+        if (isValidSchedulerPriority(thread->schedPolicy, priority)) {
+            thread->schedPriority = priority;
+        } else {
+            result = -K_EINVAL;
+        }
+    }
+    SYS_LOG1(SYSCALL_SYSTEM, cpu, "sched_setparam: pid=%d params=%X result=%d(0x%X)\n", ARG1, ARG2, result, result);
+    return result;
+}
+
 static U32 syscall_sched_getparam(CPU* cpu, U32 eipCount) {    
-    U32 result = -K_EPERM;
-    SYS_LOG1(SYSCALL_SYSTEM, cpu, "sched_getparam: pid=%d params=%X result=%d(0x%X) IGNORED\n", ARG1, ARG2, result, result);
+    U32 result = 0;
+    KThread* thread = getSchedulerThread(cpu, ARG1);
+    if (!ARG2) {
+        result = -K_EINVAL;
+    } else if (!thread) {
+        result = -K_ESRCH;
+    } else {
+        writed(ARG2, thread->schedPriority);
+    }
+    SYS_LOG1(SYSCALL_SYSTEM, cpu, "sched_getparam: pid=%d params=%X result=%d(0x%X)\n", ARG1, ARG2, result, result);
+    return result;
+}
+
+static U32 syscall_sched_setscheduler(CPU* cpu, U32 eipCount) {
+    U32 result = 0;
+    U32 policy = ARG2 & ~K_SCHED_RESET_ON_FORK;
+    KThread* thread = getSchedulerThread(cpu, ARG1);
+    if (!ARG3 || (policy != K_SCHED_OTHER && policy != K_SCHED_FIFO && policy != K_SCHED_RR && policy != K_SCHED_BATCH && policy != K_SCHED_IDLE)) {
+        result = -K_EINVAL;
+    } else if (!thread) {
+        result = -K_ESRCH;
+    } else {
+        U32 priority = readd(ARG3);
+        if (isValidSchedulerPriority(policy, priority)) {
+            thread->schedPolicy = policy;
+            thread->schedPriority = priority;
+        } else {
+            result = -K_EINVAL;
+        }
+    }
+    SYS_LOG1(SYSCALL_SYSTEM, cpu, "sched_setscheduler: pid=%d policy=%d params=%X result=%d(0x%X)\n", ARG1, ARG2, ARG3, result, result);
     return result;
 }
 
 static U32 syscall_sched_getscheduler(CPU* cpu, U32 eipCount) {    
-    U32 result = 0; // SCHED_OTHER
-    SYS_LOG1(SYSCALL_SYSTEM, cpu, "sched_getscheduler: pid=%d params=%X result=%d(0x%X) IGNORED\n", ARG1, ARG2, result, result);
+    KThread* thread = getSchedulerThread(cpu, ARG1);
+    U32 result = thread ? thread->schedPolicy : -K_ESRCH;
+    SYS_LOG1(SYSCALL_SYSTEM, cpu, "sched_getscheduler: pid=%d result=%d(0x%X)\n", ARG1, result, result);
     return result;
 }
 
 static U32 syscall_sched_yield(CPU* cpu, U32 eipCount) {    
-    cpu->yield = true;
-    U32 result = 0;
-    std::this_thread::yield();
+    U32 result = cpu->thread->schedYield();
     SYS_LOG1(SYSCALL_SYSTEM, cpu, "yield: result=%d(0x%X)\n", result, result);
     return result;
 }
 
 static U32 syscall_sched_get_priority_max(CPU* cpu, U32 eipCount) {    
-    U32 result = 32;
+    U32 result = (ARG1 == K_SCHED_FIFO || ARG1 == K_SCHED_RR) ? 99 : 0;
     SYS_LOG1(SYSCALL_SYSTEM, cpu, "sched_get_priority_max: policy=%d result=%d(0x%X)\n", ARG1, result, result);
     return result;
 }
 
 static U32 syscall_sched_get_priority_min(CPU* cpu, U32 eipCount) {
-    U32 result = 0;
+    U32 result = (ARG1 == K_SCHED_FIFO || ARG1 == K_SCHED_RR) ? 1 : 0;
     SYS_LOG1(SYSCALL_SYSTEM, cpu, "sched_get_priority_min: policy=%d result=%d(0x%X)\n", ARG1, result, result);
     return result;
 }
@@ -1156,6 +1245,9 @@ static const char* getFutexOp(U32 op) {
     if (op==1) return "WAKE";
     if (op==128) return "WAIT PRIVATE";
     if (op==129) return "WAKE PRIVATE";
+    if (op == 131) return "REQUEUE PRIVATE";
+    if (op == 132) return "CMP REQUEUE PRIVATE";
+    if (op == 133) return "WAKE OP PRIVATE";
     if (op == 137) return "WAIT BITSET PRIVATE";
     if (op == 138) return "WAKE BITSET PRIVATE";
     static BString tmp;
@@ -1165,23 +1257,63 @@ static const char* getFutexOp(U32 op) {
 
 static U32 syscall_futex(CPU* cpu, U32 eipCount) {
     SYS_LOG1(SYSCALL_FUTEX, cpu, "futex start: address=%X op=%s value=%d\n", ARG1, getFutexOp(ARG2), ARG3);
-    U32 result = cpu->thread->futex(ARG1, ARG2, ARG3, ARG4, ARG5, ARG6);
+    U32 result = cpu->thread->futex(ARG1, ARG2, ARG3, ARG4, ARG5, ARG6, eipCount);
     SYS_LOG1(SYSCALL_FUTEX, cpu, "futex   end: address=%X op=%s value=%d result=%d(0x%X)\n", ARG1, getFutexOp(ARG2), ARG3, result, result);
     return result;
 }
 
+static U64 getAllCpusMask() {
+    U32 count = KSystem::getCpuCount();
+    return count >= 64 ? ~(U64)0 : (((U64)1 << count) - 1);
+}
+
 static U32 syscall_sched_setaffinity(CPU* cpu, U32 eipCount) {    
     U32 result = 0;
-    SYS_LOG1(SYSCALL_SYSTEM, cpu, "sched_setaffinity: pid=%d cpusetsize=d cpu_set_t=%X result=%d(0x%X) IGNORED\n", ARG1, ARG2, ARG3, result, result);
+    KThread* thread = getSchedulerThread(cpu, ARG1);
+    if (!thread) {
+        result = -K_ESRCH;
+    } else {
+        U64 mask = 0;
+        if (ARG2 >= 8) {
+            mask = readq(ARG3);
+        } else if (ARG2 >= 4) {
+            mask = readd(ARG3);
+        }
+        mask &= getAllCpusMask();
+        if (!mask) {
+            result = -K_EINVAL;
+        } else {
+            thread->cpuAffinity = mask;
+#ifdef BOXEDWINE_MULTI_THREADED
+            if (!thread->process->isSystemProcess()) {
+                Platform::setCpuAffinityMaskForThread(thread, mask);
+            }
+#endif
+        }
+    }
+    SYS_LOG1(SYSCALL_SYSTEM, cpu, "sched_setaffinity: pid=%d cpusetsize=%d cpu_set_t=%X result=%d(0x%X)\n", ARG1, ARG2, ARG3, result, result);
     return result;
 }
 
+// like the kernel this returns the number of bytes written, glibc clears the rest of the caller's cpu_set_t
 static U32 syscall_sched_getaffinity(CPU* cpu, U32 eipCount) {    
-#ifdef _DEBUG
-     kwarn("__NR_sched_getaffinity not implemented");
-#endif
-    U32 result = -K_EPERM;
-    SYS_LOG1(SYSCALL_SYSTEM, cpu, "sched_getaffinity: pid=%d cpusetsize=%d mask=%X result=%d(0x%X) IGNORED\n", ARG1, ARG2, ARG3, result, result);
+    U32 result;
+    KThread* thread = getSchedulerThread(cpu, ARG1);
+    U32 len = KSystem::getCpuCount() > 32 ? 8 : 4;
+    if (ARG2 < len) {
+        result = -K_EINVAL;
+    } else if (!thread) {
+        result = -K_ESRCH;
+    } else {
+        U64 mask = thread->cpuAffinity ? thread->cpuAffinity : getAllCpusMask();
+        if (len == 8) {
+            writeq(ARG3, mask);
+        } else {
+            writed(ARG3, (U32)mask);
+        }
+        result = len;
+    }
+    SYS_LOG1(SYSCALL_SYSTEM, cpu, "sched_getaffinity: pid=%d cpusetsize=%d mask=%X result=%d(0x%X)\n", ARG1, ARG2, ARG3, result, result);
     return result;
 }
 
@@ -1698,7 +1830,7 @@ static const SyscallFunc syscallFunc[] = {
     syscall_ftruncate,  // 93 __NR_ftruncate
     syscall_fchmod,     // 94 __NR_fchmod
     0,                  // 95
-    0,                  // 96
+    syscall_getpriority,// 96 __NR_getpriority
     syscall_setpriority,// 97 __NR_setpriority
     0,                  // 98
     syscall_statfs,     // 99 __NR_statfs
@@ -1756,9 +1888,9 @@ static const SyscallFunc syscallFunc[] = {
     0,                  // 151
     0,                  // 152
     0,                  // 153
-    0,                  // 154
+    syscall_sched_setparam, // 154 __NR_sched_setparam
     syscall_sched_getparam, // 155 __NR_sched_getparam
-    0,                  // 156
+    syscall_sched_setscheduler, // 156 __NR_sched_setscheduler
     syscall_sched_getscheduler, // 157 __NR_sched_getscheduler
     syscall_sched_yield,// 158 __NR_sched_yield
     syscall_sched_get_priority_max, // 159 __NR_sched_get_priority_max
@@ -2017,21 +2149,24 @@ static const SyscallFunc syscallFunc[] = {
     syscall_utimensat_time64 // 412
 };
 
-#ifndef BOXEDWINE_MULTI_THREADED
+#ifdef BOXEDWINE_WORKER_THREADS
+extern THREAD_LOCAL S32 contextTime; // about the # instruction per 10 ms on this scheduler worker
+#elif !defined(BOXEDWINE_MULTI_THREADED)
 extern S32 contextTime; // about the # instruction per 10 ms
 #endif
 void ksyscall(CPU* cpu, U32 eipCount) {
+    BOXEDWINE_KERNEL_LOCK;
     U32 result;
 #ifdef BOXEDWINE_MULTI_THREADED 
     U32 syscallNo = EAX;
 #endif
-    if (cpu->thread->terminating) {
-        terminateCurrentThread(cpu->thread); // there is a race condition, just signal it again
-		return;
-    }
-    if (cpu->thread->pendingSignals) {
-        // I know this is a nested if statement, but it makes setting a break point easier
-        if (cpu->thread->runSignals()) {
+    U32 pendingWork = cpu->thread->pendingWork.load(std::memory_order_acquire);
+    if (pendingWork) {
+        if (pendingWork & KTHREAD_WORK_TERMINATE) {
+            terminateCurrentThread(cpu->thread); // there is a race condition, just signal it again
+            return;
+        }
+        if ((pendingWork & KTHREAD_WORK_SIGNAL) && cpu->thread->runSignals()) {
             cpu->nextBlock = NULL;
             return;
         }
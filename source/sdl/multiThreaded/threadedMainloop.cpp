@@ -22,6 +22,11 @@ bool isMainthread() {
 }
 bool doMainLoop() {
     isMainThread = true;
+    if (KSystem::mainThreadCpu >= 0 && KSystem::mainThreadCpu < 64) {
+        if (!Platform::setCpuAffinityMaskForCurrentThread((U64)1 << KSystem::mainThreadCpu)) {
+            klog("could not pin the main thread to cpu %d", KSystem::mainThreadCpu);
+        }
+    }
     while (platformThreadCount) {
         U32 timeout = 5000;
         U32 t = KSystem::getMilliesSinceStart();
@@ -12,9 +12,13 @@
 
 static U32 lastTitleUpdate = 0;
 bool isMainthread() {
+#ifdef BOXEDWINE_WORKER_THREADS
+    return isMainSchedulerWorker();
+#else
     return true;
+#endif
 }
-bool doMainLoop() {
+static bool runMainLoop() {
     bool shouldQuit = false;
 
     while (KSystem::getProcessCount()>0 && !shouldQuit) {
@@ -52,11 +56,44 @@ bool doMainLoop() {
             if (KSystem::getRunningProcessCount()==0) {
                 break;
             }
-            if (!checkWaitingNativeSockets(20)) {
-                KNativeThread::sleep(20);
+            // don't sleep past the next timer, a thread in nanosleep or a poll timeout would otherwise wake up late
+            U32 timeout = getNextTimer();
+            if (timeout > 20) {
+                timeout = 20;
+            }
+#ifdef BOXEDWINE_WORKER_THREADS
+            if (KSystem::schedulerWorkers > 1) {
+                // another worker can wake up a thread that only the main thread runs, so this waits on the scheduler
+                // instead of in select and polls the native sockets every millisecond while there are any
+                if (checkWaitingNativeSockets(0) && timeout) {
+                    timeout = 1;
+                }
+                waitForScheduledThread(timeout);
+                continue;
+            }
+#endif
+            if (!checkWaitingNativeSockets((int)timeout) && timeout) {
+                KNativeThread::sleep(timeout);
             }
         }
     }
     return true;
 }
+
+bool doMainLoop() {
+#ifdef BOXEDWINE_WORKER_THREADS
+    bool result;
+
+    startSchedulerWorkers();
+    {
+        // the main thread only lets go of the kernel lock while it runs guest code or waits
+        BOXEDWINE_KERNEL_LOCK;
+        result = runMainLoop();
+    }
+    stopSchedulerWorkers();
+    return result;
+#else
+    return runMainLoop();
+#endif
+}
 #endif
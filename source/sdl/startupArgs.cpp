@@ -36,6 +36,10 @@
 #include MKDIR_INCLUDE
 #include CURDIR_INCLUDE
 
+#ifdef BOXEDWINE_WORKER_THREADS
+#include <thread>
+#endif
+
 #define mdev(x,y) ((x << 8) | y)
 
 void gl_init(BString allowExtensions);
@@ -220,6 +224,21 @@ std::vector<BString> StartUpArgs::buildArgs() {
         args.push_back(B("-cpuAffinity"));
         args.push_back(BString::valueOf(cpuAffinity));
     }
+    if (mainThreadCpu >= 0) {
+        args.push_back(B("-mainThreadCpu"));
+        args.push_back(BString::valueOf(mainThreadCpu));
+    }
+    if (hugePages) {
+        args.push_back(B("-hugePages"));
+    }
+    if (fileReadAheadPages >= 0) {
+        args.push_back(B("-fileReadAheadPages"));
+        args.push_back(BString::valueOf(fileReadAheadPages));
+    }
+    if (workers != 1) {
+        args.push_back(B("-workers"));
+        args.push_back(BString::valueOf(workers));
+    }
     if (pollRate > 0) {
         args.push_back(B("-pollRate"));
         args.push_back(BString::valueOf(this->pollRate));
@@ -254,6 +273,33 @@ bool StartUpArgs::apply() {
     if (KSystem::cpuAffinityCountForApp) {
         klog("CPU Affinity set to %d", KSystem::cpuAffinityCountForApp);
     }
+    KSystem::mainThreadCpu = this->mainThreadCpu;
+#endif
+#ifdef BOXEDWINE_64BIT_MMU
+    KSystem::useHugePages = this->hugePages;
+#endif
+#ifdef BOXEDWINE_DEFAULT_MMU
+    if (this->fileReadAheadPages >= 0) {
+        // the window is aligned to its size, so it needs to be a power of 2
+        U32 pages = 1;
+        while ((int)(pages << 1) <= this->fileReadAheadPages && pages < 0x1000) {
+            pages <<= 1;
+        }
+        KSystem::fileReadAheadPages = this->fileReadAheadPages ? pages : 0;
+    }
+#endif
+#ifdef BOXEDWINE_WORKER_THREADS
+    if (this->workers > 0) {
+        KSystem::schedulerWorkers = this->workers;
+    } else {
+        KSystem::schedulerWorkers = std::max(1u, std::thread::hardware_concurrency());
+    }
+#ifdef BOXEDWINE_RECORDER
+    // a recording only plays back the same way if the threads run in the same order
+    if (this->recordAutomation.length() || this->runAutomation.length()) {
+        KSystem::schedulerWorkers = 1;
+    }
+#endif
 #endif
     KSystem::pentiumLevel = this->pentiumLevel;
     KSystem::pollRate = this->pollRate;
@@ -342,6 +388,7 @@ bool StartUpArgs::apply() {
                     BoxedPtr<FsNode> freeTypeNode = Fs::getNodeFromLocalPath(B(""), B("/usr/lib/i386-linux-gnu/libfreetype.so.6"), false);
                     if (freeTypeNode) {
                         freeTypeNode->link = B("libfreetype.so.6.12.3");
+                        Fs::invalidatePathCache();
                     }
                 }
             }
@@ -697,6 +744,33 @@ bool StartUpArgs::parseStartupArgs(int argc, const char **argv) {
             this->cpuAffinity = atoi(argv[i+1]);
 #else
             klog("ignoring -cpuAffinity");
+#endif
+            i++;
+        } else if (!strcmp(argv[i], "-mainThreadCpu") && i + 1 < argc) {
+#ifdef BOXEDWINE_MULTI_THREADED
+            this->mainThreadCpu = atoi(argv[i + 1]);
+#else
+            klog("ignoring -mainThreadCpu");
+#endif
+            i++;
+        } else if (!strcmp(argv[i], "-hugePages")) {
+#ifdef BOXEDWINE_64BIT_MMU
+            this->hugePages = true;
+#else
+            klog("ignoring -hugePages");
+#endif
+        } else if (!strcmp(argv[i], "-fileReadAheadPages") && i + 1 < argc) {
+#ifdef BOXEDWINE_DEFAULT_MMU
+            this->fileReadAheadPages = atoi(argv[i + 1]);
+#else
+            klog("ignoring -fileReadAheadPages");
+#endif
+            i++;
+        } else if (!strcmp(argv[i], "-workers") && i + 1 < argc) {
+#ifdef BOXEDWINE_WORKER_THREADS
+            this->workers = atoi(argv[i + 1]);
+#else
+            klog("ignoring -workers");
 #endif
             i++;
         } else if (!strcmp(argv[i], "-skipFrameFPS") && i+1<argc) {
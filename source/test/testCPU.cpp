@@ -103,7 +103,7 @@ void setup() {
         } else {
             U32 startHeapPage = HEAP_ADDRESS >> K_PAGE_SHIFT;
             U8* hostStart = new U8[PAGES_PER_SEG * K_PAGE_SIZE];
-            U64 offset = (U64)hostStart - HEAP_ADDRESS;
+            U64 offset = (U64)hostStart - HEAP_ADDRESS - process->memory->id;
             for (int i = 0; i < PAGES_PER_SEG; i++) {
                 process->memory->memOffsets[startHeapPage + i] = offset;
                 process->memory->flags[startHeapPage + i] = PAGE_MAPPED_HOST | PAGE_READ | PAGE_WRITE;
@@ -0,0 +1,190 @@
+#ifndef __KBITMAP_H__
+#define __KBITMAP_H__
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+// fixed size bitmap with a summary level (one bit per 64 bit word that has any bit set) so that searching for set bits can
+// skip 4096 clear bits at a time
+template <U32 bitCount>
+class KBitmap {
+public:
+    KBitmap() {
+        this->clear();
+    }
+
+    void clear() {
+        memset(this->bits, 0, sizeof(this->bits));
+        memset(this->summary, 0, sizeof(this->summary));
+    }
+
+    bool get(U32 index) const {
+        return ((this->bits[index >> 6] >> (index & 63)) & 1) != 0;
+    }
+
+    void set(U32 index, bool value) {
+        this->setWordBits(index >> 6, (U64)1 << (index & 63), value);
+    }
+
+    // whole words in the middle of the range, and their summary bits, are filled at once so that filling the entire
+    // bitmap when a process or its memory is created doesn't cost one summary update per bit
+    void setRange(U32 index, U32 count, bool value) {
+        if (!count) {
+            return;
+        }
+        U32 end = index + count;
+        U32 firstWord = index >> 6;
+        U32 lastWord = (end - 1) >> 6;
+
+        if (firstWord == lastWord) {
+            this->setWordBits(firstWord, rangeMask(index & 63, ((end - 1) & 63) + 1), value);
+            return;
+        }
+        U32 fullStart = firstWord;
+        U32 fullEnd = lastWord + 1;
+
+        if (index & 63) {
+            this->setWordBits(firstWord, rangeMask(index & 63, 64), value);
+            fullStart++;
+        }
+        if (end & 63) {
+            this->setWordBits(lastWord, rangeMask(0, end & 63), value);
+            fullEnd--;
+        }
+        if (fullStart >= fullEnd) {
+            return;
+        }
+        memset(this->bits + fullStart, value ? 0xFF : 0, (fullEnd - fullStart) * sizeof(U64));
+        U32 firstSummary = fullStart >> 6;
+        U32 lastSummary = (fullEnd - 1) >> 6;
+        for (U32 i = firstSummary; i <= lastSummary; i++) {
+            U64 mask = rangeMask(i == firstSummary ? (fullStart & 63) : 0, i == lastSummary ? ((fullEnd - 1) & 63) + 1 : 64);
+            if (value) {
+                this->summary[i] |= mask;
+            } else {
+                this->summary[i] &= ~mask;
+            }
+        }
+    }
+
+    // finds the first index >= start where count bits in a row are set in this bitmap or in other (other can be NULL).
+    // The returned index will be a multiple of align, align must be a power of 2
+    bool findRun(U32 start, U32 count, U32 align, const KBitmap* other, U32* result) const {
+        U32 i = start;
+
+        while (true) {
+            i = this->nextSet(i, other);
+            if (i >= bitCount) {
+                return false;
+            }
+            if (i & (align - 1)) {
+                i = (i + align - 1) & ~(align - 1);
+                continue;
+            }
+            if (i + count > bitCount) {
+                return false;
+            }
+            U32 end = this->nextClear(i, i + count, other);
+            if (end == i + count) {
+                *result = i;
+                return true;
+            }
+            i = end + 1;
+        }
+    }
+
+private:
+    static const U32 WORD_COUNT = bitCount / 64;
+    static const U32 SUMMARY_COUNT = (WORD_COUNT + 63) / 64;
+    static_assert((bitCount & 63) == 0, "KBitmap size must be a multiple of 64");
+
+    U64 bits[WORD_COUNT];
+    U64 summary[SUMMARY_COUNT];
+
+    // bits from start up to, but not including, end.  end can be 64
+    static U64 rangeMask(U32 start, U32 end) {
+        U64 mask = ~(U64)0 << start;
+        if (end < 64) {
+            mask &= ((U64)1 << end) - 1;
+        }
+        return mask;
+    }
+
+    void setWordBits(U32 word, U64 mask, bool value) {
+        if (value) {
+            this->bits[word] |= mask;
+            this->summary[word >> 6] |= (U64)1 << (word & 63);
+        } else {
+            this->bits[word] &= ~mask;
+            if (!this->bits[word]) {
+                this->summary[word >> 6] &= ~((U64)1 << (word & 63));
+            }
+        }
+    }
+
+    static U32 lowestBit(U64 value) {
+#if defined(__GNUC__)
+        return __builtin_ctzll(value);
+#elif defined(_M_X64) || defined(_M_ARM64)
+        unsigned long index;
+        _BitScanForward64(&index, value);
+        return index;
+#else
+        unsigned long index;
+        if ((U32)value) {
+            _BitScanForward(&index, (U32)value);
+            return index;
+        }
+        _BitScanForward(&index, (U32)(value >> 32));
+        return index + 32;
+#endif
+    }
+
+    U64 getWord(U32 word, const KBitmap* other) const {
+        return this->bits[word] | (other ? other->bits[word] : 0);
+    }
+
+    U64 getSummary(U32 index, const KBitmap* other) const {
+        return this->summary[index] | (other ? other->summary[index] : 0);
+    }
+
+    // returns bitCount if there are no more set bits
+    U32 nextSet(U32 index, const KBitmap* other) const {
+        U32 word = index >> 6;
+        if (word >= WORD_COUNT) {
+            return bitCount;
+        }
+        U64 value = this->getWord(word, other) & (~(U64)0 << (index & 63));
+        if (value) {
+            return (word << 6) + lowestBit(value);
+        }
+        word++;
+        while (word < WORD_COUNT) {
+            U32 summaryIndex = word >> 6;
+            U64 summaryValue = this->getSummary(summaryIndex, other) & (~(U64)0 << (word & 63));
+            if (summaryValue) {
+                word = (summaryIndex << 6) + lowestBit(summaryValue);
+                return (word << 6) + lowestBit(this->getWord(word, other));
+            }
+            word = (summaryIndex + 1) << 6;
+        }
+        return bitCount;
+    }
+
+    // returns limit if all the bits from index up to limit are set
+    U32 nextClear(U32 index, U32 limit, const KBitmap* other) const {
+        while (index < limit) {
+            U32 word = index >> 6;
+            U64 value = ~this->getWord(word, other) & (~(U64)0 << (index & 63));
+            if (value) {
+                U32 result = (word << 6) + lowestBit(value);
+                return result < limit ? result : limit;
+            }
+            index = (word + 1) << 6;
+        }
+        return limit;
+    }
+};
+
+#endif
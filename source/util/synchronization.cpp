@@ -9,11 +9,10 @@ BoxedWineCriticalSectionCond::~BoxedWineCriticalSectionCond() {
     this->cond->unlock();
 }
 
-BoxedWineCondition::BoxedWineCondition(BString name) : name(name), lockOwner(0), parent(nullptr) {
+BoxedWineCondition::BoxedWineCondition(BString name) : name(name), lockOwner(0), signalCallback(nullptr), signalCallbackData(nullptr) {
 }
 
-BoxedWineCondition::BoxedWineCondition() {
-    this->lockOwner = 0;
+BoxedWineCondition::BoxedWineCondition() : lockOwner(0), signalCallback(nullptr), signalCallbackData(nullptr) {
 }
 
 void BoxedWineCondition::lock() {
@@ -37,9 +36,17 @@ bool BoxedWineCondition::tryLock() {
     return false;
 }
 
+// a copy so that parentsMutex isn't held while a parent is locked, the parent might be in the middle of removing itself
+std::vector<BoxedWineCondition*> BoxedWineCondition::getParents() {
+    std::lock_guard<std::mutex> guard(this->parentsMutex);
+    return this->parents;
+}
+
 void BoxedWineCondition::signal() {
-    BoxedWineCondition* parent = this->parent;
-    if (parent) {
+    if (this->signalCallback) {
+        this->signalCallback(this->signalCallbackData);
+    }
+    for (BoxedWineCondition* parent : this->getParents()) {
         BoxedWineCondition& p = *parent;
         BOXEDWINE_CRITICAL_SECTION_WITH_CONDITION(p);
         parent->signal();
@@ -48,8 +55,10 @@ void BoxedWineCondition::signal() {
 }
 
 void BoxedWineCondition::signalAll() {
-    BoxedWineCondition* parent = this->parent;
-    if (parent) {
+    if (this->signalCallback) {
+        this->signalCallback(this->signalCallbackData);
+    }
+    for (BoxedWineCondition* parent : this->getParents()) {
         BoxedWineCondition& p = *parent;
         BOXEDWINE_CRITICAL_SECTION_WITH_CONDITION(p);
         parent->signalAll();
@@ -66,7 +75,7 @@ void BoxedWineCondition::wait(std::unique_lock<std::mutex>& lock) {
     if (thread) {
         thread->waitingCond = NULL;
     }
-    if (parent) {
+    for (BoxedWineCondition* parent : this->getParents()) {
         BoxedWineCondition& p = *parent;
         BOXEDWINE_CRITICAL_SECTION_WITH_CONDITION(p);
         parent->signalAll();
@@ -82,7 +91,7 @@ void BoxedWineCondition::waitWithTimeout(std::unique_lock<std::mutex>& lock, U32
     if (thread) {
         thread->waitingCond = NULL;
     }    
-    if (parent) {
+    for (BoxedWineCondition* parent : this->getParents()) {
         BoxedWineCondition& p = *parent;
         BOXEDWINE_CRITICAL_SECTION_WITH_CONDITION(p);
         parent->signalAll();
@@ -94,21 +103,45 @@ void BoxedWineCondition::unlock() {
     this->m.unlock();
 }
 
-void BoxedWineCondition::setParentCondition(BoxedWineCondition* parent) {
-    if (parent && this->parent) {
-        kpanic("BoxedWineCondition::setParentCondition logic error");
+void BoxedWineCondition::addParentCondition(BoxedWineCondition* parent) {
+    std::lock_guard<std::mutex> guard(this->parentsMutex);
+    if (vectorIndexOf(this->parents, parent) == -1) {
+        this->parents.push_back(parent);
     }
-    this->parent = parent;
+}
+
+void BoxedWineCondition::removeParentCondition(BoxedWineCondition* parent) {
+    std::lock_guard<std::mutex> guard(this->parentsMutex);
+    int index = vectorIndexOf(this->parents, parent);
+    if (index != -1) {
+        this->parents.erase(this->parents.begin() + index);
+    }
+}
+
+bool BoxedWineCondition::hasParentCondition() {
+    std::lock_guard<std::mutex> guard(this->parentsMutex);
+    return !this->parents.empty();
+}
+
+void BoxedWineCondition::setSignalCallback(void (*callback)(void* data), void* data) {
+    this->signalCallback = callback;
+    this->signalCallbackData = data;
 }
 
 #else 
 
+#ifdef BOXEDWINE_WORKER_THREADS
+bool BoxedWineKernelLock::enabled;
+std::mutex BoxedWineKernelLock::mutex;
+THREAD_LOCAL U32 BoxedWineKernelLock::depth;
+#endif
+
 bool BoxedWineConditionTimer::run() {
     this->cond->signalThread(true);
     return false; // signal will remove timer
 }
 
-BoxedWineCondition::BoxedWineCondition(BString name) : name(name), parent(nullptr) {
+BoxedWineCondition::BoxedWineCondition(BString name) : name(name), signalCallback(nullptr), signalCallbackData(nullptr) {
 }
 
 BoxedWineCondition::~BoxedWineCondition() {
@@ -136,16 +169,23 @@ void BoxedWineCondition::signalThread(bool all) {
 }
 
 void BoxedWineCondition::signal() {
+    if (this->signalCallback) {
+        this->signalCallback(this->signalCallbackData);
+    }
     this->signalThread(false);
-    if (parent) {
-        parent->signal();
+    // by index, a parent's signal callback could change who is watching
+    for (U32 i = 0; i < this->parents.size(); i++) {
+        this->parents[i]->signal();
     }
 }
 
 void BoxedWineCondition::signalAll() {
+    if (this->signalCallback) {
+        this->signalCallback(this->signalCallbackData);
+    }
     this->signalThread(true);
-    if (parent) {
-        parent->signalAll();
+    for (U32 i = 0; i < this->parents.size(); i++) {
+        this->parents[i]->signalAll();
     }
 }
 
@@ -158,7 +198,7 @@ U32 BoxedWineCondition::wait() {
 
 U32 BoxedWineCondition::waitWithTimeout(U32 ms) {
     KThread* thread = KThread::currentThread();
-    thread->condTimer.millies = ms + KSystem::getMilliesSinceStart();
+    thread->condTimer.micros = (U64)ms * 1000 + KSystem::getMicroCounter();
     thread->condTimer.cond = this;
     addTimer(&thread->condTimer);
     this->waitingThreads.addToBack(&KThread::currentThread()->waitThreadNode);
@@ -168,20 +208,30 @@ U32 BoxedWineCondition::waitWithTimeout(U32 ms) {
 }
  
 U32 BoxedWineCondition::waitCount() {
-    return this->waitingThreads.size() + (parent ? 1 : 0);
+    return this->waitingThreads.size() + (U32)this->parents.size();
 }
 
-void BoxedWineCondition::setParentCondition(BoxedWineCondition* parent) {
-#ifndef BOXEDWINE_MULTI_THREADED
+void BoxedWineCondition::addParentCondition(BoxedWineCondition* parent) {
     // poll is re-entrant
-    if (parent == this->parent) {
-        return;
+    if (vectorIndexOf(this->parents, parent) == -1) {
+        this->parents.push_back(parent);
     }
-#endif
-    if (parent && this->parent) {
-        kpanic("BoxedWineCondition::setParentCondition logic error");
+}
+
+void BoxedWineCondition::removeParentCondition(BoxedWineCondition* parent) {
+    int index = vectorIndexOf(this->parents, parent);
+    if (index != -1) {
+        this->parents.erase(this->parents.begin() + index);
     }
-    this->parent = parent;
+}
+
+bool BoxedWineCondition::hasParentCondition() {
+    return !this->parents.empty();
+}
+
+void BoxedWineCondition::setSignalCallback(void (*callback)(void* data), void* data) {
+    this->signalCallback = callback;
+    this->signalCallbackData = data;
 }
 
 #endif
@@ -23,14 +23,24 @@ public:
     void wait(std::unique_lock<std::mutex>& lock);
     void waitWithTimeout(std::unique_lock<std::mutex>& lock, U32 ms);
     void unlock();
-    void setParentCondition(BoxedWineCondition* parent);
+    void addParentCondition(BoxedWineCondition* parent);
+    void removeParentCondition(BoxedWineCondition* parent);
+    bool hasParentCondition();
+    void setSignalCallback(void (*callback)(void* data), void* data);
 
     const BString name;
 
     std::mutex m;
     std::condition_variable c;
     U32 lockOwner;
-    BoxedWineCondition* parent;
+    void (*signalCallback)(void* data); // called when this condition or one of its children is signaled
+    void* signalCallbackData;
+private:
+    // more than one poll/epoll can watch the same object
+    std::vector<BoxedWineCondition*> parents;
+    std::mutex parentsMutex;
+
+    std::vector<BoxedWineCondition*> getParents();
 };
 
 class BoxedWineCriticalSectionCond {
@@ -56,9 +66,11 @@ private:
 #define BOXEDWINE_CONDITION_SIGNAL_ALL(cond) cond.signalAll()
 #define BOXEDWINE_CONDITION_WAIT(cond) cond.wait(boxedWineCriticalSection)
 #define BOXEDWINE_CONDITION_WAIT_TIMEOUT(cond, t) cond.waitWithTimeout(boxedWineCriticalSection, t)
-#define BOXEDWINE_CONDITION_SET_PARENT(cond, parent) cond.setParentCondition(parent)
+#define BOXEDWINE_CONDITION_ADD_PARENT(cond, parent) cond.addParentCondition(parent)
+#define BOXEDWINE_CONDITION_REMOVE_PARENT(cond, parent) cond.removeParentCondition(parent)
 
 #define BoxedWineConditionTimer BoxedWineCondition
+#define BOXEDWINE_KERNEL_LOCK
 #else
 #define BOXEDWINE_CRITICAL_SECTION
 #define BOXEDWINE_CRITICAL_SECTION_WITH_MUTEX(csMutex)
@@ -69,6 +81,54 @@ typedef void* BOXEDWINE_MUTEX;
 #define BOXEDWINE_MUTEX_TRY_LOCK(mutex) true
 #define BOXEDWINE_MUTEX_UNLOCK(mutex)
 
+#ifdef BOXEDWINE_WORKER_THREADS
+// With more than one scheduler worker, guest code runs on several host threads at the same time, but everything else
+// in the kernel, including the soft mmu slow paths and decoding, runs while holding this one lock.  That way the rest
+// of the single threaded kernel doesn't need its own locks.  The depth is counted so that a worker can give the lock up
+// after a longjmp out of the cpu skipped the destructors, and while it waits for work.
+class BoxedWineKernelLock {
+public:
+    BoxedWineKernelLock() {lock();}
+    ~BoxedWineKernelLock() {unlock();}
+
+    static void lock() {
+        if (enabled && depth++ == 0) {
+            mutex.lock();
+        }
+    }
+    static void unlock() {
+        if (enabled && --depth == 0) {
+            mutex.unlock();
+        }
+    }
+    static U32 getDepth() {return depth;}
+    static void unlockTo(U32 to) {
+        while (depth > to) {
+            unlock();
+        }
+    }
+    // returns the depth to pass to relock
+    static U32 unlockAll() {
+        U32 result = depth;
+        unlockTo(0);
+        return result;
+    }
+    static void relock(U32 to) {
+        while (enabled && depth < to) {
+            lock();
+        }
+    }
+
+    static bool enabled; // set before the workers start, with one worker there is nothing to lock
+private:
+    static std::mutex mutex;
+    THREAD_LOCAL static U32 depth;
+};
+#define BOXEDWINE_KERNEL_LOCK BoxedWineKernelLock boxedWineKernelLock
+#else
+#define BOXEDWINE_KERNEL_LOCK
+#endif
+
 class KThread;
 class BoxedWineCondition;
 
@@ -91,12 +151,17 @@ public:
     U32 waitWithTimeout(U32 ms);
     U32 waitCount();
 
-    void setParentCondition(BoxedWineCondition* parent);
+    void addParentCondition(BoxedWineCondition* parent);
+    void removeParentCondition(BoxedWineCondition* parent);
+    bool hasParentCondition();
+    void setSignalCallback(void (*callback)(void* data), void* data);
 
     const BString name;
-    BoxedWineCondition* parent;
+    void (*signalCallback)(void* data); // called when this condition or one of its children is signaled
+    void* signalCallbackData;
 private:
     KList<KThread*> waitingThreads;    
+    std::vector<BoxedWineCondition*> parents; // more than one poll/epoll can watch the same object
 
     friend BoxedWineConditionTimer;
     void signalThread(bool all);
@@ -109,7 +174,8 @@ typedef BoxedWineCondition BOXEDWINE_CONDITION;
 #define BOXEDWINE_CONDITION_SIGNAL_ALL(cond) (cond).signalAll()
 #define BOXEDWINE_CONDITION_WAIT(cond) return (cond).wait()
 #define BOXEDWINE_CONDITION_WAIT_TIMEOUT(cond, ms) return (cond).waitWithTimeout(ms)
-#define BOXEDWINE_CONDITION_SET_PARENT(cond, parent) cond.setParentCondition(parent)
+#define BOXEDWINE_CONDITION_ADD_PARENT(cond, parent) cond.addParentCondition(parent)
+#define BOXEDWINE_CONDITION_REMOVE_PARENT(cond, parent) cond.removeParentCondition(parent)
 
 #endif
 